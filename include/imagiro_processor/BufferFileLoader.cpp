@@ -44,75 +44,70 @@ void BufferFileLoader::run() {
         return;
     }
 
-    float magnitude = 0;
-
-    double targetSampleRate = reader->sampleRate * oversampleRatio;
-
-    double ratio = oversampleRatio;
-    int nInterpSamples = (int)(ratio * (int)reader->lengthInSamples);
+    const auto numChannels = static_cast<int>(reader->numChannels);
+    const auto samplesToRead = static_cast<int>(reader->lengthInSamples);
+    const double ratio = oversampleRatio;
+    const auto nInterpSamples = static_cast<int>(ratio * samplesToRead);
 
-    buffer->buffer.clear();
-    buffer->buffer.setSize((int)reader->numChannels, nInterpSamples);
+    buffer->allocate(numChannels, nInterpSamples);
     buffer->file = fileToLoad;
-    buffer->sampleRate = reader->sampleRate;
+    buffer->sampleRate = reader->sampleRate * ratio;
 
-    juce::AudioSampleBuffer tempLoadBuffer ( reader->numChannels, reader->lengthInSamples);
-    juce::AudioSampleBuffer tempInterpBuffer ( reader->numChannels, nInterpSamples);
+    // Decoded a chunk at a time straight into the destination, so the file is only held once.
+    // Only oversampling needs somewhere to decode to first, and that's one chunk.
+    juce::AudioSampleBuffer chunkBuffer(ratio == 1 ? 0 : numChannels, ratio == 1 ? 0 : chunkSize);
+    std::vector<juce::LinearInterpolator> interpolator(static_cast<size_t>(numChannels));
+    std::vector<float*> destination(static_cast<size_t>(numChannels));
 
-    std::vector<juce::LinearInterpolator> interpolator;
-    interpolator.resize(std::min((int)reader->numChannels, buffer->buffer.getNumChannels()));
-
-    reader->read(tempLoadBuffer.getArrayOfWritePointers(), tempLoadBuffer.getNumChannels(),
-                 0, reader->lengthInSamples);
-
-    const int chunkSize = reader->lengthInSamples;
+    // Waveform overview and magnitude are measured as each chunk lands
+    auto peaks = std::make_shared<imagiro::PeakPyramid>(numChannels, nInterpSamples);
+    float magnitude = 0;
     int outN = 0;
 
-    auto samplesToRead = (int)reader->lengthInSamples;
-
-
-    for (auto n=0; n<samplesToRead; n+=std::min(samplesToRead - n, chunkSize)) {
+    for (int n = 0; n < samplesToRead; n += chunkSize) {
         if (threadShouldExit()) {
             listeners.call(&Listener::OnFileLoadError, "Exit requested");
             return;
         }
-        auto size = std::min(samplesToRead - n, chunkSize);
-        int numInputSamples = std::min(size, tempLoadBuffer.getNumSamples() - n);
-        int numOutputSamples = (int)(numInputSamples * ratio);
-
-        // interpolate
-        for (auto c = 0; c < std::min(buffer->buffer.getNumChannels(), (int) reader->numChannels); c++) {
-            if (ratio == 1) {
-                juce::FloatVectorOperations::copy(
-                    tempInterpBuffer.getWritePointer(c, outN),
-                    tempLoadBuffer.getReadPointer(c, n),
-                    numOutputSamples);
-            } else {
-                interpolator[c].process(1 / ratio, tempLoadBuffer.getReadPointer(c, n),
-                                        tempInterpBuffer.getWritePointer(c, outN),
-                                        numOutputSamples);
+
+        const auto numInputSamples = std::min(chunkSize, samplesToRead - n);
+        const auto numOutputSamples = std::min(static_cast<int>(numInputSamples * ratio), nInterpSamples - outN);
+
+        if (ratio == 1) {
+            for (int c = 0; c < numChannels; c++) destination[static_cast<size_t>(c)] = buffer->buffer.getWritePointer(c, outN);
+            reader->read(destination.data(), numChannels, n, numInputSamples);
+        } else {
+            reader->read(chunkBuffer.getArrayOfWritePointers(), numChannels, n, numInputSamples);
+            for (int c = 0; c < numChannels; c++) {
+                interpolator[static_cast<size_t>(c)].process(1 / ratio, chunkBuffer.getReadPointer(c),
+                                                             buffer->buffer.getWritePointer(c, outN),
+                                                             numOutputSamples);
             }
         }
 
-        // load into buffer
-        {
-            for (auto c = 0; c < std::min(buffer->buffer.getNumChannels(), (int) reader->numChannels); c++) {
-                buffer->buffer.copyFrom(c, outN, tempInterpBuffer.getReadPointer(c, outN),
-                                 numOutputSamples);
-            }
-            magnitude = std::max(magnitude, tempInterpBuffer.getMagnitude(outN, numOutputSamples));
+        for (int c = 0; c < numChannels; c++) {
+            magnitude = std::max(magnitude, peaks->addSamples(c, buffer->buffer.getReadPointer(c, outN),
+                                                              outN, numOutputSamples));
         }
 
         outN += numOutputSamples;
-
         progress = outN / static_cast<float>(nInterpSamples);
-        loadCompleteFlag = true;
+        loadProgressFlag = true;
     }
 
-    buffer->maxMagnitude = magnitude;
+    peaks->finish();
 
-    if (normalizeFile) {
-        buffer->buffer.applyGain(1.f / magnitude);
+    // The gain goes straight onto the measured magnitude and overview, there's nothing to re-measure
+    if (normalizeFile && magnitude > 0) {
+        const auto gain = 1.f / magnitude;
+        for (int c = 0; c < numChannels; c++) {
+            juce::FloatVectorOperations::multiply(buffer->buffer.getWritePointer(c), gain, nInterpSamples);
+        }
+        buffer->peaks = peaks->withGain(gain);
+        buffer->maxMagnitude = 1.f;
+    } else {
+        buffer->peaks = std::move(peaks);
+        buffer->maxMagnitude = magnitude;
     }
 
     loadedBuffer = buffer;
@@ -41,11 +41,15 @@ private:
 
     const int oversampleRatio = 1;
 
+    // Samples decoded per step, a multiple of PeakPyramid::baseSamplesPerPeak
+    static constexpr int chunkSize = 1 << 16;
+    static_assert(chunkSize % imagiro::PeakPyramid::baseSamplesPerPeak == 0);
+
     std::shared_ptr<imagiro::InfoBuffer> loadedBuffer {nullptr};
     std::atomic<bool> loadCompleteFlag {false};
 
-    std::atomic<float> progress;
-    std::atomic<bool> loadProgressFlag;
+    std::atomic<float> progress {0};
+    std::atomic<bool> loadProgressFlag {false};
     void timerCallback() override;
 
     void run() override;
@@ -0,0 +1,27 @@
+#pragma once
+#include <imagiro_processor/dsp/transient/Transient.h>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <vector>
+
+namespace imagiro {
+
+// Results of analysis transforms (see AnalysisTransforms.h), attached to the buffer they describe.
+// Each field is only set once the corresponding analysis has run.
+struct AnalysisMetadata {
+    std::optional<float> pitchHz;
+    std::optional<std::vector<Transient>> transients;
+};
+
+inline void to_json(nlohmann::json& j, const AnalysisMetadata& m) {
+    j = nlohmann::json::object();
+    if (m.pitchHz) j["pitchHz"] = *m.pitchHz;
+    if (m.transients) j["transients"] = *m.transients;
+}
+
+inline void from_json(const nlohmann::json& j, AnalysisMetadata& m) {
+    if (j.contains("pitchHz")) m.pitchHz = j.at("pitchHz").get<float>();
+    if (j.contains("transients")) m.transients = j.at("transients").get<std::vector<Transient>>();
+}
+
+} // namespace imagiro
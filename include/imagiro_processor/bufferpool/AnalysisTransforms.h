@@ -0,0 +1,119 @@
+#pragma once
+#include "Transform.h"
+#include <imagiro_processor/dsp/pitch/PitchDetector.h>
+#include <imagiro_processor/dsp/transient/TransientDetector.h>
+
+namespace imagiro {
+
+// Analysis transforms leave the samples alone and attach their results to InfoBuffer::analysis.
+// Like any other stage they're cached, and with a persistent cache their results are stored by
+// source content, so each file is only analyzed once. Put them before layout transforms
+// (PadTransform etc.) - positions are reported in the buffer's storage order.
+
+namespace detail {
+    inline std::shared_ptr<AnalysisMetadata> copyAnalysis(const InfoBuffer& info) {
+        return info.analysis ? std::make_shared<AnalysisMetadata>(*info.analysis)
+                             : std::make_shared<AnalysisMetadata>();
+    }
+}
+
+// Detects the dominant pitch (AnalysisMetadata::pitchHz, 0 if none was found)
+class PitchAnalysisTransform : public Transform {
+    int blockSize;
+    mutable std::string lastError;
+
+public:
+    explicit PitchAnalysisTransform(int detectorBlockSize = 4096) : blockSize(detectorBlockSize) {
+    }
+
+    bool process(juce::AudioSampleBuffer&, double&) const override {
+        return true;
+    }
+
+    bool processInfo(InfoBuffer& info) const override {
+        if (info.isStreamed()) {
+            lastError = "Can't analyze a streamed buffer";
+            return false;
+        }
+
+        PitchDetector detector(blockSize);
+        auto metadata = detail::copyAnalysis(info);
+        metadata->pitchHz = detector.detectPitchHz(info.getContentView(), info.sampleRate);
+        info.analysis = std::move(metadata);
+        return true;
+    }
+
+    bool isAnalysis() const override { return true; }
+
+    size_t getHash() const override {
+        return std::hash<std::string>{}("pitch-analysis") ^ (std::hash<int>{}(blockSize) << 1);
+    }
+
+    std::unique_ptr<Transform> clone() const override {
+        return std::make_unique<PitchAnalysisTransform>(blockSize);
+    }
+
+    std::string getDescription() const override {
+        return "Pitch analysis: " + std::to_string(blockSize);
+    }
+
+    std::string getLastError() const override { return lastError; }
+};
+
+// Detects transients (AnalysisMetadata::transients)
+class TransientAnalysisTransform : public Transform {
+    float sensitivity;
+    float lookaheadSeconds;
+    float dbThreshold;
+    mutable std::string lastError;
+
+public:
+    TransientAnalysisTransform(float sensitivity, float lookaheadSeconds = 0.2f, float dbThreshold = 3.f)
+        : sensitivity(sensitivity), lookaheadSeconds(lookaheadSeconds), dbThreshold(dbThreshold) {
+    }
+
+    bool process(juce::AudioSampleBuffer&, double&) const override {
+        return true;
+    }
+
+    bool processInfo(InfoBuffer& info) const override {
+        if (info.isStreamed()) {
+            lastError = "Can't analyze a streamed buffer";
+            return false;
+        }
+
+        TransientDetector detector(sensitivity, lookaheadSeconds);
+        detector.setSampleRate(static_cast<float>(info.sampleRate));
+        auto metadata = detail::copyAnalysis(info);
+        metadata->transients = detector.getTransients(info.getContentView(), dbThreshold);
+        info.analysis = std::move(metadata);
+        return true;
+    }
+
+    bool isAnalysis() const override { return true; }
+
+    size_t getHash() const override {
+        size_t h = std::hash<std::string>{}("transient-analysis");
+        h ^= std::hash<float>{}(sensitivity) << 1;
+        h ^= std::hash<float>{}(lookaheadSeconds) << 2;
+        h ^= std::hash<float>{}(dbThreshold) << 3;
+        return h;
+    }
+
+    std::unique_ptr<Transform> clone() const override {
+        return std::make_unique<TransientAnalysisTransform>(sensitivity, lookaheadSeconds, dbThreshold);
+    }
+
+    std::string getDescription() const override {
+        return "Transient analysis: " + std::to_string(sensitivity) + ", " + std::to_string(lookaheadSeconds)
+               + "s, " + std::to_string(dbThreshold) + "dB";
+    }
+
+    std::string getCanonicalKey() const override {
+        return "transients|" + exact(sensitivity) + "|" + exact(lookaheadSeconds) + "|" + exact(dbThreshold);
+    }
+
+    std::string getLastError() const override { return lastError; }
+};
+
+} // namespace imagiro
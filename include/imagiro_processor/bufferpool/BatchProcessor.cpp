@@ -0,0 +1,216 @@
+#include "BatchProcessor.h"
+#include "AnalysisTransforms.h"
+#include "CommonTransforms.h"
+#include <latch>
+#include <mutex>
+
+namespace imagiro {
+
+nlohmann::json BatchProcessor::Stats::toJson() const {
+    return {
+        {"filesProcessed", filesProcessed},
+        {"filesFailed", filesFailed},
+        {"audioSeconds", audioSeconds},
+        {"bytesRead", bytesRead},
+        {"bytesWritten", bytesWritten},
+        {"elapsedSeconds", elapsedSeconds},
+        {"filesPerSecond", getFilesPerSecond()},
+        {"megabytesPerSecond", getMegabytesPerSecond()},
+        {"realtimeFactor", getRealtimeFactor()}
+    };
+}
+
+BatchProcessor::BatchProcessor(FileBufferCache& cache, Options options)
+    : cache(cache), options(std::move(options)) {
+}
+
+Result<std::vector<std::unique_ptr<Transform>>> BatchProcessor::parseChain(const std::string& spec) {
+    using ChainResult = Result<std::vector<std::unique_ptr<Transform>>>;
+    std::vector<std::unique_ptr<Transform>> transforms;
+
+    juce::StringArray steps;
+    steps.addTokens(juce::String(spec), ",", "");
+    steps.trim();
+    steps.removeEmptyStrings();
+
+    for (const auto& step : steps) {
+        juce::StringArray parts;
+        parts.addTokens(step, ":", "");
+        const auto name = parts[0].trim().toLowerCase();
+        const auto numArgs = parts.size() - 1;
+
+        const auto expect = [&](int min, int max) -> std::optional<std::string> {
+            if (numArgs >= min && numArgs <= max) return std::nullopt;
+            return "Wrong number of arguments for " + name.toStdString() + " in \"" + step.toStdString() + "\"";
+        };
+
+        std::optional<std::string> error;
+        if (name == "normalize") {
+            if (!(error = expect(0, 0))) transforms.push_back(std::make_unique<NormalizeTransform>());
+        } else if (name == "gain") {
+            if (!(error = expect(1, 1))) transforms.push_back(std::make_unique<GainTransform>(parts[1].getFloatValue()));
+        } else if (name == "bandpass") {
+            if (!(error = expect(2, 2))) {
+                transforms.push_back(std::make_unique<BandpassTransform>(parts[1].getFloatValue(), parts[2].getFloatValue()));
+            }
+        } else if (name == "resample") {
+            if (!(error = expect(1, 1))) {
+                const auto rate = parts[1].getDoubleValue();
+                if (rate <= 0) error = "Invalid sample rate in \"" + step.toStdString() + "\"";
+                else transforms.push_back(std::make_unique<ResampleTransform>(rate));
+            }
+        } else if (name == "reverse") {
+            if (!(error = expect(0, 0))) transforms.push_back(std::make_unique<ReverseTransform>());
+        } else if (name == "pitch") {
+            if (!(error = expect(0, 1))) {
+                transforms.push_back(numArgs == 1 ? std::make_unique<PitchAnalysisTransform>(parts[1].getIntValue())
+                                                  : std::make_unique<PitchAnalysisTransform>());
+            }
+        } else if (name == "transients") {
+            if (!(error = expect(1, 1))) transforms.push_back(std::make_unique<TransientAnalysisTransform>(parts[1].getFloatValue()));
+        } else {
+            error = "Unknown transform \"" + name.toStdString() + "\"";
+        }
+
+        if (error) return ChainResult::unexpected_type(*error);
+    }
+
+    return transforms;
+}
+
+std::vector<juce::File> BatchProcessor::findInputFiles() const {
+    const auto wildcard = cache.afm.getWildcardForAllFormats();
+    auto found = options.inputDirectory.findChildFiles(juce::File::findFiles, options.recursive, wildcard);
+    found.sort();
+
+    std::vector<juce::File> files;
+    for (const auto& file : found) files.push_back(file);
+    return files;
+}
+
+juce::File BatchProcessor::getOutputFile(const juce::File& input) const {
+    const auto relative = input.getRelativePathFrom(options.inputDirectory);
+    return options.outputDirectory.getChildFile(relative).withFileExtension("wav");
+}
+
+BatchProcessor::Stats BatchProcessor::run(const ProgressCallback& onProgress) {
+    ScopedTimer timer;
+    cancelled = false;
+
+    const auto files = findInputFiles();
+    const auto client = cache.registerClient(options.maxResidentBytes);
+
+    Stats stats;
+    std::mutex statsMutex;
+    std::atomic<size_t> nextFile {0};
+
+    // Each worker takes the next file until there are none left, so no more than numWorkers files
+    // are ever held at once
+    const auto numWorkers = std::max(1, std::min(options.numWorkers, static_cast<int>(files.size())));
+    juce::ThreadPool workers(numWorkers);
+    std::latch done(numWorkers);
+
+    for (int w = 0; w < numWorkers; w++) {
+        workers.addJob([&] {
+            for (auto i = nextFile.fetch_add(1); i < files.size() && !cancelled; i = nextFile.fetch_add(1)) {
+                const auto& file = files[i];
+                const auto result = processFile(file, client);
+
+                size_t numDone;
+                {
+                    std::lock_guard<std::mutex> lock(statsMutex);
+                    if (result.error.empty()) {
+                        stats.filesProcessed++;
+                        stats.audioSeconds += result.audioSeconds;
+                        stats.bytesRead += static_cast<uint64_t>(file.getSize());
+                        stats.bytesWritten += result.bytesWritten;
+                    } else {
+                        stats.filesFailed++;
+                    }
+                    numDone = stats.filesProcessed + stats.filesFailed;
+                }
+
+                if (onProgress) onProgress(file, result.error, numDone, files.size());
+            }
+            done.count_down();
+        });
+    }
+    done.wait();
+
+    // Drop whatever the batch still has cached
+    cache.setClientQuota(client, 1);
+    cache.unregisterClient(client);
+    stats.elapsedSeconds = timer.getElapsedMs() / 1000.0;
+    return stats;
+}
+
+BatchProcessor::FileResult BatchProcessor::processFile(const juce::File& file, ClientId client) const {
+    FileResult result;
+
+    // Only the final result is cached, the stages before it are dropped as soon as they're used
+    auto request = cache.request(file.getFullPathName().toStdString());
+    for (const auto& transform : chain) request.transform(transform->clone());
+    request.nocache(0).client(client);
+
+    auto loaded = request.executeOnThisThread();
+    if (!loaded.has_value()) {
+        result.error = loaded.error();
+        return result;
+    }
+
+    const auto& info = **loaded;
+    if (info.isCompact() || info.isStreamed()) {
+        result.error = "Only float buffers can be written";
+        return result;
+    }
+
+    const auto output = getOutputFile(file);
+    if (!writeWav(info, output, result.error)) return result;
+    result.bytesWritten = static_cast<uint64_t>(output.getSize());
+    result.audioSeconds = info.sampleRate > 0 ? info.getLengthInSamples() / info.sampleRate : 0;
+
+    if (options.writeAnalysis && info.analysis) {
+        const auto sidecar = output.withFileExtension("json");
+        if (!sidecar.replaceWithText(nlohmann::json(*info.analysis).dump(2))) {
+            result.error = "Couldn't write " + sidecar.getFullPathName().toStdString();
+        } else {
+            result.bytesWritten += static_cast<uint64_t>(sidecar.getSize());
+        }
+    }
+
+    return result;
+}
+
+bool BatchProcessor::writeWav(const InfoBuffer& info, const juce::File& file, std::string& error) const {
+    if (!file.getParentDirectory().createDirectory()) {
+        error = "Couldn't create " + file.getParentDirectory().getFullPathName().toStdString();
+        return false;
+    }
+    file.deleteFile();
+
+    auto stream = std::make_unique<juce::FileOutputStream>(file);
+    if (stream->failedToOpen()) {
+        error = "Couldn't open " + file.getFullPathName().toStdString() + " for writing";
+        return false;
+    }
+
+    juce::WavAudioFormat wav;
+    std::unique_ptr<juce::AudioFormatWriter> writer(wav.createWriterFor(
+        stream.get(), info.sampleRate, static_cast<unsigned int>(info.buffer.getNumChannels()),
+        options.bitsPerSample, {}, 0));
+    if (!writer) {
+        error = "Can't write " + std::to_string(options.bitsPerSample) + " bit WAV at " +
+                std::to_string(info.sampleRate) + "Hz";
+        return false;
+    }
+    stream.release(); // owned by the writer now
+
+    // Guard padding isn't part of the audio
+    if (!writer->writeFromAudioSampleBuffer(info.buffer, info.padStart, info.getLengthInSamples())) {
+        error = "Failed writing " + file.getFullPathName().toStdString();
+        return false;
+    }
+    return true;
+}
+
+} // namespace imagiro
@@ -0,0 +1,97 @@
+#pragma once
+#include "FileBufferCache.h"
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace imagiro {
+
+// Runs one transform chain over every audio file in a directory and writes the results out as WAV
+// files, e.g. to normalize or resample a whole sample library offline.
+//
+// Files are processed on a pool of workers, each loading through the FileBufferCache on its own
+// thread, so a library uses every core. Only the final result of each file is cached, charged to a
+// client of its own whose quota bounds what stays resident - a worker lets go of its file once it's
+// been written.
+class BatchProcessor {
+public:
+    struct Options {
+        juce::File inputDirectory;
+        juce::File outputDirectory;
+        bool recursive = true;
+        int numWorkers = juce::SystemStats::getNumCpus();
+        int bitsPerSample = 24;
+
+        // Quota of the batch's client, see FileBufferCache::registerClient()
+        uint64_t maxResidentBytes = 512ull * 1024 * 1024;
+
+        // Write each file's AnalysisMetadata next to it as <name>.json, if the chain has analyses
+        bool writeAnalysis = true;
+    };
+
+    struct Stats {
+        size_t filesProcessed = 0;
+        size_t filesFailed = 0;
+        double audioSeconds = 0;   // of output audio written
+        uint64_t bytesRead = 0;    // input file sizes
+        uint64_t bytesWritten = 0;
+        double elapsedSeconds = 0;
+
+        double getFilesPerSecond() const { return elapsedSeconds > 0 ? static_cast<double>(filesProcessed) / elapsedSeconds : 0; }
+        double getRealtimeFactor() const { return elapsedSeconds > 0 ? audioSeconds / elapsedSeconds : 0; }
+        double getMegabytesPerSecond() const {
+            return elapsedSeconds > 0 ? static_cast<double>(bytesRead) / (1024.0 * 1024.0) / elapsedSeconds : 0;
+        }
+
+        nlohmann::json toJson() const;
+    };
+
+    // Called from the workers as each file finishes. error is empty on success.
+    using ProgressCallback = std::function<void(const juce::File& file, const std::string& error,
+                                                size_t numDone, size_t numTotal)>;
+
+    BatchProcessor(FileBufferCache& cache, Options options);
+
+    // Transforms to apply after loading, as a comma separated list, e.g.
+    // "bandpass:30:18000,normalize,gain:-1,resample:48000,pitch,transients:0.5"
+    //
+    //     normalize                  NormalizeTransform
+    //     gain:<db>                  GainTransform
+    //     bandpass:<low>:<high>      BandpassTransform
+    //     resample:<rate>            ResampleTransform
+    //     reverse                    ReverseTransform
+    //     pitch[:<block size>]       PitchAnalysisTransform
+    //     transients:<sensitivity>   TransientAnalysisTransform
+    static Result<std::vector<std::unique_ptr<Transform>>> parseChain(const std::string& spec);
+
+    void setChain(std::vector<std::unique_ptr<Transform>> transforms) { chain = std::move(transforms); }
+
+    // Audio files (anything the cache's formats can read) under the input directory
+    std::vector<juce::File> findInputFiles() const;
+
+    // Process every input file, blocking until all are done
+    Stats run(const ProgressCallback& onProgress = {});
+
+    // Stop after the files currently being processed, from any thread
+    void cancel() { cancelled = true; }
+
+private:
+    FileBufferCache& cache;
+    Options options;
+    std::vector<std::unique_ptr<Transform>> chain;
+    std::atomic<bool> cancelled {false};
+
+    // Result for one file
+    struct FileResult {
+        std::string error;
+        double audioSeconds = 0;
+        uint64_t bytesWritten = 0;
+    };
+    FileResult processFile(const juce::File& file, ClientId client) const;
+
+    juce::File getOutputFile(const juce::File& input) const;
+    bool writeWav(const InfoBuffer& info, const juce::File& file, std::string& error) const;
+};
+
+} // namespace imagiro
@@ -1,119 +1,431 @@
 #pragma once
 #include "CacheTypes.h"
+#include "CacheMetrics.h"
 #include <immer/map.hpp>
 #include <immer/atom.hpp>
 #include <atomic>
+#include <mutex>
 #include <optional>
+#include <unordered_map>
 
 namespace imagiro {
 
 // Pure cache management, thread-safe
+// Reads are lock-free; writers are serialised so the cache can be shared between plugin instances.
 class BufferCache {
 public:
     BufferCache(const uint64_t maxSize = 500 * 1024 * 1024)
         : maxCacheSize(maxSize) {}
 
     // Try to get a buffer from cache (thread-safe, non-blocking)
-    std::optional<CacheEntry> get(size_t keyHash) const {
+    // Aliases are followed, so this returns the entry holding the data.
+    std::optional<CacheEntry> get(const ChainId& id) const {
         auto currentCache = cache.load();
-        auto it = currentCache->find(keyHash);
-        if (it != nullptr) {
-            return *it;
+        auto it = find(*currentCache, id);
+        if (it == nullptr) return std::nullopt;
+
+        if (it->aliasOf) {
+            it = find(*currentCache, *it->aliasOf);
+            if (it == nullptr) return std::nullopt; // target has been evicted
         }
-        return std::nullopt;
+        return *it;
     }
 
     // Check if a key exists and is ready (thread-safe, non-blocking)
-    bool exists(size_t keyHash) const {
-        auto entry = get(keyHash);
+    bool exists(const ChainId& id) const {
+        auto entry = get(id);
         return entry.has_value() && entry->state == CacheEntryState::Ready;
     }
 
     // Get buffer if ready (thread-safe, non-blocking)
-    std::optional<std::shared_ptr<InfoBuffer>> getBuffer(size_t keyHash) const {
-        auto entry = get(keyHash);
+    std::optional<std::shared_ptr<InfoBuffer>> getBuffer(const ChainId& id) const {
+        auto entry = get(id);
         if (entry.has_value() && entry->state == CacheEntryState::Ready) {
+            metrics.hits.fetch_add(1, std::memory_order_relaxed);
             return entry->buffer;
         }
+        metrics.misses.fetch_add(1, std::memory_order_relaxed);
         return std::nullopt;
     }
 
     // Add or update entry (thread-safe)
-    void put(size_t keyHash, const CacheEntry& entry) {
-        auto currentCache = cache.load();
+    void put(const ChainId& id, CacheEntry entry) {
+        entry.canonicalKey = std::make_shared<const std::string>(id.canonical);
+        const auto& keyHash = id.hash;
 
-        // Check if replacing
-        auto existing = currentCache->find(keyHash);
-        if (existing != nullptr) {
-            currentCacheSize.fetch_sub(existing->sizeInBytes);
-        }
+        {
+            std::lock_guard lock(writeMutex);
+            auto currentCache = cache.load();
 
-        // Add new entry
-        auto newCache = currentCache->set(keyHash, entry);
-        cache.store(newCache);
-        currentCacheSize.fetch_add(entry.sizeInBytes);
+            // Check if replacing
+            auto existing = currentCache->find(keyHash);
+            if (existing != nullptr) {
+                currentCacheSize.fetch_sub(existing->sizeInBytes);
+                chargeClient(existing->owner, -static_cast<int64_t>(existing->sizeInBytes));
+            }
 
-        // Evict if needed
-        while (currentCacheSize.load() > maxCacheSize) {
-            evictLRU();
+            // Add new entry
+            auto newCache = currentCache->set(keyHash, entry);
+            cache.store(newCache);
+            currentCacheSize.fetch_add(entry.sizeInBytes);
+            chargeClient(entry.owner, static_cast<int64_t>(entry.sizeInBytes));
         }
+
+        makeRoom(entry.owner);
+    }
+
+    // Point one chain at another's entry, for chains known to produce the same samples (thread-safe)
+    void putAlias(const ChainId& id, const ChainId& target, ClientId owner = NoClient) {
+        if (id == target) return;
+        CacheEntry entry;
+        entry.state = CacheEntryState::Ready;
+        entry.owner = owner;
+        entry.aliasOf = std::make_shared<const ChainId>(target);
+        put(id, std::move(entry));
     }
 
     // Mark entry as loading (thread-safe)
-    void markLoading(size_t keyHash) {
+    void markLoading(const ChainId& id, ClientId owner = NoClient) {
         CacheEntry entry;
         entry.state = CacheEntryState::Loading;
-        put(keyHash, entry);
+        entry.owner = owner;
+        put(id, std::move(entry));
     }
 
     // Mark entry as error (thread-safe)
-    void markError(size_t keyHash, const std::string& error) {
+    void markError(const ChainId& id, const std::string& error, ClientId owner = NoClient) {
         CacheEntry entry;
         entry.state = CacheEntryState::Error;
         entry.errorMessage = error;
-        put(keyHash, entry);
+        entry.owner = owner;
+        put(id, std::move(entry));
     }
 
     // Clear cache (thread-safe)
     void clear() {
+        std::lock_guard lock(writeMutex);
+        for (const auto& [key, entry] : *cache.load()) {
+            if (isResident(entry)) {
+                metrics.recordEviction(EvictionReason::Cleared, entry.sizeInBytes);
+            }
+        }
         cache.store({});
         currentCacheSize.store(0);
+        for (auto& [id, client] : clients) client.usedBytes = 0;
     }
 
     size_t getCurrentSize() const { return currentCacheSize.load(); }
 
+    // Cold tier. Entries nobody outside the cache holds are losslessly compressed (see
+    // CompressedBuffer) once they're older than coldAfter, and eviction compresses the least recently
+    // used entry before it drops anything. Compressed entries read as misses, and are decompressed
+    // by the loader when they're requested again. Off by default.
+    void setCompression(bool enabled, std::chrono::milliseconds coldAfter = std::chrono::seconds(30)) {
+        compressionColdAfter.store(coldAfter.count());
+        compressionEnabled.store(enabled);
+    }
+
+    bool isCompressed(const ChainId& id) const {
+        auto entry = get(id);
+        return entry.has_value() && entry->state == CacheEntryState::Compressed;
+    }
+
+    // Compress the coldest entry that's due, without holding up writers while it's encoded.
+    // Returns false if there was nothing to do. Called from the loader thread when it's idle.
+    bool compressColdEntry() {
+        if (!compressionEnabled.load()) return false;
+
+        const auto coldBefore = std::chrono::steady_clock::now() -
+                                std::chrono::milliseconds(compressionColdAfter.load());
+        auto candidate = findCompressible(NoClient, coldBefore);
+        if (!candidate) return false;
+
+        auto compressed = CompressedBuffer::compress(*candidate->buffer);
+
+        std::lock_guard lock(writeMutex);
+        replaceWithCompressed(candidate->key, candidate->buffer, std::move(compressed));
+        return true;
+    }
+
+    // Decompress an entry back into memory, for a request that needs it.
+    // nullopt if it isn't compressed (any more).
+    std::optional<std::shared_ptr<InfoBuffer>> decompress(const ChainId& id) {
+        auto entry = get(id);
+        if (!entry.has_value() || entry->state != CacheEntryState::Compressed) return std::nullopt;
+
+        auto buffer = entry->compressed->decompress();
+        metrics.decompressions.fetch_add(1, std::memory_order_relaxed);
+
+        std::unique_lock lock(writeMutex);
+        auto currentCache = cache.load();
+
+        // Aliases share their target's entry
+        const auto* stored = find(*currentCache, id);
+        if (stored == nullptr) return buffer;
+        const auto target = stored->aliasOf ? *stored->aliasOf : id;
+        const auto* it = find(*currentCache, target);
+
+        // Replaced while we were decoding - the samples are still right, just don't store them
+        if (it == nullptr || it->compressed != entry->compressed) return buffer;
+
+        auto restored = *it;
+        restored.state = CacheEntryState::Ready;
+        restored.buffer = buffer;
+        restored.compressed.reset();
+        restored.sizeInBytes = buffer->getSizeInBytes();
+        restored.updateAccess();
+
+        const auto growth = static_cast<int64_t>(restored.sizeInBytes) - static_cast<int64_t>(it->sizeInBytes);
+        cache.store(currentCache->set(target.hash, restored));
+        currentCacheSize.fetch_add(static_cast<size_t>(growth));
+        chargeClient(restored.owner, growth);
+
+        lock.unlock();
+        makeRoom(restored.owner);
+        return buffer;
+    }
+
+    // Lock-free counters, see CacheMetrics
+    const CacheMetrics& getMetrics() const { return metrics; }
+
+    nlohmann::json getMetricsJson() const {
+        auto json = metrics.toJson();
+        json["residentBytes"] = getCurrentSize();
+        json["maxBytes"] = getMaxSize();
+        json["keyCollisions"] = getKeyCollisions();
+        return json;
+    }
+
+    // Lookups that hit an entry stored for a different chain with the same hash.
+    // Should stay at zero - anything else points at a bad canonical key.
+    uint64_t getKeyCollisions() const { return keyCollisions.load(); }
+
+    // Global memory budget shared by every client
+    void setMaxSize(uint64_t bytes) {
+        maxCacheSize.store(bytes);
+        makeRoom(NoClient);
+    }
+    uint64_t getMaxSize() const { return maxCacheSize.load(); }
+
+    // Per-client quotas. A quota of 0 means the client is only bound by the global budget.
+    void setClientQuota(ClientId id, uint64_t quotaBytes) {
+        {
+            std::lock_guard lock(writeMutex);
+            clients[id].quotaBytes = quotaBytes;
+        }
+        makeRoom(id);
+    }
+
+    // Forget a client. Its entries stay cached (other clients may share them) but are no longer
+    // charged to anyone's quota.
+    void releaseClient(ClientId id) {
+        std::lock_guard lock(writeMutex);
+        const auto currentCache = cache.load();
+        auto newCache = currentCache.get();
+        for (const auto& [key, entry] : *currentCache) {
+            if (entry.owner == id) {
+                auto released = entry;
+                released.owner = NoClient;
+                newCache = newCache.set(key, released);
+            }
+        }
+        cache.store(newCache);
+        clients.erase(id);
+    }
+
+    uint64_t getClientQuota(ClientId id) const {
+        std::lock_guard lock(writeMutex);
+        const auto it = clients.find(id);
+        return it != clients.end() ? it->second.quotaBytes : 0;
+    }
+
+    size_t getClientUsage(ClientId id) const {
+        std::lock_guard lock(writeMutex);
+        const auto it = clients.find(id);
+        return it != clients.end() ? it->second.usedBytes : 0;
+    }
+
 private:
-    immer::atom<immer::map<size_t, CacheEntry>> cache {};
+    using Map = immer::map<Hash128, CacheEntry, Hash128Hasher>;
+    immer::atom<Map> cache {};
+
+    mutable std::atomic<uint64_t> keyCollisions {0};
+    mutable CacheMetrics metrics;
+
+    // Find the entry for a chain, treating an entry stored for a different chain as a miss
+    const CacheEntry* find(const Map& map, const ChainId& id) const {
+        auto it = map.find(id.hash);
+        if (it == nullptr) return nullptr;
+        if (it->canonicalKey && *it->canonicalKey != id.canonical) {
+            keyCollisions.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return it;
+    }
 
     std::atomic<size_t> currentCacheSize{0};
-    uint64_t maxCacheSize;
+    std::atomic<uint64_t> maxCacheSize;
+
+    std::atomic<bool> compressionEnabled {false};
+    std::atomic<int64_t> compressionColdAfter {30000}; // ms
+
+    struct ClientUsage {
+        uint64_t quotaBytes = 0;
+        size_t usedBytes = 0;
+    };
+
+    // Guards writers and the client table, readers never take it
+    mutable std::mutex writeMutex;
+    std::unordered_map<ClientId, ClientUsage> clients;
+
+    void chargeClient(ClientId id, int64_t bytes) {
+        if (id == NoClient) return;
+        auto& usage = clients[id];
+        usage.usedBytes = static_cast<size_t>(std::max<int64_t>(0, static_cast<int64_t>(usage.usedBytes) + bytes));
+    }
+
+    bool isOverQuota(ClientId id) const {
+        if (id == NoClient) return false;
+        const auto it = clients.find(id);
+        return it != clients.end() && it->second.quotaBytes > 0 && it->second.usedBytes > it->second.quotaBytes;
+    }
+
+    // Entries that hold samples and count against the budget
+    static bool isResident(const CacheEntry& entry) {
+        return (entry.state == CacheEntryState::Ready || entry.state == CacheEntryState::Compressed) && !entry.aliasOf;
+    }
+
+    // Ready entries whose samples only the cache can see, so compressing them actually frees memory
+    bool isCompressible(const CacheEntry& entry) const {
+        if (!compressionEnabled.load() || entry.state != CacheEntryState::Ready || entry.aliasOf ||
+            entry.incompressible || !entry.buffer) return false;
+        const auto& buffer = *entry.buffer;
+        return entry.buffer.use_count() == 1 && !buffer.isShared() && !buffer.isStreamed() &&
+               !buffer.isCompact() && buffer.isFullyLoaded();
+    }
+
+    // An entry to compress. Holds its own reference to the buffer, so the samples can't go away (or
+    // their memory be reused) while they're encoded without writeMutex.
+    struct CompressionCandidate {
+        Hash128 key;
+        std::shared_ptr<InfoBuffer> buffer;
+    };
+
+    // The least recently used compressible entry, optionally restricted to one owner and to entries
+    // last used before a given time
+    std::optional<CompressionCandidate> findCompressible(
+        ClientId owner,
+        std::chrono::steady_clock::time_point usedBefore = std::chrono::steady_clock::time_point::max()) const {
+        if (!compressionEnabled.load()) return std::nullopt;
 
-    void evictLRU() {
         auto currentCache = cache.load();
-        if (currentCache->empty()) return;
+        const CacheEntry* oldest = nullptr;
+        Hash128 oldestKey;
+
+        for (const auto& [key, entry] : *currentCache) {
+            if (owner != NoClient && entry.owner != owner) continue;
+            if (!isCompressible(entry) || entry.lastAccess > usedBefore) continue;
+            if (oldest == nullptr || entry.lastAccess < oldest->lastAccess) {
+                oldest = &entry;
+                oldestKey = key;
+            }
+        }
+
+        if (oldest == nullptr) return std::nullopt;
+        return CompressionCandidate {oldestKey, oldest->buffer};
+    }
+
+    // Swap an entry's samples for their compressed form, as long as it still holds the same buffer
+    // and nobody else has picked it up while it was being encoded (the caller's reference is the
+    // only other one). A null result marks the entry so it isn't tried again. Called with writeMutex
+    // held.
+    bool replaceWithCompressed(const Hash128& key, const std::shared_ptr<InfoBuffer>& buffer,
+                               std::shared_ptr<const CompressedBuffer> compressed) {
+        auto currentCache = cache.load();
+        auto it = currentCache->find(key);
+        if (it == nullptr || it->state != CacheEntryState::Ready || it->buffer != buffer) return false;
+        if (buffer.use_count() > 2) return false;
+
+        auto updated = *it;
+        if (!compressed) {
+            updated.incompressible = true;
+            cache.store(currentCache->set(key, updated));
+            return false;
+        }
+
+        updated.state = CacheEntryState::Compressed;
+        updated.buffer.reset();
+        updated.compressed = std::move(compressed);
+        updated.sizeInBytes = updated.compressed->getSizeInBytes();
+
+        const auto saved = it->sizeInBytes - std::min(it->sizeInBytes, updated.sizeInBytes);
+        metrics.compressions.fetch_add(1, std::memory_order_relaxed);
+        metrics.compressionSavedBytes.fetch_add(saved, std::memory_order_relaxed);
+        currentCacheSize.fetch_sub(saved);
+        chargeClient(updated.owner, -static_cast<int64_t>(saved));
+        cache.store(currentCache->set(key, updated));
+        return true;
+    }
+
+    // Brings the owner back under its quota, then the cache under the global budget. The least
+    // recently used entry that can be compressed is, before anything is dropped. Entries are encoded
+    // without writeMutex, so readers and other writers aren't held up, and only swapped in if
+    // they're unchanged. Called without writeMutex held.
+    void makeRoom(ClientId owner) {
+        std::unique_lock lock(writeMutex);
+        while (true) {
+            ClientId scope;
+            if (isOverQuota(owner)) scope = owner;
+            else if (currentCacheSize.load() > maxCacheSize.load()) scope = NoClient;
+            else return;
+
+            if (auto candidate = findCompressible(scope)) {
+                lock.unlock();
+                auto compressed = CompressedBuffer::compress(*candidate->buffer);
+                lock.lock();
+
+                // Either frees memory, marks the entry as not worth it, or finds the entry has
+                // changed (and no longer a candidate), so the loop always progresses
+                replaceWithCompressed(candidate->key, candidate->buffer, std::move(compressed));
+                continue;
+            }
+
+            if (!evictLRU(scope)) return;
+        }
+    }
+
+    // Drops the least recently used ready entry, optionally restricted to one owner.
+    // Returns false if there was nothing left to evict. Called with writeMutex held.
+    bool evictLRU(ClientId owner) {
+        auto currentCache = cache.load();
+        if (currentCache->empty()) return false;
 
         // Find oldest entry that's ready (not loading)
-        size_t oldestKey = 0;
+        Hash128 oldestKey;
         auto oldestTime = std::chrono::steady_clock::now();
         bool found = false;
 
         for (const auto& [key, entry] : *currentCache) {
-            if (entry.state == CacheEntryState::Ready &&
-                entry.lastAccess < oldestTime) {
+            if (owner != NoClient && entry.owner != owner) continue;
+            if ((entry.state == CacheEntryState::Ready || entry.state == CacheEntryState::Compressed) &&
+                entry.lastAccess <= oldestTime) {
                 oldestTime = entry.lastAccess;
                 oldestKey = key;
                 found = true;
             }
         }
 
-        if (found) {
-            auto it = currentCache->find(oldestKey);
-            if (it != nullptr) {
-                currentCacheSize.fetch_sub(it->sizeInBytes);
-                auto newCache = currentCache->erase(oldestKey);
-                cache.store(newCache);
-            }
-        }
+        if (!found) return false;
+
+        auto it = currentCache->find(oldestKey);
+        if (it == nullptr) return false;
+
+        metrics.recordEviction(owner == NoClient ? EvictionReason::Budget : EvictionReason::Quota, it->sizeInBytes);
+        currentCacheSize.fetch_sub(it->sizeInBytes);
+        chargeClient(it->owner, -static_cast<int64_t>(it->sizeInBytes));
+        auto newCache = currentCache->erase(oldestKey);
+        cache.store(newCache);
+        return true;
     }
 };
 
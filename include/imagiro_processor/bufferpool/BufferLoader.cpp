@@ -1,6 +1,7 @@
 #include "BufferLoader.h"
 
 #include "CommonTransforms.h"
+#include <latch>
 
 namespace imagiro {
 
@@ -10,108 +11,337 @@ BufferLoader::BufferLoader(BufferCache& cache)
 }
 
 BufferLoader::~BufferLoader() {
+    // Graph steps may be waiting on requests the loader thread has queued, so they go first
+    branchPool.removeAllJobs(true, 4000);
     stopThread(4000);
 }
 
-Result<std::shared_ptr<InfoBuffer>> BufferLoader::requestBuffer(const CacheKey& key) {
+Result<std::shared_ptr<InfoBuffer>> BufferLoader::requestBuffer(const CacheKey& key, ClientId client) {
+    return requestBufferAsync(key, client).get(); // Block until ready
+}
+
+std::shared_future<Result<std::shared_ptr<InfoBuffer>>> BufferLoader::requestBufferAsync(
+    const CacheKey& key, ClientId client, Priority priority) {
+
     auto promise = std::make_shared<std::promise<Result<std::shared_ptr<InfoBuffer>>>>();
-    auto future = promise->get_future();
+    auto future = promise->get_future().share();
 
-    const size_t keyHash = key.getHash();
+    const auto id = key.getId();
+    const auto ready = [&](Result<std::shared_ptr<InfoBuffer>> result) {
+        promise->set_value(std::move(result));
+        return future;
+    };
 
     // Check if already in cache
-    if (auto entry = cache.get(keyHash)) {
+    if (auto entry = cache.get(id)) {
         if (entry->state == CacheEntryState::Ready) {
+            metrics.requestHits.fetch_add(1, std::memory_order_relaxed);
             listeners.call(&Listener::onBufferLoaded, key, entry->buffer);
-            return entry->buffer;
+            return ready(entry->buffer);
         } else if (entry->state == CacheEntryState::Error) {
-            return Result<std::shared_ptr<InfoBuffer>>::unexpected_type(entry->errorMessage);
+            return ready(Result<std::shared_ptr<InfoBuffer>>::unexpected_type(entry->errorMessage));
         }
         // If loading, add to waiters below
     }
 
-    // Check if already loading
-    bool alreadyLoading = false;
+    // Check if already loading, otherwise mark as loading. This has to be a single step so that
+    // two clients requesting the same chain at once only decode it once.
     {
         std::lock_guard<std::mutex> lock(activeRequestsMutex);
-        auto it = activeRequests.find(keyHash);
+
+        // Another client may have finished loading it since we checked
+        if (auto buffer = cache.getBuffer(id)) {
+            metrics.requestHits.fetch_add(1, std::memory_order_relaxed);
+            return ready(*buffer);
+        }
+
+        auto it = activeRequests.find(id.canonical);
         if (it != activeRequests.end()) {
             // Already loading, add to waiters
+            metrics.requestsJoined.fetch_add(1, std::memory_order_relaxed);
             it->second.push_back(promise);
-            alreadyLoading = true;
+            if (priority == Priority::Normal) promoteQueuedPrefetch(key, id.canonical, client);
+        } else {
+            activeRequests[id.canonical] = {promise};
+
+            // Mark in cache as loading. Compressed entries stay as they are, the loader will
+            // decompress them.
+            if (!cache.isCompressed(id)) cache.markLoading(id, client);
+
+            // Queue request
+            if (priority == Priority::Prefetch) queuedPrefetches.insert(id.canonical);
+            enqueue(LoadRequest{key, promise, client}, priority);
         }
     }
 
-    if (alreadyLoading) return future.get();
+    return future;
+}
+
+std::vector<std::shared_future<Result<std::shared_ptr<InfoBuffer>>>> BufferLoader::requestGraph(
+    std::vector<GraphStep> steps, ClientId client) {
+
+    auto evaluation = std::make_shared<GraphEvaluation>();
+    evaluation->client = client;
+    evaluation->promises.resize(steps.size());
+    evaluation->followers.resize(steps.size());
+
+    std::vector<std::shared_future<Result<std::shared_ptr<InfoBuffer>>>> futures;
+    std::vector<size_t> roots;
+    for (size_t i = 0; i < steps.size(); ++i) {
+        futures.push_back(evaluation->promises[i].get_future().share());
+        if (steps[i].after) evaluation->followers[*steps[i].after].push_back(i);
+        else roots.push_back(i);
+    }
+    evaluation->steps = std::move(steps);
+
+    for (const auto root : roots) runGraphStep(evaluation, root);
+    return futures;
+}
+
+void BufferLoader::runGraphStep(std::shared_ptr<GraphEvaluation> evaluation, size_t index) {
+    // Steps never wait for their followers, only start them, so the pool can't deadlock however
+    // few threads it has
+    branchPool.addJob([this, evaluation, index] {
+        const auto& step = evaluation->steps[index];
+        evaluation->promises[index].set_value(requestBufferOnThisThread(step.key, evaluation->client));
+
+        // A follower whose step failed still runs, and reports its own error
+        for (const auto follower : evaluation->followers[index]) runGraphStep(evaluation, follower);
+    });
+}
+
+Result<std::shared_ptr<InfoBuffer>> BufferLoader::requestBufferOnThisThread(const CacheKey& key, ClientId client) {
+    const auto id = key.getId();
+    auto promise = std::make_shared<std::promise<Result<std::shared_ptr<InfoBuffer>>>>();
+    auto future = promise->get_future();
+
+    // Same deduplication as requestBufferAsync(), except that a new load is processed right here
+    // rather than queued
+    {
+        std::lock_guard<std::mutex> lock(activeRequestsMutex);
+
+        if (auto buffer = cache.getBuffer(id)) {
+            metrics.requestHits.fetch_add(1, std::memory_order_relaxed);
+            return *buffer;
+        }
+
+        auto it = activeRequests.find(id.canonical);
+        if (it != activeRequests.end()) {
+            metrics.requestsJoined.fetch_add(1, std::memory_order_relaxed);
+            it->second.push_back(promise);
+            promise.reset();
+            promoteQueuedPrefetch(key, id.canonical, client);
+        } else {
+            activeRequests[id.canonical] = {promise};
+            if (!cache.isCompressed(id)) cache.markLoading(id, client);
+        }
+    }
 
-    // Mark as loading
-    activeRequests[keyHash] = {promise};
+    if (promise) {
+        ScopedTimer timer;
+        processRequest(LoadRequest{key, promise, client});
+        metrics.loadTime.record(timer.getElapsedMs());
+    }
 
-    // Mark in cache as loading
-    cache.markLoading(keyHash);
+    return future.get();
+}
 
-    // Queue request
-    LoadRequest request{key, promise};
-    loadQueue.enqueue(std::move(request));
+void BufferLoader::enqueue(LoadRequest&& request, Priority priority) {
+    std::lock_guard<std::mutex> enqueueLock(enqueueMutex);
+    auto& queue = priority == Priority::Prefetch ? prefetchQueue : loadQueue;
+    queue.enqueue(std::move(request));
+    metrics.queued();
     notify();
+}
 
-    return future.get(); // Block until ready
+void BufferLoader::promoteQueuedPrefetch(const CacheKey& key, const std::string& canonical, ClientId client) {
+    // The prefetch can't be taken out of its queue, so queue it again here. Whichever of the two is
+    // dequeued first loads it, and the other is skipped (see run()).
+    if (queuedPrefetches.erase(canonical) == 0) return;
+    promotedPrefetches.insert(canonical);
+    enqueue(LoadRequest{key, nullptr, client}, Priority::Normal);
 }
 
 void BufferLoader::run() {
     while (!threadShouldExit()) {
         LoadRequest request;
-        if (loadQueue.try_dequeue(request)) {
+        if (loadQueue.try_dequeue(request) || prefetchQueue.try_dequeue(request)) {
+            metrics.dequeued();
+            if (!claimQueuedRequest(request.key.getId().canonical)) continue;
+
+            ScopedTimer timer;
             processRequest(std::move(request));
-        } else {
+            metrics.loadTime.record(timer.getElapsedMs());
+        } else if (!cache.compressColdEntry()) {
+            // Compress cold entries while there's nothing to load, one at a time so new requests
+            // don't wait long
             wait(100);
         }
     }
 }
 
+bool BufferLoader::claimQueuedRequest(const std::string& canonical) {
+    std::lock_guard<std::mutex> lock(activeRequestsMutex);
+    if (auto it = staleQueueEntries.find(canonical); it != staleQueueEntries.end()) {
+        staleQueueEntries.erase(it);
+        return false;
+    }
+    if (promotedPrefetches.erase(canonical) > 0) {
+        staleQueueEntries.insert(canonical);
+    } else {
+        queuedPrefetches.erase(canonical);
+    }
+    return true;
+}
+
+void BufferLoader::setDiskCache(std::shared_ptr<DiskBufferCache> newDiskCache) {
+    std::lock_guard<std::mutex> lock(diskCacheMutex);
+    diskCache = std::move(newDiskCache);
+}
+
+std::shared_ptr<DiskBufferCache> BufferLoader::getDiskCache() {
+    std::lock_guard<std::mutex> lock(diskCacheMutex);
+    return diskCache;
+}
+
+std::optional<BufferLoader::PersistentSource> BufferLoader::getPersistentSource(const CacheKey& key) {
+    // Nothing worth persisting without at least one transform after the source
+    if (key.transforms.size() < 2) return std::nullopt;
+
+    auto disk = getDiskCache();
+    if (!disk) return std::nullopt;
+
+    const auto path = key.getSourcePath();
+    if (path.empty()) return std::nullopt;
+
+    auto id = disk->getSourceId(path);
+    if (!id) return std::nullopt;
+
+    return PersistentSource{std::move(disk), *id};
+}
+
+bool BufferLoader::isCachedStage(const CacheKey& key, size_t index) {
+    if (index == key.transforms.size()) return true;
+
+    // The float samples a CompactTransform is about to replace would take the memory it saves
+    if (dynamic_cast<const CompactTransform*>(key.transforms[index].get())) return false;
+
+    return index <= key.nocacheIndex;
+}
+
+bool BufferLoader::isPersistedStage(const CacheKey& key, size_t index) {
+    // The bare source is cheaper to decode again than to store a second copy of, and analysis
+    // stages only add metadata, which is persisted separately. Mipmaps are quicker to build again
+    // than to read back.
+    return index >= 2 && isCachedStage(key, index) && !key.transforms[index - 1]->isAnalysis() &&
+           !dynamic_cast<const MipmapTransform*>(key.transforms[index - 1].get());
+}
+
+std::vector<ChainId> BufferLoader::getStageIds(const CacheKey& key) {
+    std::vector<ChainId> ids;
+    ids.reserve(key.transforms.size() + 1);
+    for (size_t i = 0; i <= key.transforms.size(); ++i) {
+        ids.push_back(key.getPartialId(i));
+    }
+    return ids;
+}
+
+std::vector<ChainId> BufferLoader::getContentStageIds(const CacheKey& key, const Hash128& contentHash) {
+    std::vector<ChainId> ids;
+    ids.reserve(key.transforms.size() + 1);
+    ids.push_back(key.getPartialId(0));
+    for (size_t i = 1; i <= key.transforms.size(); ++i) {
+        ids.push_back(key.getContentPartialId(contentHash, i));
+    }
+    return ids;
+}
+
+Hash128 BufferLoader::hashContent(const InfoBuffer& info) {
+    Hasher128 hasher;
+    hasher.update(static_cast<uint64_t>(info.buffer.getNumChannels()));
+    hasher.update(static_cast<uint64_t>(info.buffer.getNumSamples()));
+    hasher.update(&info.sampleRate, sizeof(info.sampleRate));
+
+    const auto channelBytes = static_cast<size_t>(info.buffer.getNumSamples()) * sizeof(float);
+    for (int c = 0; c < info.buffer.getNumChannels(); c++) {
+        hasher.update(info.buffer.getReadPointer(c), channelBytes);
+    }
+    return hasher.finish();
+}
+
 void BufferLoader::processRequest(LoadRequest&& request) {
-    const size_t keyHash = request.key.getHash();
+    const auto& key = request.key;
+    const auto pathIds = getStageIds(key);
+    const auto& id = pathIds.back();
+    const auto persistent = getPersistentSource(key);
+
+    // Stages are stored under these. With content addressing they're swapped for ids based on the
+    // decoded samples once the source has been loaded, and the path ids become aliases.
+    auto ids = pathIds;
+    bool contentAddressed = false;
 
     // Find longest cached prefix
-    auto [startBuffer, startIndex] = findCachedPrefix(request.key);
+    bool fromDisk = false;
+    auto [startBuffer, startIndex] = findCachedPrefix(key, ids, persistent, request.client, &fromDisk);
+
+    if (fromDisk) metrics.diskPrefixHits.fetch_add(1, std::memory_order_relaxed);
+    else if (startIndex == key.transforms.size() && startBuffer) metrics.completeHits.fetch_add(1, std::memory_order_relaxed);
+    else if (startIndex > 0) metrics.memoryPrefixHits.fetch_add(1, std::memory_order_relaxed);
+    else metrics.coldLoads.fetch_add(1, std::memory_order_relaxed);
 
     Result<std::shared_ptr<InfoBuffer>> result;
 
     if (!startBuffer && startIndex == 0) {
-        // Need to load from file - check if first transform is LoadTransform
-        if (request.key.transforms.empty() ||
-            !dynamic_cast<LoadTransform*>(request.key.transforms[0].get())) {
-            result = Result<std::shared_ptr<InfoBuffer>>::unexpected_type("No LoadTransform found at start of chain");
+        // Need to load from file - check if first transform is a source
+        if (key.transforms.empty() || !key.transforms[0]->isSource()) {
+            result = Result<std::shared_ptr<InfoBuffer>>::unexpected_type("No source transform found at start of chain");
+        } else if (auto progressive = key.progressive ? prepareProgressive(key) : nullptr) {
+            result = loadProgressively(*progressive, request, id, persistent);
         } else {
-            // Create empty buffer for LoadTransform to fill
+            // Create empty buffer for the source to fill
             auto buffer = std::make_shared<InfoBuffer>();
             buffer->buffer = juce::AudioSampleBuffer();
-            double sampleRate = 0;
+            buffer->sampleRate = 0;
 
-            if (request.key.transforms[0]->process(buffer->buffer, sampleRate)) {
-                buffer->sampleRate = sampleRate;
+            ScopedTimer decodeTimer;
+            if (key.transforms[0]->processInfo(*buffer)) {
+                metrics.recordDecode(buffer->getSizeInBytes(), decodeTimer.getElapsedMs());
                 updateBufferMetadata(buffer);
+                buffer->moveToSharedStorage();
+                startBuffer = buffer;
+                startIndex = 1;
+
+                if (contentAddressing.load() && !buffer->isStreamed()) {
+                    ids = getContentStageIds(key, hashContent(*buffer));
+                    contentAddressed = true;
+
+                    // Identical audio may have been loaded (and transformed) under another path
+                    auto [sharedBuffer, sharedIndex] = findCachedPrefix(key, ids, std::nullopt, request.client);
+                    if (sharedBuffer) {
+                        startBuffer = sharedBuffer;
+                        startIndex = sharedIndex;
+                    }
+                }
 
                 // Cache the loaded buffer
-                if (request.key.nocacheIndex > 0) {
+                if (startBuffer == buffer && isCachedStage(key, 1)) {
                     CacheEntry entry;
                     entry.state = CacheEntryState::Ready;
+                    entry.owner = request.client;
                     entry.buffer = buffer;
-                    entry.sizeInBytes = buffer->buffer.getNumSamples() *
-                                       buffer->buffer.getNumChannels() *
-                                       sizeof(float);
-                    cache.put(request.key.getPartialHash(1), entry);
+                    entry.sizeInBytes = buffer->getSizeInBytes();
+                    cache.put(ids[1], entry);
                 }
 
                 // Apply remaining transforms
-                result = applyTransforms(buffer, request.key, 1);
+                result = applyTransforms(startBuffer, key, startIndex, ids, request.client, persistent);
             } else {
-                result = Result<std::shared_ptr<InfoBuffer>>::unexpected_type(request.key.transforms[0]->getLastError());
+                result = Result<std::shared_ptr<InfoBuffer>>::unexpected_type(key.transforms[0]->getLastError());
             }
         }
     } else if (startBuffer) {
         // Apply remaining transforms
-        result = applyTransforms(startBuffer, request.key, startIndex);
+        result = applyTransforms(startBuffer, key, startIndex, ids, request.client, persistent);
     } else {
         result = Result<std::shared_ptr<InfoBuffer>>::unexpected_type("Failed to find valid starting point");
     }
@@ -120,80 +350,433 @@ void BufferLoader::processRequest(LoadRequest&& request) {
     if (result.has_value()) {
         CacheEntry entry;
         entry.state = CacheEntryState::Ready;
+        entry.owner = request.client;
         entry.buffer = result.value();
-        entry.sizeInBytes = entry.buffer->buffer.getNumSamples() *
-                           entry.buffer->buffer.getNumChannels() *
-                           sizeof(float);
-        cache.put(keyHash, entry);
+        entry.sizeInBytes = entry.buffer->getSizeInBytes();
+        cache.put(ids.back(), entry);
+
+        // Point the path based stages at the shared ones
+        if (contentAddressed) {
+            for (size_t i = 1; i < ids.size(); ++i) {
+                if (isCachedStage(key, i)) cache.putAlias(pathIds[i], ids[i], request.client);
+            }
+        }
 
         // Notify listeners
-        listeners.call(&Listener::onBufferLoaded, request.key, entry.buffer);
+        listeners.call(&Listener::onBufferLoaded, key, entry.buffer);
     } else {
-        cache.markError(keyHash, result.error());
-        listeners.call(&Listener::onBufferLoadError, request.key, result.error());
+        cache.markError(id, result.error(), request.client);
+        listeners.call(&Listener::onBufferLoadError, key, result.error());
     }
 
     // Notify all waiters
-    notifyWaiters(keyHash, result);
+    notifyWaiters(id, result);
+}
+
+std::unique_ptr<BufferLoader::ProgressiveLoad> BufferLoader::prepareProgressive(const CacheKey& key) {
+    auto load = std::make_unique<ProgressiveLoad>();
+    load->source = key.transforms[0]->createChunkedSource();
+    if (!load->source) return nullptr;
+
+    load->buffer = std::make_shared<InfoBuffer>();
+    load->buffer->sampleRate = 0;
+    load->buffer->maxMagnitude = 0;
+    if (!load->source->prepare(*load->buffer)) return nullptr; // the regular load reports the error
+
+    // Not worth it if it all fits in one chunk anyway
+    if (load->buffer->buffer.getNumSamples() <= progressiveChunkSamples) return nullptr;
+
+    const auto numChannels = load->buffer->buffer.getNumChannels();
+    for (size_t i = 1; i < key.transforms.size(); ++i) {
+        auto processor = key.transforms[i]->createChunkProcessor(numChannels, load->buffer->sampleRate);
+        if (!processor) return nullptr;
+        load->processors.push_back(std::move(processor));
+    }
+
+    return load;
+}
+
+Result<std::shared_ptr<InfoBuffer>> BufferLoader::loadProgressively(
+    ProgressiveLoad& load,
+    const LoadRequest& request,
+    const ChainId& id,
+    const std::optional<PersistentSource>& persistent) {
+
+    const auto& key = request.key;
+    auto& info = *load.buffer;
+    auto progress = std::make_shared<LoadProgress>();
+    ScopedTimer decodeTimer;
+    info.progress = progress;
+
+    const auto totalSamples = info.buffer.getNumSamples();
+    const auto numChannels = info.buffer.getNumChannels();
+    auto maxMagnitude = 0.f;
+
+    // Chunks start on peak boundaries, so the overview can be measured as they come in
+    static_assert(progressiveChunkSamples % PeakPyramid::baseSamplesPerPeak == 0);
+    auto peaks = std::make_shared<PeakPyramid>(numChannels, totalSamples);
+    bool published = false;
+
+    for (int start = 0; start < totalSamples; start += progressiveChunkSamples) {
+        const auto numSamples = std::min(progressiveChunkSamples, totalSamples - start);
+
+        if (threadShouldExit() || !load.source->read(info, start, numSamples)) {
+            // Whoever already has the published buffer finds out through it
+            progress->error = threadShouldExit() ? "Loader stopped" : load.source->getLastError();
+            progress->failed.store(true, std::memory_order_release);
+            return Result<std::shared_ptr<InfoBuffer>>::unexpected_type(progress->error);
+        }
+
+        for (auto& processor : load.processors) {
+            processor->process(info.buffer, start, numSamples);
+        }
+
+        for (int c = 0; c < numChannels; c++) {
+            maxMagnitude = std::max(maxMagnitude, peaks->addSamples(c, info.buffer.getReadPointer(c, start), start, numSamples));
+        }
+        progress->readySamples.store(start + numSamples, std::memory_order_release);
+
+        if (!published) {
+            // Magnitude so far is only provisional, the final buffer below has the real one
+            info.maxMagnitude = maxMagnitude;
+
+            CacheEntry entry;
+            entry.state = CacheEntryState::Ready;
+            entry.owner = request.client;
+            entry.buffer = load.buffer;
+            entry.sizeInBytes = info.getSizeInBytes();
+            cache.put(id, entry);
+
+            // Blocked requesters can start playing now
+            notifyWaiters(id, load.buffer);
+            published = true;
+        }
+    }
+
+    // Includes the chain's transforms, which run on each chunk as it's decoded
+    metrics.recordDecode(info.getSizeInBytes(), decodeTimer.getElapsedMs());
+
+    // Readers may still hold the published buffer, so don't touch it. Hand out a complete one that
+    // shares its samples instead.
+    auto complete = std::make_shared<InfoBuffer>();
+    complete->buffer.setDataToReferTo(load.buffer->buffer.getArrayOfWritePointers(),
+                                      info.buffer.getNumChannels(), totalSamples);
+    complete->sampleRate = info.sampleRate;
+    complete->maxMagnitude = maxMagnitude;
+    peaks->finish();
+    complete->peaks = std::move(peaks);
+    complete->file = info.file;
+    complete->storageOwner = load.buffer;
+    complete->sampleStorage = load.buffer->sampleStorage;
+
+    if (persistent && isPersistedStage(key, key.transforms.size())) {
+        persistent->diskCache->store(persistent->id, key.getPersistentHash(key.transforms.size()), complete);
+    }
+
+    return complete;
 }
 
-std::pair<std::shared_ptr<InfoBuffer>, size_t> BufferLoader::findCachedPrefix(const CacheKey& key) {
+std::pair<std::shared_ptr<InfoBuffer>, size_t> BufferLoader::findCachedPrefix(
+    const CacheKey& key,
+    const std::vector<ChainId>& ids,
+    const std::optional<PersistentSource>& persistent,
+    ClientId client,
+    bool* loadedFromDisk) {
+
     // Search from the end backwards to find longest cached chain
+    size_t memoryIndex = 0;
+    std::shared_ptr<InfoBuffer> memoryBuffer;
     for (size_t i = key.transforms.size(); i > 0; --i) {
-        if (auto buffer = cache.getBuffer(key.getPartialHash(i))) {
-            return {*buffer, i};
+        auto buffer = cache.getBuffer(ids[i]);
+        if (!buffer) buffer = cache.decompress(ids[i]);
+        if (buffer) {
+            memoryIndex = i;
+            memoryBuffer = *buffer;
+            break;
+        }
+    }
+
+    // The disk cache is only worth trying for stages longer than what's already in memory
+    if (persistent) {
+        for (size_t i = key.transforms.size(); i > memoryIndex && i >= 2; --i) {
+            if (!isPersistedStage(key, i)) continue;
+
+            auto buffer = persistent->diskCache->load(persistent->id, key.getPersistentHash(i));
+            if (!buffer || !restoreAnalysis(*buffer, key, i, *persistent)) continue;
+
+            buffer->file = juce::File(key.getSourcePath());
+            buffer->moveToSharedStorage();
+
+            CacheEntry entry;
+            entry.state = CacheEntryState::Ready;
+            entry.owner = client;
+            entry.buffer = buffer;
+            entry.sizeInBytes = buffer->getSizeInBytes();
+            cache.put(ids[i], entry);
+
+            if (loadedFromDisk) *loadedFromDisk = true;
+            return {buffer, i};
+        }
+    }
+
+    return {memoryBuffer, memoryIndex};
+}
+
+bool BufferLoader::restoreAnalysis(InfoBuffer& buffer, const CacheKey& key, size_t index,
+                                   const PersistentSource& persistent) {
+    // Follows applyTransforms(): analysis results build on each other, gains keep them and anything
+    // else drops them
+    std::shared_ptr<const AnalysisMetadata> analysis;
+    for (size_t j = 0; j < index; ++j) {
+        const auto& transform = key.transforms[j];
+        if (transform->isAnalysis()) {
+            analysis = persistent.diskCache->loadAnalysis(persistent.id, key.getPersistentHash(j + 1));
+            if (!analysis) return false;
+        } else if (!transform->getGainFactor(1.f)) {
+            analysis.reset();
         }
     }
-    return {nullptr, 0};
+
+    buffer.analysis = std::move(analysis);
+    return true;
 }
 
 Result<std::shared_ptr<InfoBuffer>> BufferLoader::applyTransforms(
     std::shared_ptr<InfoBuffer> startBuffer,
     const CacheKey& key,
-    size_t startIndex) {
+    size_t startIndex,
+    const std::vector<ChainId>& ids,
+    ClientId client,
+    const std::optional<PersistentSource>& persistent) {
+
+    // Streamed buffers only hold their head, there's nothing sensible to transform
+    if (startBuffer->isStreamed() && startIndex < key.transforms.size()) {
+        return Result<std::shared_ptr<InfoBuffer>>::unexpected_type("Transforms can't follow a streaming source");
+    }
 
-    // Make a copy to work with
-    auto workingBuffer = std::make_shared<InfoBuffer>(*startBuffer);
+    // Nothing left to do (e.g. the whole chain was found under another path). Cached buffers are
+    // never modified, so it can be handed out as is.
+    if (startIndex >= key.transforms.size()) return startBuffer;
+
+    // Work on a view of the start buffer. Its samples are only copied if an in-place transform
+    // needs to write to them.
+    auto workingBuffer = startBuffer->share();
 
     // Apply each transform
-    for (size_t i = startIndex; i < key.transforms.size(); ++i) {
-        double sampleRate = workingBuffer->sampleRate;
+    for (size_t i = startIndex; i < key.transforms.size();) {
+        const auto& transform = key.transforms[i];
+        auto next = i + 1;
+        ScopedTimer transformTimer;
 
-        if (!key.transforms[i]->process(workingBuffer->buffer, sampleRate)) {
-            return  Result<std::shared_ptr<InfoBuffer>>::unexpected_type(key.transforms[i]->getLastError());
+        if (workingBuffer->isCompact()) {
+            return Result<std::shared_ptr<InfoBuffer>>::unexpected_type("Transforms can't follow compact storage");
+        }
+        if (workingBuffer->mipmaps) {
+            return Result<std::shared_ptr<InfoBuffer>>::unexpected_type("Transforms can't follow mipmaps");
         }
 
-        workingBuffer->sampleRate = sampleRate;
-        updateBufferMetadata(workingBuffer);
+        if (transform->isAnalysis()) {
+            // Only reads the samples, so there's nothing to copy. Results are looked up by source
+            // content first, so a file is only ever analyzed once.
+            const auto analysisHash = key.getPersistentHash(next);
+            auto stored = persistent ? persistent->diskCache->loadAnalysis(persistent->id, analysisHash) : nullptr;
+            if (stored) {
+                workingBuffer->analysis = std::move(stored);
+            } else {
+                if (!transform->processInfo(*workingBuffer)) {
+                    return Result<std::shared_ptr<InfoBuffer>>::unexpected_type(transform->getLastError());
+                }
+                if (persistent && workingBuffer->analysis) {
+                    persistent->diskCache->storeAnalysis(persistent->id, analysisHash, *workingBuffer->analysis);
+                }
+            }
+        } else if (const auto* mipmap = dynamic_cast<const MipmapTransform*>(transform.get())) {
+            // Only adds the pyramid, so the samples stay shared. Each channel builds on its own thread.
+            const auto ok = mipmap->build(*workingBuffer, [this](int numChannels, const std::function<void(int)>& fn) {
+                forEachChannel(numChannels, fn);
+            });
+            if (!ok) return Result<std::shared_ptr<InfoBuffer>>::unexpected_type(mipmap->getLastError());
+        } else if (auto gain = transform->getGainFactor(workingBuffer->maxMagnitude)) {
+            // Fold following gains into the same pass. Their effect on the peak is known, so there's
+            // no need to measure it between them. The stages in between are skipped, so aren't
+            // cached, unless one is where the chain asked caching to stop (see nocache()).
+            auto magnitude = workingBuffer->maxMagnitude * std::abs(*gain);
+            auto totalGain = *gain;
+            while (next < key.transforms.size() && next != key.nocacheIndex) {
+                const auto nextGain = key.transforms[next]->getGainFactor(magnitude);
+                if (!nextGain) break;
+                totalGain *= *nextGain;
+                magnitude *= std::abs(*nextGain);
+                ++next;
+            }
+
+            workingBuffer->makeWritable();
+            auto& buffer = workingBuffer->buffer;
+            forEachChannel(buffer.getNumChannels(), [&](int c) {
+                juce::FloatVectorOperations::multiply(buffer.getWritePointer(c), totalGain, buffer.getNumSamples());
+            });
+            workingBuffer->maxMagnitude = magnitude;
+            if (workingBuffer->peaks) workingBuffer->peaks = workingBuffer->peaks->withGain(totalGain);
+        } else if (const auto* selector = dynamic_cast<const OutputTransform*>(transform.get())) {
+            // Every output comes out of the same pass. Cache the others too, so the chains that
+            // select them don't run it again.
+            std::vector<InfoBuffer> outputs;
+            if (!selector->processOutputs(*workingBuffer, outputs)) {
+                return Result<std::shared_ptr<InfoBuffer>>::unexpected_type(selector->getLastError());
+            }
+
+            for (size_t o = 0; o < outputs.size(); ++o) {
+                auto output = std::make_shared<InfoBuffer>(std::move(outputs[o]));
+                updateBufferMetadata(output);
+                if (o == selector->getOutputIndex()) {
+                    workingBuffer = std::move(output);
+                } else if (next <= key.nocacheIndex) {
+                    auto siblingKey = key.getPartialKey(i);
+                    siblingKey.transforms.push_back(selector->withOutput(o));
+
+                    CacheEntry entry;
+                    entry.state = CacheEntryState::Ready;
+                    entry.owner = client;
+                    entry.buffer = output;
+                    entry.sizeInBytes = output->getSizeInBytes();
+                    cache.put(siblingKey.getId(), entry);
+                }
+            }
+        } else if (transform->isInPlace()) {
+            workingBuffer->makeWritable();
+            std::string error;
+            const auto ok = transform->isChannelIndependent() && workingBuffer->buffer.getNumChannels() > 1
+                                ? processChannels(*transform, *workingBuffer, error)
+                                : transform->processInfo(*workingBuffer);
+            if (!ok) {
+                return Result<std::shared_ptr<InfoBuffer>>::unexpected_type(error.empty() ? transform->getLastError() : error);
+            }
+            updateBufferMetadata(workingBuffer);
+
+            // Analysis of the old samples doesn't describe the new ones (gains above keep it, since
+            // they don't move anything)
+            workingBuffer->analysis.reset();
+        } else {
+            auto output = std::make_shared<InfoBuffer>();
+            if (!transform->processInto(*workingBuffer, *output)) {
+                return Result<std::shared_ptr<InfoBuffer>>::unexpected_type(transform->getLastError());
+            }
+            workingBuffer = std::move(output);
+            updateBufferMetadata(workingBuffer);
+        }
 
-        // Cache intermediate result if before nocache index
-        if (i + 1 <= key.nocacheIndex && i + 1 < key.transforms.size()) {
-            auto bufferCopy = std::make_shared<InfoBuffer>(*workingBuffer);
+        // Fused gains are all charged to the first one
+        metrics.recordTransform(typeid(*transform).name(), transformTimer.getElapsedMs());
+
+        // Cache intermediate result if before nocache index. The entry shares samples with the working
+        // buffer, and only gets its own copy if a later transform writes to them.
+        if (isCachedIntermediateStage(key, next)) {
+            workingBuffer->moveToSharedStorage();
+            auto stageBuffer = workingBuffer->share();
 
             CacheEntry entry;
             entry.state = CacheEntryState::Ready;
-            entry.buffer = bufferCopy;
-            entry.sizeInBytes = bufferCopy->buffer.getNumSamples() *
-                               bufferCopy->buffer.getNumChannels() *
-                               sizeof(float);
+            entry.owner = client;
+            entry.buffer = stageBuffer;
+            entry.sizeInBytes = stageBuffer->getSizeInBytes();
+
+            cache.put(ids[next], entry);
 
-            cache.put(key.getPartialHash(i + 1), entry);
+            if (persistent && isPersistedStage(key, next)) {
+                persistent->diskCache->store(persistent->id, key.getPersistentHash(next), stageBuffer);
+            }
+        } else if (persistent && next == key.transforms.size() && isPersistedStage(key, next)) {
+            // The final result isn't modified after this, so it can be written out without a copy
+            persistent->diskCache->store(persistent->id, key.getPersistentHash(next), workingBuffer);
         }
+
+        i = next;
     }
 
     return workingBuffer;
 }
 
 void BufferLoader::updateBufferMetadata(std::shared_ptr<InfoBuffer>& buffer) {
-    buffer->maxMagnitude = buffer->buffer.getMagnitude(0, buffer->buffer.getNumSamples());
+    // Compact storage keeps the metadata measured before it
+    if (buffer->isCompact()) return;
+
+    const auto& samples = buffer->buffer;
+    std::vector<float> magnitudes(static_cast<size_t>(samples.getNumChannels()), 0.f);
+
+    // Streamed buffers only hold their head, there's no point drawing that
+    if (buffer->isStreamed()) {
+        forEachChannel(samples.getNumChannels(), [&](int c) {
+            magnitudes[static_cast<size_t>(c)] = samples.getMagnitude(c, 0, samples.getNumSamples());
+        });
+        buffer->peaks.reset();
+    } else {
+        // The peak overview is measured in the same pass as the magnitude. Guard padding is silent,
+        // so leaving it out doesn't change the magnitude.
+        const auto start = buffer->padStart;
+        const auto length = buffer->getLengthInSamples();
+        auto peaks = std::make_shared<PeakPyramid>(samples.getNumChannels(), length);
+        forEachChannel(samples.getNumChannels(), [&](int c) {
+            magnitudes[static_cast<size_t>(c)] = peaks->addSamples(c, samples.getReadPointer(c, start), 0, length);
+        });
+        peaks->finish();
+        buffer->peaks = std::move(peaks);
+    }
+
+    buffer->maxMagnitude = magnitudes.empty() ? 0.f : *std::max_element(magnitudes.begin(), magnitudes.end());
+}
+
+void BufferLoader::forEachChannel(int numChannels, const std::function<void(int)>& fn) {
+    if (numChannels <= 1) {
+        if (numChannels == 1) fn(0);
+        return;
+    }
+
+    // Last channel runs here rather than waiting idle
+    std::latch done(numChannels - 1);
+    for (int c = 0; c < numChannels - 1; c++) {
+        channelPool.addJob([&fn, &done, c] {
+            fn(c);
+            done.count_down();
+        });
+    }
+    fn(numChannels - 1);
+    done.wait();
+}
+
+bool BufferLoader::processChannels(const Transform& transform, InfoBuffer& info, std::string& error) {
+    std::mutex errorMutex;
+    std::atomic<bool> ok {true};
+
+    forEachChannel(info.buffer.getNumChannels(), [&](int c) {
+        // Each channel gets its own transform, since they keep error state
+        const auto channelTransform = transform.clone();
+
+        InfoBuffer channel;
+        auto* data = info.buffer.getWritePointer(c);
+        channel.buffer.setDataToReferTo(&data, 1, info.buffer.getNumSamples());
+        channel.sampleRate = info.sampleRate;
+        channel.file = info.file;
+
+        if (!channelTransform->processInfo(channel)) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            ok = false;
+            error = channelTransform->getLastError();
+        }
+    });
+
+    return ok;
+}
+
+bool BufferLoader::isCachedIntermediateStage(const CacheKey& key, size_t index) {
+    return index < key.transforms.size() && isCachedStage(key, index);
 }
 
-void BufferLoader::notifyWaiters(size_t keyHash, const Result<std::shared_ptr<InfoBuffer>>& result) {
+void BufferLoader::notifyWaiters(const ChainId& id, const Result<std::shared_ptr<InfoBuffer>>& result) {
     std::vector<std::shared_ptr<std::promise<Result<std::shared_ptr<InfoBuffer>>>>> promises;
 
     {
         std::lock_guard<std::mutex> lock(activeRequestsMutex);
-        auto it = activeRequests.find(keyHash);
+        auto it = activeRequests.find(id.canonical);
         if (it != activeRequests.end()) {
             promises = std::move(it->second);
             activeRequests.erase(it);
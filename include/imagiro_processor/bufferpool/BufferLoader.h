@@ -1,6 +1,8 @@
 #pragma once
 #include "BufferCache.h"
+#include "DiskBufferCache.h"
 #include <unordered_map>
+#include <unordered_set>
 #include <mutex>
 #include <imagiro_util/readerwriterqueue/readerwriterqueue.h>
 
@@ -11,8 +13,35 @@ public:
     BufferLoader(BufferCache& cache);
     ~BufferLoader() override;
 
-    // Request a buffer with transform chain
-    Result<std::shared_ptr<InfoBuffer>> requestBuffer(const CacheKey& key);
+    // Request a buffer with transform chain. Identical requests from any client are loaded once
+    Result<std::shared_ptr<InfoBuffer>> requestBuffer(const CacheKey& key, ClientId client = NoClient);
+
+    // Same as requestBuffer(), but a chain that isn't already loading is loaded on the calling thread
+    // rather than queued for the loader thread
+    Result<std::shared_ptr<InfoBuffer>> requestBufferOnThisThread(const CacheKey& key, ClientId client = NoClient);
+
+    // Prefetches are only started while no regular request is waiting. A regular request for a chain
+    // that's already queued as a prefetch moves it up to the regular queue.
+    enum class Priority {
+        Normal,
+        Prefetch
+    };
+
+    // Same as requestBuffer(), without waiting for the result
+    std::shared_future<Result<std::shared_ptr<InfoBuffer>>> requestBufferAsync(
+        const CacheKey& key, ClientId client = NoClient, Priority priority = Priority::Normal);
+
+    // One chain of a graph evaluation (see TransformGraph), started once the step it follows is
+    // done, so it picks up that step's cached result as its prefix
+    struct GraphStep {
+        CacheKey key;
+        std::optional<size_t> after; // index of an earlier step, or nullopt to start straight away
+    };
+
+    // Load a set of chains that share prefixes. Steps that don't depend on each other are processed
+    // in parallel, on their own threads rather than the loader thread. One future per step.
+    std::vector<std::shared_future<Result<std::shared_ptr<InfoBuffer>>>> requestGraph(
+        std::vector<GraphStep> steps, ClientId client = NoClient);
 
     // Listener interface
     struct Listener {
@@ -24,35 +53,138 @@ public:
     void addListener(Listener* l) { listeners.add(l); }
     void removeListener(Listener* l) { listeners.remove(l); }
 
+    // Optional second level cache. Transformed stages are looked up there on a memory miss,
+    // and written there once computed.
+    void setDiskCache(std::shared_ptr<DiskBufferCache> diskCache);
+
+    // Identify loaded audio by its decoded samples rather than its path, so identical files at
+    // different paths (or chains starting from them) share one entry. Costs a hash of every
+    // decoded sample, so it's off by default.
+    void setContentAddressing(bool enabled) { contentAddressing = enabled; }
+
+    // Lock-free counters, see CacheMetrics
+    const LoaderMetrics& getMetrics() const { return metrics; }
+
 private:
     BufferCache& cache;
-    juce::ListenerList<Listener> listeners;
 
-    // Queue of requests
+    std::atomic<bool> contentAddressing {false};
+    LoaderMetrics metrics;
+
+    std::mutex diskCacheMutex;
+    std::shared_ptr<DiskBufferCache> diskCache;
+    std::shared_ptr<DiskBufferCache> getDiskCache();
+
+    // What's needed to look a chain up in the disk cache, if it can be persisted at all
+    struct PersistentSource {
+        std::shared_ptr<DiskBufferCache> diskCache;
+        DiskBufferCache::SourceId id;
+    };
+    std::optional<PersistentSource> getPersistentSource(const CacheKey& key);
+
+    // Whether stage `index` (the result after `index` transforms) is kept in the memory and disk caches.
+    // Stages up to the nocache index are, apart from one that's about to be compacted.
+    static bool isCachedStage(const CacheKey& key, size_t index);
+    static bool isPersistedStage(const CacheKey& key, size_t index);
+    static bool isCachedIntermediateStage(const CacheKey& key, size_t index);
+
+    // Listeners may be added from any instance while the loader thread is calling them
+    juce::ListenerList<Listener, juce::Array<Listener*, juce::CriticalSection>> listeners;
+
+    // Queue of requests (single consumer; producers are serialised since the loader may be shared)
     moodycamel::ReaderWriterQueue<LoadRequest> loadQueue{64};
+    moodycamel::ReaderWriterQueue<LoadRequest> prefetchQueue{64};
+    std::mutex enqueueMutex;
 
-    // Active requests (for deduplication)
+    // Active requests (for deduplication), by canonical chain key
     std::mutex activeRequestsMutex;
-    std::unordered_map<size_t, std::vector<std::shared_ptr<std::promise<Result<std::shared_ptr<InfoBuffer>>>>>> activeRequests;
+    std::unordered_map<std::string, std::vector<std::shared_ptr<std::promise<Result<std::shared_ptr<InfoBuffer>>>>>> activeRequests;
+
+    // Also under activeRequestsMutex. Prefetches still waiting in their queue, those that have been
+    // queued again as regular requests, and the second copy of those, left to be skipped
+    std::unordered_set<std::string> queuedPrefetches;
+    std::unordered_set<std::string> promotedPrefetches;
+    std::unordered_multiset<std::string> staleQueueEntries;
+
+    void enqueue(LoadRequest&& request, Priority priority);
+    void promoteQueuedPrefetch(const CacheKey& key, const std::string& canonical, ClientId client);
+
+    // Whether a dequeued request should be loaded, or is the leftover copy of a promoted prefetch
+    bool claimQueuedRequest(const std::string& canonical);
 
     // Thread implementation
     void run() override;
+
+    // Also called from graph steps, so any number may run at once
     void processRequest(LoadRequest&& request);
 
     // Find the longest cached prefix and return index of next transform to apply
-    std::pair<std::shared_ptr<InfoBuffer>, size_t> findCachedPrefix(const CacheKey& key);
+    std::pair<std::shared_ptr<InfoBuffer>, size_t> findCachedPrefix(
+        const CacheKey& key,
+        const std::vector<ChainId>& ids,
+        const std::optional<PersistentSource>& persistent,
+        ClientId client,
+        bool* loadedFromDisk = nullptr);
+
+    // The disk cache only holds samples, so put back the analysis a stage loaded from it carried
+    // when it was made, from the stored analysis results. False if one of those has gone missing.
+    static bool restoreAnalysis(InfoBuffer& buffer, const CacheKey& key, size_t index,
+                                const PersistentSource& persistent);
 
     // Apply transform chain starting from given index
     Result<std::shared_ptr<InfoBuffer>> applyTransforms(
         std::shared_ptr<InfoBuffer> buffer,
         const CacheKey& key,
-        size_t startIndex);
+        size_t startIndex,
+        const std::vector<ChainId>& ids,
+        ClientId client,
+        const std::optional<PersistentSource>& persistent);
 
     // Calculate buffer metadata
     void updateBufferMetadata(std::shared_ptr<InfoBuffer>& buffer);
 
+    // Workers for processing the channels of one buffer in parallel
+    juce::ThreadPool channelPool {std::max(1, juce::SystemStats::getNumCpus() - 1)};
+    void forEachChannel(int numChannels, const std::function<void(int)>& fn);
+
+    // Workers for graph steps (see requestGraph()). Separate from channelPool, since steps wait on
+    // channel jobs.
+    juce::ThreadPool branchPool {std::max(2, juce::SystemStats::getNumCpus() / 2)};
+
+    struct GraphEvaluation {
+        std::vector<GraphStep> steps;
+        std::vector<std::promise<Result<std::shared_ptr<InfoBuffer>>>> promises;
+        std::vector<std::vector<size_t>> followers;
+        ClientId client = NoClient;
+    };
+    void runGraphStep(std::shared_ptr<GraphEvaluation> evaluation, size_t index);
+
+    // Run a channel independent transform on each channel of the buffer in parallel
+    bool processChannels(const Transform& transform, InfoBuffer& info, std::string& error);
+
     // Notify all promises waiting for this key
-    void notifyWaiters(size_t keyHash, const Result<std::shared_ptr<InfoBuffer>>& result);
+    void notifyWaiters(const ChainId& id, const Result<std::shared_ptr<InfoBuffer>>& result);
+
+    // Ids of every stage of a chain, indexed by number of transforms applied
+    static std::vector<ChainId> getStageIds(const CacheKey& key);
+
+    // Progressive loading - the source is decoded a chunk at a time and each chunk is run through
+    // the whole chain, so the start of the result can be published straight away
+    static constexpr int progressiveChunkSamples = 1 << 16;
+
+    struct ProgressiveLoad {
+        std::unique_ptr<ChunkedSource> source;
+        std::vector<std::unique_ptr<ChunkProcessor>> processors;
+        std::shared_ptr<InfoBuffer> buffer;
+    };
+
+    // Returns nullptr if the chain can't be loaded progressively
+    static std::unique_ptr<ProgressiveLoad> prepareProgressive(const CacheKey& key);
+    Result<std::shared_ptr<InfoBuffer>> loadProgressively(ProgressiveLoad& load, const LoadRequest& request,
+                                                          const ChainId& id,
+                                                          const std::optional<PersistentSource>& persistent);
+    static std::vector<ChainId> getContentStageIds(const CacheKey& key, const Hash128& contentHash);
+    static Hash128 hashContent(const InfoBuffer& info);
 };
 
 } // namespace imagiro
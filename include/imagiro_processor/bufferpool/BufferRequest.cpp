@@ -29,22 +29,70 @@ BufferRequest& BufferRequest::channels(int num) {
     return *this;
 }
 
+BufferRequest& BufferRequest::stream(double preloadMs) {
+    if (auto* load = dynamic_cast<LoadTransform*>(key.transforms[0].get())) {
+        key.transforms[0] = std::make_unique<StreamTransform>(
+            load->getFilePath(),
+            cache->afm,
+            preloadMs,
+            static_cast<int>(load->getStartSample()),
+            static_cast<int>(load->getEndSample()),
+            load->getNumChannels());
+    }
+    return *this;
+}
+
+BufferRequest& BufferRequest::mapped(MappedAudioFile::AccessPattern accessPattern) {
+    if (auto* load = dynamic_cast<LoadTransform*>(key.transforms[0].get())) {
+        key.transforms[0] = std::make_unique<MappedLoadTransform>(
+            load->getFilePath(),
+            cache->afm,
+            accessPattern,
+            static_cast<int>(load->getStartSample()),
+            static_cast<int>(load->getEndSample()),
+            load->getNumChannels());
+    }
+    return *this;
+}
+
 BufferRequest& BufferRequest::transform(std::unique_ptr<Transform> t) {
     key.transforms.push_back(std::move(t));
     return *this;
 }
 
+BufferRequest& BufferRequest::compact(CompactSamples::Format format) {
+    return transform(std::make_unique<CompactTransform>(format));
+}
+
+BufferRequest& BufferRequest::mipmaps() {
+    return transform(std::make_unique<MipmapTransform>());
+}
+
 BufferRequest& BufferRequest::nocache(size_t fromIndex) {
     key.nocacheIndex = fromIndex;
     return *this;
 }
 
+BufferRequest& BufferRequest::progressive(bool enabled) {
+    key.progressive = enabled;
+    return *this;
+}
+
+BufferRequest& BufferRequest::client(ClientId id) {
+    clientId = id;
+    return *this;
+}
+
 std::shared_ptr<BufferRequestHandle> BufferRequest::execute() {
-    return cache->createHandle(key);
+    return cache->createHandle(key, clientId);
 }
 
 Result<std::shared_ptr<InfoBuffer>> BufferRequest::executeBlocking() {
-    return cache->requestBuffer(key);
+    return cache->requestBuffer(key, clientId);
+}
+
+Result<std::shared_ptr<InfoBuffer>> BufferRequest::executeOnThisThread() {
+    return cache->requestBufferOnThisThread(key, clientId);
 }
 
 } // namespace imagiro
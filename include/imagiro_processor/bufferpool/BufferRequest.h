@@ -17,6 +17,7 @@ class BufferRequest {
 private:
     FileBufferCache* cache;
     CacheKey key;
+    ClientId clientId = NoClient;
 
     BufferRequest(FileBufferCache* c, const std::string& path);
 
@@ -27,17 +28,43 @@ public:
     // Set number of channels
     BufferRequest& channels(int num);
 
+    // Stream from disk, keeping only the first preloadMs resident (call after range/channels)
+    BufferRequest& stream(double preloadMs);
+
+    // Load uncompressed files through a memory mapping (call after range/channels)
+    BufferRequest& mapped(MappedAudioFile::AccessPattern accessPattern = MappedAudioFile::AccessPattern::Random);
+
     // Add a transform
     BufferRequest& transform(std::unique_ptr<Transform> t);
 
+    // Store the result as 16 bit samples, for half the memory (call after all other transforms). The
+    // float samples it's made from aren't cached.
+    BufferRequest& compact(CompactSamples::Format format = CompactSamples::Format::Int16);
+
+    // Build decimated copies for alias-free playback at high pitches, see MipmapTransform (call after
+    // all other transforms)
+    BufferRequest& mipmaps();
+
     // Set nocache index (transforms after this won't be cached)
     BufferRequest& nocache(size_t fromIndex);
 
+    // Hand the buffer out as soon as its first chunk is loaded, rather than when all of it is.
+    // Only the first getReadySamples() samples can be read until it's finished.
+    // Chains with a transform that needs the whole buffer (e.g. normalize) load as usual.
+    BufferRequest& progressive(bool enabled = true);
+
+    // Charge cached results to a client's quota
+    BufferRequest& client(ClientId id);
+
     // Execute and get handle
     std::shared_ptr<BufferRequestHandle> execute();
 
     // Execute and get result directly (blocking)
     Result<std::shared_ptr<InfoBuffer>> executeBlocking();
+
+    // Same, but load on the calling thread rather than the loader thread, e.g. from a pool of
+    // workers. Identical requests in progress elsewhere are still only loaded once.
+    Result<std::shared_ptr<InfoBuffer>> executeOnThisThread();
 };
 
 } // namespace imagiro
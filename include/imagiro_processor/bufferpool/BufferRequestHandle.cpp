@@ -4,15 +4,16 @@
 
 namespace imagiro {
 
-BufferRequestHandle::BufferRequestHandle(FileBufferCache* c, const CacheKey& k)
-    : cache(c), key(k) {
+BufferRequestHandle::BufferRequestHandle(FileBufferCache* c, const CacheKey& k, ClientId client)
+    : cache(c), key(k), id(k.getId()), pin(std::make_shared<std::shared_ptr<void>>()) {
     // Create promise/future pair
     promise = std::make_shared<std::promise<Result<std::shared_ptr<InfoBuffer>>>>();
     future = promise->get_future().share();
 
     // Start loading asynchronously on message thread
-    juce::MessageManager::callAsync([p = this->promise, c, k]() {
-        auto result = c->requestBuffer(k);
+    juce::MessageManager::callAsync([p = this->promise, pin = this->pin, c, k, client]() {
+        auto result = c->requestBuffer(k, client);
+        if (result.has_value()) *pin = result.value()->pin();
         try {
             p->set_value(result.value());
         } catch (...) {
@@ -23,12 +24,12 @@ BufferRequestHandle::BufferRequestHandle(FileBufferCache* c, const CacheKey& k)
 
 bool BufferRequestHandle::exists() const {
     // This only reads from the lock-free cache
-    return cache->cache->exists(key.getHash());
+    return cache->cache->exists(id);
 }
 
 std::optional<std::shared_ptr<InfoBuffer>> BufferRequestHandle::get() const {
     // This only reads from the lock-free cache
-    return cache->getBuffer(key);
+    return cache->getBuffer(id);
 }
 
 Result<std::shared_ptr<InfoBuffer>> BufferRequestHandle::getBlocking(int timeoutMs) const {
@@ -45,14 +46,21 @@ Result<std::shared_ptr<InfoBuffer>> BufferRequestHandle::getBlocking(int timeout
             return Result<std::shared_ptr<InfoBuffer>>::unexpected_type("Timeout waiting for buffer");
         }
 
-        return future.get();
+        // Loading may have failed after the buffer was handed out part loaded
+        auto result = future.get();
+        if (result.has_value()) {
+            if (auto error = result.value()->getLoadError()) {
+                return Result<std::shared_ptr<InfoBuffer>>::unexpected_type(*error);
+            }
+        }
+        return result;
     }
 
     return Result<std::shared_ptr<InfoBuffer>>::unexpected_type("No active request");
 }
 
 BufferRequestHandle::State BufferRequestHandle::getState() const {
-    auto entry = cache->cache->get(key.getHash());
+    auto entry = cache->cache->get(id);
 
     if (!entry.has_value()) {
         return State::NotStarted;
@@ -63,6 +71,8 @@ BufferRequestHandle::State BufferRequestHandle::getState() const {
             return State::Loading;
         case CacheEntryState::Ready:
             return State::Ready;
+        case CacheEntryState::Compressed:
+            return State::Compressed;
         case CacheEntryState::Error:
             return State::Error;
     }
@@ -71,7 +81,7 @@ BufferRequestHandle::State BufferRequestHandle::getState() const {
 }
 
 std::optional<std::string> BufferRequestHandle::getError() const {
-    auto entry = cache->cache->get(key.getHash());
+    auto entry = cache->cache->get(id);
 
     if (entry.has_value() && entry->state == CacheEntryState::Error) {
         return entry->errorMessage;
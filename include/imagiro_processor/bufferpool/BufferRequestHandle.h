@@ -15,27 +15,34 @@ class BufferRequestHandle : std::enable_shared_from_this<BufferRequestHandle> {
 private:
     FileBufferCache* cache;
     CacheKey key;
+    ChainId id; // computed once, so lookups from the audio thread don't allocate
     mutable std::shared_ptr<std::promise<Result<std::shared_ptr<InfoBuffer>>>> promise;
     mutable std::shared_future<Result<std::shared_ptr<InfoBuffer>>> future;
     mutable std::atomic<bool> requestStarted{false};
 
-    BufferRequestHandle(FileBufferCache* c, const CacheKey& k);
+    // Keeps the loaded buffer resident while the handle is alive, see InfoBuffer::pin(). Taken when
+    // the buffer arrives on the message thread, so voices playing it never lock memory themselves.
+    std::shared_ptr<std::shared_ptr<void>> pin;
+
+    BufferRequestHandle(FileBufferCache* c, const CacheKey& k, ClientId client = NoClient);
 
 public:
     // Move support (atomic is non-movable, so we handle it manually)
     BufferRequestHandle(BufferRequestHandle&& other) noexcept
-        : cache(other.cache), key(std::move(other.key)),
+        : cache(other.cache), key(std::move(other.key)), id(std::move(other.id)),
           promise(std::move(other.promise)), future(std::move(other.future)),
-          requestStarted(other.requestStarted.load()) {
+          requestStarted(other.requestStarted.load()), pin(std::move(other.pin)) {
         other.cache = nullptr;
     }
     BufferRequestHandle& operator=(BufferRequestHandle&& other) noexcept {
         if (this != &other) {
             cache = other.cache;
             key = std::move(other.key);
+            id = std::move(other.id);
             promise = std::move(other.promise);
             future = std::move(other.future);
             requestStarted.store(other.requestStarted.load());
+            pin = std::move(other.pin);
             other.cache = nullptr;
         }
         return *this;
@@ -57,6 +64,7 @@ public:
         NotStarted,
         Loading,
         Ready,
+        Compressed, // cold - request it again (or prefetch it) to decompress
         Error
     };
     State getState() const;
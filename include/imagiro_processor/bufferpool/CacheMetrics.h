@@ -0,0 +1,226 @@
+#pragma once
+#include <nlohmann/json.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#endif
+
+namespace imagiro {
+
+// Buffer pool instrumentation. Everything is a relaxed atomic, so it can be read from any thread
+// (e.g. a UI timer) without locking, and written from the loader and audio threads without waiting.
+// Values read while loads are running may be a moment out of step with each other.
+
+// Counts of durations, in fixed buckets from 100us to 5s
+class LatencyHistogram {
+public:
+    static constexpr std::array<double, 15> bucketLimitsMs {
+        0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000
+    };
+    static constexpr size_t numBuckets = bucketLimitsMs.size() + 1; // last one is everything longer
+
+    void record(double ms) {
+        size_t bucket = 0;
+        while (bucket < bucketLimitsMs.size() && ms >= bucketLimitsMs[bucket]) bucket++;
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        totalMicros.fetch_add(static_cast<uint64_t>(ms * 1000), std::memory_order_relaxed);
+    }
+
+    uint64_t getCount() const { return count.load(std::memory_order_relaxed); }
+    uint64_t getBucket(size_t index) const { return buckets[index].load(std::memory_order_relaxed); }
+
+    double getMeanMs() const {
+        const auto n = getCount();
+        return n > 0 ? static_cast<double>(totalMicros.load(std::memory_order_relaxed)) / 1000.0 / static_cast<double>(n) : 0;
+    }
+
+    nlohmann::json toJson() const {
+        auto counts = nlohmann::json::array();
+        for (size_t i = 0; i < numBuckets; i++) counts.push_back(getBucket(i));
+        return {
+            {"count", getCount()},
+            {"meanMs", getMeanMs()},
+            {"bucketLimitsMs", bucketLimitsMs},
+            {"bucketCounts", counts}
+        };
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, numBuckets> buckets {};
+    std::atomic<uint64_t> count {0};
+    std::atomic<uint64_t> totalMicros {0};
+};
+
+// Times a scope in milliseconds
+class ScopedTimer {
+public:
+    ScopedTimer() : start(std::chrono::steady_clock::now()) {}
+
+    double getElapsedMs() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+enum class EvictionReason {
+    Budget,  // the global budget was exceeded
+    Quota,   // a client's quota was exceeded
+    Cleared  // clear() was called
+};
+
+struct CacheMetrics {
+    // Lookups for a ready buffer (BufferCache::getBuffer, e.g. from BufferRequestHandle::get)
+    std::atomic<uint64_t> hits {0};
+    std::atomic<uint64_t> misses {0};
+
+    std::array<std::atomic<uint64_t>, 3> evictions {};
+    std::array<std::atomic<uint64_t>, 3> evictedBytes {};
+
+    // Cold entries compressed rather than evicted, the memory that freed, and compressed entries
+    // that were requested again
+    std::atomic<uint64_t> compressions {0};
+    std::atomic<uint64_t> compressionSavedBytes {0};
+    std::atomic<uint64_t> decompressions {0};
+
+    void recordEviction(EvictionReason reason, uint64_t bytes) {
+        evictions[static_cast<size_t>(reason)].fetch_add(1, std::memory_order_relaxed);
+        evictedBytes[static_cast<size_t>(reason)].fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    nlohmann::json toJson() const {
+        const auto byReason = [](const std::array<std::atomic<uint64_t>, 3>& values) {
+            return nlohmann::json{
+                {"budget", values[0].load(std::memory_order_relaxed)},
+                {"quota", values[1].load(std::memory_order_relaxed)},
+                {"cleared", values[2].load(std::memory_order_relaxed)}
+            };
+        };
+        return {
+            {"hits", hits.load(std::memory_order_relaxed)},
+            {"misses", misses.load(std::memory_order_relaxed)},
+            {"evictions", byReason(evictions)},
+            {"evictedBytes", byReason(evictedBytes)},
+            {"compressions", compressions.load(std::memory_order_relaxed)},
+            {"compressionSavedBytes", compressionSavedBytes.load(std::memory_order_relaxed)},
+            {"decompressions", decompressions.load(std::memory_order_relaxed)}
+        };
+    }
+};
+
+struct LoaderMetrics {
+    // Requests that were answered straight from memory, that joined a load already in progress,
+    // and that were queued
+    std::atomic<uint64_t> requestHits {0};
+    std::atomic<uint64_t> requestsJoined {0};
+    std::atomic<uint64_t> requestsQueued {0};
+
+    // How queued requests started: with the whole chain cached after all, from a cached prefix in
+    // memory or on disk, or from the source
+    std::atomic<uint64_t> completeHits {0};
+    std::atomic<uint64_t> memoryPrefixHits {0};
+    std::atomic<uint64_t> diskPrefixHits {0};
+    std::atomic<uint64_t> coldLoads {0};
+
+    std::atomic<int> queueDepth {0};
+    std::atomic<int> peakQueueDepth {0};
+
+    // Decoding sources (not counting transforms)
+    std::atomic<uint64_t> decodedBytes {0};
+    std::atomic<uint64_t> decodeMicros {0};
+    LatencyHistogram decodeTime;
+
+    // Queue to result, for requests that had to be loaded
+    LatencyHistogram loadTime;
+
+    void queued() {
+        requestsQueued.fetch_add(1, std::memory_order_relaxed);
+        const auto depth = queueDepth.fetch_add(1, std::memory_order_relaxed) + 1;
+        auto peak = peakQueueDepth.load(std::memory_order_relaxed);
+        while (depth > peak && !peakQueueDepth.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {}
+    }
+
+    void dequeued() { queueDepth.fetch_sub(1, std::memory_order_relaxed); }
+
+    void recordDecode(uint64_t bytes, double ms) {
+        decodedBytes.fetch_add(bytes, std::memory_order_relaxed);
+        decodeMicros.fetch_add(static_cast<uint64_t>(ms * 1000), std::memory_order_relaxed);
+        decodeTime.record(ms);
+    }
+
+    double getDecodeThroughputMBps() const {
+        const auto micros = decodeMicros.load(std::memory_order_relaxed);
+        return micros > 0 ? static_cast<double>(decodedBytes.load(std::memory_order_relaxed)) / static_cast<double>(micros) : 0;
+    }
+
+    // Execution time per transform type. Types claim a slot the first time they're seen, anything
+    // past maxTransformTypes isn't recorded.
+    static constexpr size_t maxTransformTypes = 32;
+
+    void recordTransform(const char* typeName, double ms) {
+        for (auto& slot : transformSlots) {
+            auto name = slot.name.load(std::memory_order_acquire);
+            if (name == nullptr) {
+                if (slot.name.compare_exchange_strong(name, typeName, std::memory_order_acq_rel)) name = typeName;
+            }
+            if (name == typeName || std::strcmp(name, typeName) == 0) {
+                slot.time.record(ms);
+                return;
+            }
+        }
+    }
+
+    nlohmann::json toJson() const {
+        auto transforms = nlohmann::json::object();
+        for (const auto& slot : transformSlots) {
+            const auto name = slot.name.load(std::memory_order_acquire);
+            if (name == nullptr) break;
+            transforms[demangle(name)] = slot.time.toJson();
+        }
+
+        return {
+            {"requestHits", requestHits.load(std::memory_order_relaxed)},
+            {"requestsJoined", requestsJoined.load(std::memory_order_relaxed)},
+            {"requestsQueued", requestsQueued.load(std::memory_order_relaxed)},
+            {"completeHits", completeHits.load(std::memory_order_relaxed)},
+            {"memoryPrefixHits", memoryPrefixHits.load(std::memory_order_relaxed)},
+            {"diskPrefixHits", diskPrefixHits.load(std::memory_order_relaxed)},
+            {"coldLoads", coldLoads.load(std::memory_order_relaxed)},
+            {"queueDepth", queueDepth.load(std::memory_order_relaxed)},
+            {"peakQueueDepth", peakQueueDepth.load(std::memory_order_relaxed)},
+            {"decodedBytes", decodedBytes.load(std::memory_order_relaxed)},
+            {"decodeThroughputMBps", getDecodeThroughputMBps()},
+            {"decodeTime", decodeTime.toJson()},
+            {"loadTime", loadTime.toJson()},
+            {"transforms", transforms}
+        };
+    }
+
+private:
+    struct TransformSlot {
+        std::atomic<const char*> name {nullptr};
+        LatencyHistogram time;
+    };
+    std::array<TransformSlot, maxTransformTypes> transformSlots;
+
+    static std::string demangle(const char* name) {
+#if __has_include(<cxxabi.h>)
+        int status = 0;
+        if (auto* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status)) {
+            std::string result(demangled);
+            std::free(demangled);
+            return result;
+        }
+#endif
+        return name;
+    }
+};
+
+} // namespace imagiro
@@ -1,6 +1,7 @@
 #pragma once
 #include "Transform.h"
 #include "InfoBuffer.h"
+#include "CompressedBuffer.h"
 #include <memory>
 #include <vector>
 #include <chrono>
@@ -14,37 +15,88 @@ namespace imagiro {
 template<typename T>
 using Result = std::expected<T, std::string>;
 
+// Identifies a client (e.g. a plugin instance) of a shared cache, for quota accounting
+using ClientId = uint32_t;
+static constexpr ClientId NoClient = 0;
+
+// Identity of a (partial) transform chain. The hash is what the cache is keyed by; the canonical
+// string is stored alongside each entry and compared on lookup, so a hash collision is a miss
+// rather than the wrong buffer.
+struct ChainId {
+    Hash128 hash;
+    std::string canonical;
+
+    static ChainId fromCanonical(std::string canonical) {
+        const auto hash = Hasher128().update(canonical).finish();
+        return {hash, std::move(canonical)};
+    }
+
+    bool operator==(const ChainId& other) const {
+        return hash == other.hash && canonical == other.canonical;
+    }
+};
+
 // Cache key representing a transform chain
 struct CacheKey {
     std::vector<std::unique_ptr<Transform>> transforms;
     size_t nocacheIndex = std::numeric_limits<size_t>::max();
 
+    // Publish the buffer as soon as its first chunk is ready, see InfoBuffer::getReadySamples().
+    // Not part of the chain's identity.
+    bool progressive = false;
+
     // Get key for partial chain up to (but not including) index
     CacheKey getPartialKey(size_t upToIndex) const {
         CacheKey partial;
         partial.nocacheIndex = nocacheIndex;
+        partial.progressive = progressive;
         for (size_t i = 0; i < upToIndex && i < transforms.size(); ++i) {
             partial.transforms.push_back(transforms[i]->clone());
         }
         return partial;
     }
 
-    // Get hash for the full chain
-    size_t getHash() const {
-        return getPartialHash(transforms.size());
+    // Identity of the full chain
+    ChainId getId() const {
+        return getPartialId(transforms.size());
+    }
+
+    // Identity of the chain up to (but not including) a transform index
+    ChainId getPartialId(size_t upToIndex) const {
+        std::string canonical;
+        for (size_t i = 0; i < upToIndex && i < transforms.size(); ++i) {
+            appendCanonical(canonical, transforms[i]->getCanonicalKey());
+        }
+        return ChainId::fromCanonical(std::move(canonical));
+    }
+
+    // Identity of the same partial chain, but with the source replaced by the samples it produced.
+    // Identical audio loaded from different paths (or different sources) then shares entries.
+    ChainId getContentPartialId(const Hash128& contentHash, size_t upToIndex) const {
+        std::string canonical;
+        appendCanonical(canonical, "content|" + contentHash.toHex());
+        for (size_t i = 1; i < upToIndex && i < transforms.size(); ++i) {
+            appendCanonical(canonical, transforms[i]->getCanonicalKey());
+        }
+        return ChainId::fromCanonical(std::move(canonical));
     }
 
-    // Get hash up to specific transform index
-    size_t getPartialHash(size_t upToIndex) const {
-        size_t hash = 0;
+    // Stable hash up to a transform index, for the persistent cache.
+    // Doesn't include the source file, which is identified by content.
+    uint64_t getPersistentHash(size_t upToIndex) const {
+        Hasher64 hasher;
         for (size_t i = 0; i < upToIndex && i < transforms.size(); ++i) {
-            hash ^= transforms[i]->getHash() << (i % 64);
+            hasher.update(transforms[i]->getPersistentHash());
         }
-        return hash;
+        return hasher.finish();
+    }
+
+    std::string getSourcePath() const {
+        return transforms.empty() ? std::string() : transforms[0]->getSourcePath();
     }
 
     // Copy constructor
-    CacheKey(const CacheKey& other) : nocacheIndex(other.nocacheIndex) {
+    CacheKey(const CacheKey& other) : nocacheIndex(other.nocacheIndex), progressive(other.progressive) {
         for (const auto& transform : other.transforms) {
             transforms.push_back(transform->clone());
         }
@@ -58,18 +110,28 @@ struct CacheKey {
         if (this != &other) {
             transforms.clear();
             nocacheIndex = other.nocacheIndex;
+            progressive = other.progressive;
             for (const auto& transform : other.transforms) {
                 transforms.push_back(transform->clone());
             }
         }
         return *this;
     }
+
+private:
+    // Length-prefixed, so no choice of key strings can make two different chains concatenate the same
+    static void appendCanonical(std::string& chain, const std::string& key) {
+        chain += std::to_string(key.size());
+        chain += ':';
+        chain += key;
+    }
 };
 
 // States for cache entries
 enum class CacheEntryState {
     Loading,
     Ready,
+    Compressed, // cold, held losslessly compressed until it's requested again (see BufferCache)
     Error
 };
 
@@ -80,6 +142,19 @@ struct CacheEntry {
     std::string errorMessage;
     size_t sizeInBytes = 0;
     std::chrono::steady_clock::time_point lastAccess;
+    ClientId owner = NoClient; // client charged for this entry
+
+    // Chain this entry was stored for, checked on lookup (see ChainId).
+    // Shared so that copying an entry out of the cache never allocates.
+    std::shared_ptr<const std::string> canonicalKey;
+
+    // Set for entries that only point at another one with the same content (see content addressing
+    // in BufferLoader). Aliases hold no buffer and cost nothing against the budget.
+    std::shared_ptr<const ChainId> aliasOf;
+
+    // Samples of a Compressed entry, which has no buffer
+    std::shared_ptr<const CompressedBuffer> compressed;
+    bool incompressible = false; // tried already, not worth trying again
 
     CacheEntry() : lastAccess(std::chrono::steady_clock::now()) {}
 
@@ -92,6 +167,7 @@ struct CacheEntry {
 struct LoadRequest {
     CacheKey key;
     std::shared_ptr<std::promise<Result<std::shared_ptr<InfoBuffer>>>> promise;
+    ClientId client = NoClient;
 };
 
 } // namespace imagiro
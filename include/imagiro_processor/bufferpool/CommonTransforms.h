@@ -2,7 +2,9 @@
 #include <utility>
 
 #include "Transform.h"
+#include "MappedAudioFile.h"
 #include <imagiro_processor/dsp/filter/CascadedBiquadFilter.h>
+#include <imagiro_processor/dsp/interpolation.h>
 #include "juce_dsp/juce_dsp.h"
 #include "juce_audio_formats/juce_audio_formats.h"
 
@@ -23,6 +25,304 @@ public:
     }
 
     bool process(juce::AudioSampleBuffer& buffer, double& sampleRate) const override {
+        InfoBuffer info;
+        if (!processInfo(info)) return false;
+        buffer.makeCopyOf(info.buffer);
+        sampleRate = info.sampleRate;
+        return true;
+    }
+
+    bool processInfo(InfoBuffer& info) const override {
+        Chunked source(*this);
+        if (!source.prepare(info) || !source.read(info, 0, info.buffer.getNumSamples())) {
+            lastError = source.getLastError();
+            return false;
+        }
+        return true;
+    }
+
+    std::unique_ptr<ChunkedSource> createChunkedSource() const override {
+        return std::make_unique<Chunked>(*this);
+    }
+
+    bool isSource() const override { return true; }
+
+    std::optional<uint64_t> estimateSizeInBytes() const override {
+        std::unique_ptr<juce::AudioFormatReader> reader(afm.createReaderFor(juce::File(filePath)));
+        if (!reader) return std::nullopt;
+
+        const auto totalSamples = reader->lengthInSamples;
+        const auto start = std::min(static_cast<juce::int64>(startSample), totalSamples);
+        const auto end = endSample == 0 ? totalSamples : std::min(static_cast<juce::int64>(endSample), totalSamples);
+        const auto channels = numChannels == 0 ? static_cast<int>(reader->numChannels)
+                                               : std::min(numChannels, static_cast<int>(reader->numChannels));
+        return static_cast<uint64_t>(std::max<juce::int64>(0, end - start)) * static_cast<uint64_t>(channels) * sizeof(float);
+    }
+
+    size_t getHash() const override {
+        size_t h = std::hash<std::string>{}(filePath);
+        h ^= std::hash<size_t>{}(startSample) << 1;
+        h ^= std::hash<size_t>{}(endSample) << 2;
+        h ^= std::hash<int>{}(numChannels) << 3;
+        return h;
+    }
+
+    std::unique_ptr<Transform> clone() const override {
+        return std::make_unique<LoadTransform>(*this);
+    }
+
+    std::string getDescription() const override {
+        return "Load: " + filePath;
+    }
+
+    std::string getCanonicalKey() const override {
+        return "load|" + filePath + "|" + std::to_string(startSample) + "|" + std::to_string(endSample)
+            + "|" + std::to_string(numChannels);
+    }
+
+    uint64_t getPersistentHash() const override {
+        return Hasher64().update(std::string("load"))
+            .update(static_cast<uint64_t>(startSample))
+            .update(static_cast<uint64_t>(endSample))
+            .update(static_cast<uint64_t>(numChannels))
+            .finish();
+    }
+
+    std::string getSourcePath() const override { return filePath; }
+
+    std::string getLastError() const override { return lastError; }
+
+    const std::string& getFilePath() const { return filePath; }
+    size_t getStartSample() const { return startSample; }
+    size_t getEndSample() const { return endSample; }
+    int getNumChannels() const { return numChannels; }
+    juce::AudioFormatManager& getFormatManager() const { return afm; }
+
+private:
+    std::string filePath;
+    size_t startSample;
+    size_t endSample;
+    int numChannels;
+    mutable std::string lastError;
+
+    juce::AudioFormatManager& afm;
+
+    // Keeps the reader open between chunks
+    class Chunked : public ChunkedSource {
+    public:
+        explicit Chunked(const LoadTransform& t)
+            : filePath(t.filePath), startSample(t.startSample), endSample(t.endSample),
+              numChannels(t.numChannels), afm(t.afm) {}
+
+        bool prepare(InfoBuffer& info) override {
+            const auto file = juce::File(filePath);
+            if (!file.existsAsFile()) {
+                error = "File does not exist: " + filePath;
+                return false;
+            }
+
+            reader.reset(afm.createReaderFor(file));
+            if (!reader) {
+                error = "Cannot create reader for file: " + filePath;
+                return false;
+            }
+
+            // Determine range to load
+            const auto totalSamples = reader->lengthInSamples;
+            start = std::min(static_cast<juce::int64>(startSample), totalSamples);
+            const auto end = endSample == 0 ? totalSamples : std::min(static_cast<juce::int64>(endSample), totalSamples);
+            const auto samplesToRead = end - start;
+
+            if (samplesToRead <= 0) {
+                error = "Invalid sample range";
+                return false;
+            }
+
+            // Determine channels
+            const auto channelsToRead = numChannels == 0
+                                            ? static_cast<int>(reader->numChannels)
+                                            : std::min(numChannels, static_cast<int>(reader->numChannels));
+
+            // Allocate buffer
+            info.allocate(channelsToRead, static_cast<int>(samplesToRead));
+            info.sampleRate = reader->sampleRate;
+            fileSize = file.getSize();
+            return true;
+        }
+
+        bool read(InfoBuffer& info, int chunkStart, int numSamples) override {
+            // Readers fill whatever's missing from a truncated file with silence rather than failing
+            if (juce::File(filePath).getSize() < fileSize) {
+                error = "File was truncated while loading: " + filePath;
+                return false;
+            }
+
+            auto& buffer = info.buffer;
+            juce::HeapBlock<float*> channels(buffer.getNumChannels());
+            for (int c = 0; c < buffer.getNumChannels(); c++) {
+                channels[c] = buffer.getWritePointer(c, chunkStart);
+            }
+
+            if (!reader->read(channels.get(), buffer.getNumChannels(), start + chunkStart, numSamples)) {
+                error = "Failed to read audio data";
+                return false;
+            }
+            return true;
+        }
+
+        std::string getLastError() const override { return error; }
+
+    private:
+        std::string filePath;
+        size_t startSample;
+        size_t endSample;
+        int numChannels;
+        juce::AudioFormatManager& afm;
+
+        std::unique_ptr<juce::AudioFormatReader> reader;
+        juce::int64 fileSize {0};
+        juce::int64 start {0};
+        std::string error;
+    };
+};
+
+// Memory-mapped source for uncompressed WAV/AIFF files.
+// Mono float files are used straight from the mapping with no copy; other formats are converted a
+// chunk at a time from the mapping instead of going through an AudioFormatReader, so peak memory is
+// only the output buffer. Falls back to a regular LoadTransform for anything it can't map.
+// Produces the same samples as LoadTransform, so it shares its cache entries.
+class MappedLoadTransform : public Transform {
+public:
+    using AccessPattern = MappedAudioFile::AccessPattern;
+
+    MappedLoadTransform(std::string path,
+                        juce::AudioFormatManager& afm,
+                        const AccessPattern accessPattern = AccessPattern::Random,
+                        const int startSample = 0,
+                        const int endSample = 0,
+                        const int numChannels = 0)
+        : filePath(std::move(path)),
+          accessPattern(accessPattern),
+          startSample(std::max(0, startSample)),
+          endSample(std::max(0, endSample)),
+          numChannels(std::max(0, numChannels)),
+          afm(afm) {
+    }
+
+    bool process(juce::AudioSampleBuffer& buffer, double& sampleRate) const override {
+        InfoBuffer info;
+        if (!processInfo(info)) return false;
+        buffer.makeCopyOf(info.buffer);
+        sampleRate = info.sampleRate;
+        return true;
+    }
+
+    bool processInfo(InfoBuffer& info) const override {
+        const auto file = juce::File(filePath);
+        auto mapped = std::shared_ptr<MappedAudioFile>(MappedAudioFile::open(file));
+        if (!mapped) return fallback().processInfo(info);
+
+        const auto totalSamples = mapped->getLengthInSamples();
+        const auto start = std::min(static_cast<juce::int64>(startSample), totalSamples);
+        const auto end = endSample == 0 ? totalSamples : std::min(static_cast<juce::int64>(endSample), totalSamples);
+        const auto samplesToRead = end - start;
+
+        if (samplesToRead <= 0) {
+            lastError = "Invalid sample range";
+            return false;
+        }
+
+        const auto channelsToRead = numChannels == 0
+                                        ? mapped->getNumChannels()
+                                        : std::min(numChannels, mapped->getNumChannels());
+
+        info.sampleRate = mapped->getSampleRate();
+        info.file = file;
+
+        if (auto* data = mapped->getZeroCopyData()) {
+            // Refer to the mapping directly, the InfoBuffer keeps it alive
+            mapped->adviseAccess(accessPattern);
+            float* channels[] = { data + start };
+            info.buffer.setDataToReferTo(channels, 1, static_cast<int>(samplesToRead));
+            info.storageOwner = mapped;
+            return true;
+        }
+
+        info.allocate(channelsToRead, static_cast<int>(samplesToRead));
+        if (!mapped->read(info.buffer.getArrayOfWritePointers(), channelsToRead, start, static_cast<int>(samplesToRead))) {
+            lastError = "Failed to read audio data";
+            return false;
+        }
+
+        return true;
+    }
+
+    bool isSource() const override { return true; }
+
+    size_t getHash() const override {
+        return fallback().getHash();
+    }
+
+    std::unique_ptr<Transform> clone() const override {
+        return std::make_unique<MappedLoadTransform>(*this);
+    }
+
+    std::string getDescription() const override {
+        return "Load (mapped): " + filePath;
+    }
+
+    std::string getCanonicalKey() const override { return fallback().getCanonicalKey(); }
+    uint64_t getPersistentHash() const override { return fallback().getPersistentHash(); }
+    std::string getSourcePath() const override { return filePath; }
+    std::optional<uint64_t> estimateSizeInBytes() const override { return fallback().estimateSizeInBytes(); }
+
+    std::string getLastError() const override { return lastError; }
+
+    const std::string& getFilePath() const { return filePath; }
+
+private:
+    std::string filePath;
+    AccessPattern accessPattern;
+    size_t startSample;
+    size_t endSample;
+    int numChannels;
+    mutable std::string lastError;
+
+    juce::AudioFormatManager& afm;
+
+    LoadTransform fallback() const {
+        return LoadTransform(filePath, afm, static_cast<int>(startSample), static_cast<int>(endSample), numChannels);
+    }
+};
+
+// Streaming source - only the first preloadMs of the sample is loaded, the rest stays on disk and is
+// read during playback through a DiskStreamer voice. Memory use then scales with active voices rather
+// than sample length. Transforms after this would only see the resident head, so it must be used alone.
+class StreamTransform : public Transform {
+public:
+    StreamTransform(std::string path,
+                    juce::AudioFormatManager& afm,
+                    const double preloadMs,
+                    const int startSample = 0,
+                    const int endSample = 0,
+                    const int numChannels = 0)
+        : filePath(std::move(path)),
+          preloadMs(std::max(0.0, preloadMs)),
+          startSample(std::max(0, startSample)),
+          endSample(std::max(0, endSample)),
+          numChannels(std::max(0, numChannels)),
+          afm(afm) {
+    }
+
+    bool process(juce::AudioSampleBuffer& buffer, double& sampleRate) const override {
+        InfoBuffer info;
+        if (!processInfo(info)) return false;
+        buffer = std::move(info.buffer);
+        sampleRate = info.sampleRate;
+        return true;
+    }
+
+    bool processInfo(InfoBuffer& info) const override {
         const auto file = juce::File(filePath);
         if (!file.existsAsFile()) {
             lastError = "File does not exist: " + filePath;
@@ -35,62 +335,95 @@ public:
             return false;
         }
 
-        // Determine range to load
+        // Determine range to stream
         const auto totalSamples = reader->lengthInSamples;
-        const auto start = std::min(startSample, static_cast<size_t>(totalSamples));
+        const auto start = std::min(static_cast<juce::int64>(startSample), totalSamples);
         const auto end = endSample == 0 ? totalSamples : std::min(static_cast<juce::int64>(endSample), totalSamples);
-        const auto samplesToRead = end - start;
+        const auto samplesInRange = end - start;
 
-        if (samplesToRead <= 0) {
+        if (samplesInRange <= 0) {
             lastError = "Invalid sample range";
             return false;
         }
 
-        // Determine channels
         const auto channelsToRead = numChannels == 0
-                                        ? reader->numChannels
+                                        ? static_cast<int>(reader->numChannels)
                                         : std::min(numChannels, static_cast<int>(reader->numChannels));
 
-        // Allocate buffer
-        buffer.setSize(channelsToRead, static_cast<int>(samplesToRead));
+        // Only the head is resident
+        const auto headLength = std::min(samplesInRange,
+                                         static_cast<juce::int64>(preloadMs * 0.001 * reader->sampleRate));
 
-        // Read audio
-        if (!reader->read(buffer.getArrayOfWritePointers(),
-                          channelsToRead,
-                          static_cast<juce::int64>(start),
-                          static_cast<int>(samplesToRead))) {
+        info.buffer.setSize(channelsToRead, static_cast<int>(headLength));
+        if (!reader->read(info.buffer.getArrayOfWritePointers(), channelsToRead, start, static_cast<int>(headLength))) {
             lastError = "Failed to read audio data";
             return false;
         }
 
-        sampleRate = reader->sampleRate;
+        info.sampleRate = reader->sampleRate;
+        info.file = file;
+        info.stream.reset();
+
+        if (headLength < samplesInRange) {
+            auto source = std::make_shared<StreamingSource>();
+            source->filePath = filePath;
+            source->fileStartSample = start;
+            source->lengthInSamples = samplesInRange;
+            source->numChannels = channelsToRead;
+            source->sampleRate = reader->sampleRate;
+            source->headLength = static_cast<int>(headLength);
+            info.stream = std::move(source);
+        }
+
         return true;
     }
 
+    bool isSource() const override { return true; }
+
+    // Only the head counts, the rest is read from disk
+    std::optional<uint64_t> estimateSizeInBytes() const override {
+        std::unique_ptr<juce::AudioFormatReader> reader(afm.createReaderFor(juce::File(filePath)));
+        if (!reader) return std::nullopt;
+
+        const auto totalSamples = reader->lengthInSamples;
+        const auto start = std::min(static_cast<juce::int64>(startSample), totalSamples);
+        const auto end = endSample == 0 ? totalSamples : std::min(static_cast<juce::int64>(endSample), totalSamples);
+        const auto headLength = std::min(std::max<juce::int64>(0, end - start),
+                                         static_cast<juce::int64>(preloadMs * 0.001 * reader->sampleRate));
+        const auto channels = numChannels == 0 ? static_cast<int>(reader->numChannels)
+                                               : std::min(numChannels, static_cast<int>(reader->numChannels));
+        return static_cast<uint64_t>(headLength) * static_cast<uint64_t>(channels) * sizeof(float);
+    }
+
     size_t getHash() const override {
-        size_t h = std::hash<std::string>{}(filePath);
-        h ^= std::hash<size_t>{}(startSample) << 1;
-        h ^= std::hash<size_t>{}(endSample) << 2;
-        h ^= std::hash<int>{}(numChannels) << 3;
+        size_t h = std::hash<std::string>{}("stream:" + filePath);
+        h ^= std::hash<double>{}(preloadMs) << 1;
+        h ^= std::hash<size_t>{}(startSample) << 2;
+        h ^= std::hash<size_t>{}(endSample) << 3;
+        h ^= std::hash<int>{}(numChannels) << 4;
         return h;
     }
 
     std::unique_ptr<Transform> clone() const override {
-        return std::make_unique<LoadTransform>(*this);
+        return std::make_unique<StreamTransform>(*this);
     }
 
     std::string getDescription() const override {
-        return "Load: " + filePath;
+        return "Stream: " + filePath + " (" + std::to_string(preloadMs) + "ms preload)";
+    }
+
+    std::string getCanonicalKey() const override {
+        return "stream|" + filePath + "|" + exact(preloadMs) + "|" + std::to_string(startSample)
+            + "|" + std::to_string(endSample) + "|" + std::to_string(numChannels);
     }
 
     std::string getLastError() const override { return lastError; }
 
     const std::string& getFilePath() const { return filePath; }
-    size_t getStartSample() const { return startSample; }
-    size_t getEndSample() const { return endSample; }
 
 private:
     std::string filePath;
+    double preloadMs;
     size_t startSample;
     size_t endSample;
     int numChannels;
@@ -105,6 +438,36 @@ class BandpassTransform : public Transform {
     float highFreq;
     mutable std::string lastError;
 
+    // Filter state carries over between chunks, so chunked output matches a single pass
+    class Chunked : public ChunkProcessor {
+    public:
+        Chunked(float low, float high, int numChannels, double sampleRate)
+            : bypassed(low <= 20 && high >= 20000) {
+            lp.setFilterType(CascadedBiquadFilter<4>::LOWPASS);
+            hp.setFilterType(CascadedBiquadFilter<4>::HIGHPASS);
+            lp.setSampleRate(sampleRate);
+            hp.setSampleRate(sampleRate);
+            lp.setCutoff(high);
+            hp.setCutoff(low);
+            lp.setChannels(numChannels);
+            hp.setChannels(numChannels);
+        }
+
+        void process(juce::AudioSampleBuffer& buffer, int startSample, int numSamples) override {
+            if (bypassed) return;
+            for (auto c = 0; c < buffer.getNumChannels(); c++) {
+                auto* data = buffer.getWritePointer(c, startSample);
+                lp.processBlock(data, numSamples, c);
+                hp.processBlock(data, numSamples, c);
+            }
+        }
+
+    private:
+        const bool bypassed;
+        CascadedBiquadFilter<4> lp;
+        CascadedBiquadFilter<4> hp;
+    };
+
 public:
     BandpassTransform(float low, float high)
         : lowFreq(low), highFreq(high) {
@@ -118,25 +481,7 @@ public:
             return false;
         }
 
-        CascadedBiquadFilter<4> lp;
-        CascadedBiquadFilter<4> hp;
-        lp.setFilterType(CascadedBiquadFilter<4>::LOWPASS);
-        hp.setFilterType(CascadedBiquadFilter<4>::HIGHPASS);
-        lp.setSampleRate(sampleRate);
-        hp.setSampleRate(sampleRate);
-        lp.setCutoff(highFreq);
-        hp.setCutoff(lowFreq);
-        lp.setChannels(buffer.getNumChannels());
-        hp.setChannels(buffer.getNumChannels());
-
-        for (auto c = 0; c < buffer.getNumChannels(); c++) {
-            for (auto s = 0; s < buffer.getNumSamples(); s++) {
-                auto v = buffer.getSample(c, s);
-                v = lp.process(v, c);
-                v = hp.process(v, c);
-                buffer.setSample(c, s, v);
-            }
-        }
+        Chunked(lowFreq, highFreq, buffer.getNumChannels(), sampleRate).process(buffer, 0, buffer.getNumSamples());
         return true;
     }
 
@@ -154,6 +499,17 @@ public:
         return "Bandpass: " + std::to_string(lowFreq) + "-" + std::to_string(highFreq) + "Hz";
     }
 
+    std::string getCanonicalKey() const override {
+        return "bandpass|" + exact(lowFreq) + "|" + exact(highFreq);
+    }
+
+    bool isChannelIndependent() const override { return true; }
+
+    std::unique_ptr<ChunkProcessor> createChunkProcessor(int numChannels, double sampleRate) const override {
+        if (sampleRate <= 0) return nullptr;
+        return std::make_unique<Chunked>(lowFreq, highFreq, numChannels, sampleRate);
+    }
+
     std::string getLastError() const override { return lastError; }
 };
 
@@ -182,6 +538,10 @@ public:
         return "Normalize";
     }
 
+    std::optional<float> getGainFactor(float currentMagnitude) const override {
+        return currentMagnitude > 0.0f ? 1.0f / currentMagnitude : 1.0f;
+    }
+
     std::string getLastError() const override { return lastError; }
 };
 
@@ -211,7 +571,399 @@ public:
         return "Gain: " + std::to_string(gainDb) + "dB";
     }
 
+    std::string getCanonicalKey() const override {
+        return "gain|" + exact(gainDb);
+    }
+
+    bool isChannelIndependent() const override { return true; }
+
+    std::optional<float> getGainFactor(float) const override {
+        return juce::Decibels::decibelsToGain(gainDb);
+    }
+
+    std::unique_ptr<ChunkProcessor> createChunkProcessor(int, double) const override {
+        struct Chunked : ChunkProcessor {
+            float gain;
+            explicit Chunked(float g) : gain(g) {}
+            void process(juce::AudioSampleBuffer& buffer, int startSample, int numSamples) override {
+                buffer.applyGain(startSample, numSamples, gain);
+            }
+        };
+        return std::make_unique<Chunked>(juce::Decibels::decibelsToGain(gainDb));
+    }
+
+    std::string getLastError() const override { return lastError; }
+};
+
+// Adds silent guard samples around the content, so a playback interpolator can read its neighbours
+// at any position without bounds checks
+class PadTransform : public Transform {
+    int pre;
+    int post;
+    mutable std::string lastError;
+
+public:
+    PadTransform(int preSamples = INTERP_PRE_SAMPLES, int postSamples = INTERP_POST_SAMPLES)
+        : pre(std::max(0, preSamples)), post(std::max(0, postSamples)) {
+    }
+
+    bool process(juce::AudioSampleBuffer& buffer, double& sampleRate) const override {
+        InfoBuffer input;
+        input.buffer = std::move(buffer);
+        input.sampleRate = sampleRate;
+        InfoBuffer output;
+        processInto(input, output);
+        buffer.makeCopyOf(output.buffer);
+        return true;
+    }
+
+    bool isInPlace() const override { return false; }
+
+    bool processInto(const InfoBuffer& input, InfoBuffer& output) const override {
+        const auto numSamples = input.buffer.getNumSamples();
+        output.allocate(input.buffer.getNumChannels(), numSamples + pre + post);
+        output.buffer.clear();
+        for (int c = 0; c < input.buffer.getNumChannels(); c++) {
+            output.buffer.copyFrom(c, pre, input.buffer, c, 0, numSamples);
+        }
+
+        output.sampleRate = input.sampleRate;
+        output.file = input.file;
+        output.padStart = input.padStart + pre;
+        output.padEnd = input.padEnd + post;
+        output.reversed = input.reversed;
+        return true;
+    }
+
+    size_t getHash() const override {
+        size_t h = std::hash<std::string>{}("pad");
+        h ^= std::hash<int>{}(pre) << 1;
+        h ^= std::hash<int>{}(post) << 2;
+        return h;
+    }
+
+    std::unique_ptr<Transform> clone() const override {
+        return std::make_unique<PadTransform>(pre, post);
+    }
+
+    std::string getDescription() const override {
+        return "Pad: " + std::to_string(pre) + "/" + std::to_string(post);
+    }
+
+    std::string getLastError() const override { return lastError; }
+};
+
+// Stores the content back to front, so reverse playback walks forwards through memory
+class ReverseTransform : public Transform {
+    mutable std::string lastError;
+
+public:
+    bool process(juce::AudioSampleBuffer& buffer, double& sampleRate) const override {
+        buffer.reverse(0, buffer.getNumSamples());
+        return true;
+    }
+
+    bool processInfo(InfoBuffer& info) const override {
+        info.buffer.reverse(0, info.buffer.getNumSamples());
+        std::swap(info.padStart, info.padEnd);
+        info.reversed = !info.reversed;
+        return true;
+    }
+
+    size_t getHash() const override {
+        return std::hash<std::string>{}("reverse");
+    }
+
+    std::unique_ptr<Transform> clone() const override {
+        return std::make_unique<ReverseTransform>();
+    }
+
+    std::string getDescription() const override {
+        return "Reverse";
+    }
+
+    std::string getLastError() const override { return lastError; }
+};
+
+// Polyphase windowed-sinc sample rate conversion, so grains can play at the session rate without
+// resampling on the fly. Use before PadTransform.
+class ResampleTransform : public Transform {
+    double targetRate;
+    mutable std::string lastError;
+
+    static constexpr int numPhases = 1024;
+    static constexpr int halfTapsAtUnity = 16;
+    static constexpr double kaiserBeta = 8.6;
+
+    static double besselI0(double x) {
+        double sum = 1, term = 1;
+        for (int k = 1; k < 32; k++) {
+            term *= (x / (2 * k)) * (x / (2 * k));
+            sum += term;
+            if (term < sum * 1e-12) break;
+        }
+        return sum;
+    }
+
+public:
+    explicit ResampleTransform(double targetSampleRate) : targetRate(targetSampleRate) {
+    }
+
+    bool process(juce::AudioSampleBuffer& buffer, double& sampleRate) const override {
+        InfoBuffer input;
+        input.buffer = std::move(buffer);
+        input.sampleRate = sampleRate;
+        InfoBuffer output;
+        if (!processInto(input, output)) return false;
+        buffer.makeCopyOf(output.buffer);
+        sampleRate = output.sampleRate;
+        return true;
+    }
+
+    bool isInPlace() const override { return false; }
+
+    bool processInto(const InfoBuffer& input, InfoBuffer& output) const override {
+        if (input.sampleRate <= 0 || targetRate <= 0) {
+            lastError = "Invalid sample rate";
+            return false;
+        }
+        if (input.padStart != 0 || input.padEnd != 0) {
+            lastError = "Resample before padding";
+            return false;
+        }
+
+        output.file = input.file;
+        output.reversed = input.reversed;
+        output.sampleRate = targetRate;
+
+        const auto ratio = targetRate / input.sampleRate;
+        if (juce::approximatelyEqual(ratio, 1.0)) {
+            output.allocateCopyOf(input.buffer);
+            return true;
+        }
+
+        // Lowpass at the lower of the two Nyquist rates, widening the kernel to match when downsampling
+        const auto cutoff = std::min(1.0, ratio) * 0.97;
+        const auto half = static_cast<int>(std::ceil(halfTapsAtUnity / std::max(cutoff, 1.0 / 16)));
+        const auto numTaps = 2 * half;
+
+        // Kernel for each fractional phase, plus one extra row to interpolate towards
+        std::vector<float> table(static_cast<size_t>((numPhases + 1) * numTaps));
+        const auto windowNorm = besselI0(kaiserBeta);
+        for (int p = 0; p <= numPhases; p++) {
+            for (int j = 0; j < numTaps; j++) {
+                const auto d = static_cast<double>(p) / numPhases + (half - 1 - j);
+                const auto x = cutoff * d;
+                const auto sinc = std::abs(x) < 1e-9 ? 1.0 : std::sin(juce::MathConstants<double>::pi * x) / (juce::MathConstants<double>::pi * x);
+                const auto w = d / half;
+                const auto window = std::abs(w) >= 1 ? 0.0 : besselI0(kaiserBeta * std::sqrt(1 - w * w)) / windowNorm;
+                table[static_cast<size_t>(p * numTaps + j)] = static_cast<float>(cutoff * sinc * window);
+            }
+        }
+
+        const auto inLength = input.buffer.getNumSamples();
+        const auto outLength = static_cast<int>(std::ceil(inLength * ratio));
+        output.allocate(input.buffer.getNumChannels(), outLength);
+
+        // Zero padded copy of each channel so the kernel never runs off the ends
+        std::vector<float> padded(static_cast<size_t>(inLength + 2 * numTaps), 0.f);
+
+        for (int c = 0; c < input.buffer.getNumChannels(); c++) {
+            std::copy_n(input.buffer.getReadPointer(c), inLength, padded.begin() + numTaps);
+            auto* out = output.buffer.getWritePointer(c);
+
+            for (int n = 0; n < outLength; n++) {
+                const auto t = n / ratio;
+                const auto i = static_cast<int>(t);
+                const auto phase = (t - i) * numPhases;
+                const auto p = static_cast<int>(phase);
+                const auto blend = static_cast<float>(phase - p);
+
+                const auto* row0 = table.data() + p * numTaps;
+                const auto* row1 = row0 + numTaps;
+                const auto* in = padded.data() + numTaps + i - half + 1;
+
+                float acc0 = 0, acc1 = 0;
+                for (int j = 0; j < numTaps; j++) {
+                    acc0 += in[j] * row0[j];
+                    acc1 += in[j] * row1[j];
+                }
+                out[n] = acc0 + (acc1 - acc0) * blend;
+            }
+        }
+
+        return true;
+    }
+
+    size_t getHash() const override {
+        return std::hash<std::string>{}("resample") ^ (std::hash<double>{}(targetRate) << 1);
+    }
+
+    std::unique_ptr<Transform> clone() const override {
+        return std::make_unique<ResampleTransform>(targetRate);
+    }
+
+    std::string getDescription() const override {
+        return "Resample: " + std::to_string(targetRate) + "Hz";
+    }
+
+    std::string getCanonicalKey() const override {
+        return "resample|" + exact(targetRate);
+    }
+
+    std::string getLastError() const override { return lastError; }
+};
+
+
+// Stores the samples as 16 bit (see CompactSamples), halving their memory. Must be the last
+// transform in a chain - nothing can process compact samples.
+class CompactTransform : public Transform {
+    CompactSamples::Format format;
+    mutable std::string lastError;
+
+public:
+    explicit CompactTransform(CompactSamples::Format storageFormat = CompactSamples::Format::Int16)
+        : format(storageFormat) {
+    }
+
+    bool process(juce::AudioSampleBuffer&, double&) const override {
+        lastError = "Compact storage only applies to an InfoBuffer";
+        return false;
+    }
+
+    bool isInPlace() const override { return false; }
+
+    bool processInto(const InfoBuffer& input, InfoBuffer& output) const override {
+        if (input.isStreamed()) {
+            lastError = "Can't compact a streamed buffer";
+            return false;
+        }
+
+        output.compact = CompactSamples::fromBuffer(input.buffer, format, input.maxMagnitude);
+        output.buffer.setSize(input.buffer.getNumChannels(), 0);
+        output.sampleRate = input.sampleRate;
+        output.maxMagnitude = input.maxMagnitude;
+        output.file = input.file;
+        output.padStart = input.padStart;
+        output.padEnd = input.padEnd;
+        output.reversed = input.reversed;
+        output.peaks = input.peaks;
+        output.analysis = input.analysis;
+        return true;
+    }
+
+    size_t getHash() const override {
+        return std::hash<std::string>{}("compact") ^ (std::hash<int>{}(static_cast<int>(format)) << 1);
+    }
+
+    std::unique_ptr<Transform> clone() const override {
+        return std::make_unique<CompactTransform>(format);
+    }
+
+    std::string getDescription() const override {
+        return std::string("Compact: ") + (format == CompactSamples::Format::Int16 ? "int16" : "float16");
+    }
+
     std::string getLastError() const override { return lastError; }
 };
 
+// Attaches a pyramid of decimated copies of the content (InfoBuffer::mipmaps), so grains can play it
+// at high pitches without aliasing. Leaves the samples alone. Must be the last transform in a chain,
+// and can't follow CompactTransform. The loader builds the channels in parallel.
+class MipmapTransform : public Transform {
+    mutable std::string lastError;
+
+public:
+    bool process(juce::AudioSampleBuffer&, double&) const override {
+        lastError = "Mipmaps only apply to an InfoBuffer";
+        return false;
+    }
+
+    bool processInfo(InfoBuffer& info) const override {
+        return build(info, InfoBuffer::Mipmaps::sequential);
+    }
+
+    bool build(InfoBuffer& info, const InfoBuffer::Mipmaps::ForEachChannel& forEachChannel) const {
+        if (info.isStreamed() || info.isCompact()) {
+            lastError = "Mipmaps need resident float samples";
+            return false;
+        }
+
+        info.mipmaps = std::make_shared<const InfoBuffer::Mipmaps>(info.getContentView(), info.sampleRate, forEachChannel);
+        return true;
+    }
+
+    size_t getHash() const override {
+        return std::hash<std::string>{}("mipmap");
+    }
+
+    std::unique_ptr<Transform> clone() const override {
+        return std::make_unique<MipmapTransform>();
+    }
+
+    std::string getDescription() const override {
+        return "Mipmap";
+    }
+
+    std::string getLastError() const override { return lastError; }
+};
+
+// Splits the input at a crossover frequency into "low" and "high" bands, in one pass. The high band
+// is whatever the lowpass removed, so the two always sum back to the input exactly.
+// Use with OutputTransform, or TransformGraph::select().
+class BandSplitTransform : public MultiOutputTransform {
+    float crossover;
+
+public:
+    explicit BandSplitTransform(float crossoverHz) : crossover(crossoverHz) {
+    }
+
+    std::vector<std::string> getOutputNames() const override {
+        return {"low", "high"};
+    }
+
+    bool processOutputs(const InfoBuffer& input, std::vector<InfoBuffer>& outputs, std::string& error) const override {
+        if (input.sampleRate <= 0) {
+            error = "Invalid sample rate";
+            return false;
+        }
+
+        const auto numChannels = input.buffer.getNumChannels();
+        const auto numSamples = input.buffer.getNumSamples();
+        auto& low = outputs[0];
+        auto& high = outputs[1];
+        low.allocateCopyOf(input.buffer);
+        high.allocate(numChannels, numSamples);
+
+        CascadedBiquadFilter<4> lp;
+        lp.setFilterType(CascadedBiquadFilter<4>::LOWPASS);
+        lp.setSampleRate(input.sampleRate);
+        lp.setCutoff(crossover);
+        lp.setChannels(numChannels);
+
+        for (int c = 0; c < numChannels; c++) {
+            lp.processBlock(low.buffer.getWritePointer(c), numSamples, c);
+            juce::FloatVectorOperations::subtract(high.buffer.getWritePointer(c), input.buffer.getReadPointer(c),
+                                                  low.buffer.getReadPointer(c), numSamples);
+        }
+
+        for (auto& output : outputs) {
+            output.sampleRate = input.sampleRate;
+            output.file = input.file;
+            output.padStart = input.padStart;
+            output.padEnd = input.padEnd;
+            output.reversed = input.reversed;
+        }
+        return true;
+    }
+
+    std::string getCanonicalKey() const override {
+        return "bandsplit|" + exact(crossover);
+    }
+
+    std::string getDescription() const override {
+        return "Band split: " + std::to_string(crossover) + "Hz";
+    }
+};
+
 } // namespace imagiro
@@ -0,0 +1,154 @@
+#pragma once
+#include "juce_audio_basics/juce_audio_basics.h"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace imagiro {
+
+// 16 bit sample storage, for cached buffers that don't need full float precision (see
+// CompactTransform). Takes half the memory of a float buffer, and is converted back to float
+// a window at a time on read.
+class CompactSamples {
+public:
+    enum class Format {
+        Int16,  // linear, scaled to the buffer's peak - best for 16 bit sources
+        Float16 // IEEE half precision - keeps relative precision for quiet material
+    };
+
+    static std::shared_ptr<CompactSamples> fromBuffer(const juce::AudioSampleBuffer& buffer, Format format,
+                                                      float magnitude) {
+        auto compact = std::make_shared<CompactSamples>();
+        compact->format = format;
+        compact->numChannels = buffer.getNumChannels();
+        compact->numSamples = buffer.getNumSamples();
+        compact->scale = magnitude > 0 ? magnitude / 32767.f : 1.f;
+        compact->data.resize(static_cast<size_t>(compact->numChannels) * static_cast<size_t>(compact->numSamples));
+
+        for (int c = 0; c < compact->numChannels; c++) {
+            const auto* in = buffer.getReadPointer(c);
+            auto* out = compact->data.data() + static_cast<size_t>(c) * static_cast<size_t>(compact->numSamples);
+            if (format == Format::Int16) {
+                const auto inverseScale = 1.f / compact->scale;
+                for (int i = 0; i < compact->numSamples; i++) {
+                    const auto v = juce::jlimit(-32767.f, 32767.f, std::round(in[i] * inverseScale));
+                    out[i] = static_cast<uint16_t>(static_cast<int16_t>(v));
+                }
+            } else {
+                floatToHalf(in, out, compact->numSamples);
+            }
+        }
+
+        return compact;
+    }
+
+    // Convert samples [start, start + num) of a channel to float
+    void toFloat(int channel, int start, int num, float* destination) const {
+        jassert(start >= 0 && start + num <= numSamples);
+        const auto* in = data.data() + static_cast<size_t>(channel) * static_cast<size_t>(numSamples) + start;
+        if (format == Format::Int16) {
+            // Simple enough for the compiler to vectorise
+            const auto* samples = reinterpret_cast<const int16_t*>(in);
+            for (int i = 0; i < num; i++) destination[i] = static_cast<float>(samples[i]) * scale;
+        } else {
+            halfToFloat(in, destination, num);
+        }
+    }
+
+    Format getFormat() const { return format; }
+    int getNumChannels() const { return numChannels; }
+    int getNumSamples() const { return numSamples; }
+
+    size_t getSizeInBytes() const { return data.size() * sizeof(uint16_t); }
+
+    static void halfToFloat(const uint16_t* in, float* out, int num) {
+        int i = 0;
+#if defined(__F16C__)
+        for (; i + 8 <= num; i += 8) {
+            const auto half = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            _mm256_storeu_ps(out + i, _mm256_cvtph_ps(half));
+        }
+#endif
+        for (; i < num; i++) out[i] = halfToFloat(in[i]);
+    }
+
+    static void floatToHalf(const float* in, uint16_t* out, int num) {
+        int i = 0;
+#if defined(__F16C__)
+        for (; i + 8 <= num; i += 8) {
+            const auto half = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), half);
+        }
+#endif
+        for (; i < num; i++) out[i] = floatToHalf(in[i]);
+    }
+
+private:
+    Format format {Format::Int16};
+    int numChannels {0};
+    int numSamples {0};
+    float scale {1};
+    std::vector<uint16_t> data; // channel after channel
+
+    static float halfToFloat(uint16_t h) {
+        const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+        uint32_t exponent = (h >> 10) & 0x1f;
+        uint32_t mantissa = h & 0x3ff;
+        uint32_t bits;
+
+        if (exponent == 0) {
+            if (mantissa == 0) {
+                bits = sign;
+            } else {
+                // Subnormal - normalise it
+                exponent = 127 - 15 + 1;
+                while ((mantissa & 0x400) == 0) {
+                    mantissa <<= 1;
+                    exponent--;
+                }
+                bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+            }
+        } else if (exponent == 0x1f) {
+            bits = sign | 0x7f800000 | (mantissa << 13);
+        } else {
+            bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+        }
+
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    static uint16_t floatToHalf(float f) {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        const auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+        const auto exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+        auto mantissa = bits & 0x7fffff;
+
+        if (((bits >> 23) & 0xff) == 0xff) return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+        if (exponent >= 0x1f) return static_cast<uint16_t>(sign | 0x7c00);
+        if (exponent <= 0) {
+            if (exponent < -10) return sign;
+            // Subnormal, round to nearest
+            mantissa |= 0x800000;
+            const auto shift = static_cast<uint32_t>(14 - exponent);
+            auto half = mantissa >> shift;
+            if ((mantissa >> (shift - 1)) & 1) half++;
+            return static_cast<uint16_t>(sign | half);
+        }
+
+        // Round to nearest even, like F16C. A carry out of the mantissa correctly bumps the exponent.
+        auto half = static_cast<uint32_t>(sign) | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+        const auto remainder = mantissa & 0x1fff;
+        if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) half++;
+        return static_cast<uint16_t>(half);
+    }
+};
+
+} // namespace imagiro
@@ -0,0 +1,269 @@
+#pragma once
+#include "InfoBuffer.h"
+#include <cstdint>
+#include <cstdlib>
+#include <future>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace imagiro {
+
+// Lossless in-memory compression for cold cache entries (see BufferCache::setCompression).
+// Samples decoded from 8/16/24 bit files are exact multiples of their format's step, so they're
+// stored at that depth, FLAC style: a fixed polynomial predictor per block and Rice coded
+// residuals. Channels holding anything else (e.g. after a gain) can't be packed losslessly, so
+// buffers with one aren't compressed at all.
+class CompressedBuffer {
+public:
+    // nullptr if the buffer can't be compressed, or wouldn't get at least minRatio smaller
+    static std::shared_ptr<const CompressedBuffer> compress(const InfoBuffer& info, float minRatio = 0.8f) {
+        if (info.isStreamed() || info.isCompact() || !info.isFullyLoaded()) return nullptr;
+
+        const auto& samples = info.buffer;
+        auto compressed = std::make_shared<CompressedBuffer>();
+        compressed->numSamples = samples.getNumSamples();
+
+        for (int c = 0; c < samples.getNumChannels(); c++) {
+            auto& channel = compressed->channels.emplace_back();
+            channel.bits = detectBitDepth(samples.getReadPointer(c), compressed->numSamples);
+            if (channel.bits == 0) return nullptr;
+            encodeChannel(samples.getReadPointer(c), compressed->numSamples, channel);
+        }
+
+        const auto floatBytes = static_cast<size_t>(samples.getNumChannels()) *
+                                static_cast<size_t>(compressed->numSamples) * sizeof(float);
+        if (static_cast<float>(compressed->getSamplesSizeInBytes()) > static_cast<float>(floatBytes) * minRatio) {
+            return nullptr;
+        }
+
+        // Everything but the samples
+        auto header = std::make_shared<InfoBuffer>();
+        header->sampleRate = info.sampleRate;
+        header->maxMagnitude = info.maxMagnitude;
+        header->file = info.file;
+        header->padStart = info.padStart;
+        header->padEnd = info.padEnd;
+        header->reversed = info.reversed;
+        header->peaks = info.peaks;
+        header->analysis = info.analysis;
+        header->mipmaps = info.mipmaps;
+        compressed->header = std::move(header);
+        return compressed;
+    }
+
+    // A new buffer with the original samples (in shared storage, see InfoBuffer::allocate())
+    std::shared_ptr<InfoBuffer> decompress() const {
+        auto info = std::make_shared<InfoBuffer>(*header);
+        info->allocate(static_cast<int>(channels.size()), numSamples);
+
+        // Channels are independent, decode each on its own thread
+        std::vector<std::future<void>> tasks;
+        for (size_t c = 1; c < channels.size(); c++) {
+            tasks.push_back(std::async(std::launch::async, [&, c] {
+                decodeChannel(channels[c], numSamples, info->buffer.getWritePointer(static_cast<int>(c)));
+            }));
+        }
+        if (!channels.empty()) decodeChannel(channels[0], numSamples, info->buffer.getWritePointer(0));
+        for (auto& task : tasks) task.get();
+        return info;
+    }
+
+    size_t getSizeInBytes() const {
+        return getSamplesSizeInBytes() + (header->peaks ? header->peaks->getSizeInBytes() : 0) +
+               (header->mipmaps ? header->mipmaps->getSizeInBytes() : 0);
+    }
+
+    int getNumChannels() const { return static_cast<int>(channels.size()); }
+    int getNumSamples() const { return numSamples; }
+
+private:
+    static constexpr int blockSize = 4096;
+    static constexpr int maxOrder = 3;
+    static constexpr uint32_t escapeQuotient = 24; // longer unary runs store the value raw instead
+
+    struct Channel {
+        int bits {0};
+        std::vector<uint8_t> data;
+    };
+
+    std::shared_ptr<const InfoBuffer> header;
+    std::vector<Channel> channels;
+    int numSamples {0};
+
+    size_t getSamplesSizeInBytes() const {
+        size_t size = 0;
+        for (const auto& channel : channels) size += channel.data.size();
+        return size;
+    }
+
+    // Smallest of 8/16/24 bits that represents every sample exactly (as the JUCE readers scale
+    // them), or 0 if none does
+    static int detectBitDepth(const float* data, int num) {
+        for (const auto bits : {8, 16, 24}) {
+            const auto scale = static_cast<float>(1 << (bits - 1));
+            auto exact = true;
+            for (int i = 0; i < num && exact; i++) {
+                const auto v = data[i] * scale;
+                exact = v == std::nearbyint(v) && v >= -scale && v < scale;
+            }
+            if (exact) return bits;
+        }
+        return 0;
+    }
+
+    // Fixed predictors of order 0-3 (FLAC's), from the previous samples of the channel
+    static int64_t predict(int order, const int64_t* history) {
+        switch (order) {
+            case 1: return history[0];
+            case 2: return 2 * history[0] - history[1];
+            case 3: return 3 * history[0] - 3 * history[1] + history[2];
+            default: return 0;
+        }
+    }
+
+    static uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+    static int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+    class BitWriter {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& destination) : out(destination) {}
+        ~BitWriter() { flush(); }
+
+        // Up to 32 bits at a time
+        void write(uint64_t value, int numBits) {
+            if (numBits == 0) return;
+            accumulator = (accumulator << numBits) | (value & ((uint64_t{1} << numBits) - 1));
+            pending += numBits;
+            while (pending >= 8) {
+                pending -= 8;
+                out.push_back(static_cast<uint8_t>(accumulator >> pending));
+            }
+        }
+
+        // That many ones, then a zero
+        void writeUnary(uint32_t ones) {
+            write(((uint64_t{1} << ones) - 1) << 1, static_cast<int>(ones) + 1);
+        }
+
+        void flush() {
+            if (pending > 0) out.push_back(static_cast<uint8_t>(accumulator << (8 - pending)));
+            pending = 0;
+        }
+
+    private:
+        std::vector<uint8_t>& out;
+        uint64_t accumulator {0};
+        int pending {0};
+    };
+
+    class BitReader {
+    public:
+        explicit BitReader(const std::vector<uint8_t>& source) : in(source) {}
+
+        uint64_t read(int numBits) {
+            if (numBits == 0) return 0;
+            while (available < numBits) {
+                accumulator = (accumulator << 8) | (position < in.size() ? in[position] : 0);
+                position++;
+                available += 8;
+            }
+            available -= numBits;
+            return (accumulator >> available) & ((uint64_t{1} << numBits) - 1);
+        }
+
+        // Ones up to the next zero (which is consumed), or limit ones
+        uint32_t readUnary(uint32_t limit) {
+            uint32_t ones = 0;
+            while (ones < limit && read(1)) ones++;
+            return ones;
+        }
+
+    private:
+        const std::vector<uint8_t>& in;
+        size_t position {0};
+        uint64_t accumulator {0};
+        int available {0};
+    };
+
+    // Each block: predictor order (2 bits), Rice parameter (5 bits), then one code per sample.
+    // Quotients of escapeQuotient or more are written as that many ones and the raw 32 bit value.
+    static void encodeChannel(const float* data, int num, Channel& channel) {
+        const auto scale = static_cast<float>(1 << (channel.bits - 1));
+        std::vector<int64_t> values(static_cast<size_t>(num) + maxOrder, 0);
+        for (int i = 0; i < num; i++) values[static_cast<size_t>(i) + maxOrder] = static_cast<int64_t>(data[i] * scale);
+
+        BitWriter writer(channel.data);
+        std::vector<uint64_t> residuals(blockSize);
+        for (int start = 0; start < num; start += blockSize) {
+            const auto count = std::min(blockSize, num - start);
+            const auto* first = values.data() + maxOrder + start;
+
+            // Order with the smallest residuals
+            auto bestOrder = 0;
+            auto bestSum = std::numeric_limits<uint64_t>::max();
+            for (int order = 0; order <= maxOrder; order++) {
+                uint64_t sum = 0;
+                for (int i = 0; i < count; i++) {
+                    const int64_t history[] {first[i - 1], first[i - 2], first[i - 3]};
+                    sum += static_cast<uint64_t>(std::abs(first[i] - predict(order, history)));
+                }
+                if (sum < bestSum) {
+                    bestSum = sum;
+                    bestOrder = order;
+                }
+            }
+
+            for (int i = 0; i < count; i++) {
+                const int64_t history[] {first[i - 1], first[i - 2], first[i - 3]};
+                residuals[static_cast<size_t>(i)] = zigzag(first[i] - predict(bestOrder, history));
+            }
+
+            // Rice parameter from the mean zigzagged residual
+            const auto mean = bestSum * 2 / static_cast<uint64_t>(count);
+            auto k = 0;
+            while (k < 31 && (uint64_t{1} << (k + 1)) <= mean) k++;
+
+            writer.write(static_cast<uint64_t>(bestOrder), 2);
+            writer.write(static_cast<uint64_t>(k), 5);
+            for (int i = 0; i < count; i++) {
+                const auto residual = residuals[static_cast<size_t>(i)];
+                const auto quotient = residual >> k;
+                if (quotient >= escapeQuotient) {
+                    writer.write((uint64_t{1} << escapeQuotient) - 1, escapeQuotient);
+                    writer.write(residual, 32);
+                } else {
+                    writer.writeUnary(static_cast<uint32_t>(quotient));
+                    writer.write(residual, k);
+                }
+            }
+        }
+    }
+
+    static void decodeChannel(const Channel& channel, int num, float* destination) {
+        const auto inverseScale = 1.f / static_cast<float>(1 << (channel.bits - 1));
+        int64_t history[maxOrder] {};
+
+        BitReader reader(channel.data);
+        for (int start = 0; start < num; start += blockSize) {
+            const auto count = std::min(blockSize, num - start);
+            const auto order = static_cast<int>(reader.read(2));
+            const auto k = static_cast<int>(reader.read(5));
+
+            for (int i = 0; i < count; i++) {
+                const auto quotient = reader.readUnary(escapeQuotient);
+                const auto residual = quotient >= escapeQuotient
+                    ? reader.read(32)
+                    : (static_cast<uint64_t>(quotient) << k) | reader.read(k);
+
+                const auto value = predict(order, history) + unzigzag(residual);
+                history[2] = history[1];
+                history[1] = history[0];
+                history[0] = value;
+                destination[start + i] = static_cast<float>(value) * inverseScale;
+            }
+        }
+    }
+};
+
+} // namespace imagiro
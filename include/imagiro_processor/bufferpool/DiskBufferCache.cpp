@@ -0,0 +1,372 @@
+#include "DiskBufferCache.h"
+#include <juce_data_structures/juce_data_structures.h>
+#include "../config/Resources.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+
+namespace imagiro {
+
+namespace {
+    constexpr uint32_t entryMagic = 0x46554249; // "IBUF"
+    constexpr uint32_t entryVersion = 3;
+    constexpr int hashBlockSize = 1 << 20;
+
+    // Everything compaction and clear() manage
+    constexpr auto entryPattern = "*.ibuf;*.ianalysis";
+
+    // Leftovers from a write that never finished (e.g. the host crashed)
+    constexpr juce::int64 staleTempFileMs = 60 * 60 * 1000;
+
+    juce::String toHex(uint64_t value) {
+        return juce::String::toHexString(static_cast<juce::int64>(value)).paddedLeft('0', 16);
+    }
+}
+
+DiskBufferCache::DiskBufferCache(juce::File dir, uint64_t maxSizeBytes)
+    : juce::Thread("DiskBufferCache"), directory(std::move(dir)), maxSize(maxSizeBytes) {
+    directory.createDirectory();
+    loadSourceIndex();
+    startThread(juce::Thread::Priority::background);
+}
+
+DiskBufferCache::~DiskBufferCache() {
+    // Let queued writes finish, they're cheap compared to decoding everything again next time
+    signalThreadShouldExit();
+    notify();
+    stopThread(10000);
+    saveSourceIndex();
+}
+
+juce::File DiskBufferCache::getDefaultDirectory() {
+    return Resources::getDataFolder().getChildFile("buffer-cache");
+}
+
+std::optional<DiskBufferCache::SourceId> DiskBufferCache::getSourceId(const std::string& path) {
+    const auto file = juce::File(path);
+    if (!file.existsAsFile()) return std::nullopt;
+
+    SourceId id;
+    id.size = file.getSize();
+    id.modificationTime = file.getLastModificationTime().toMilliseconds();
+
+    {
+        std::lock_guard<std::mutex> lock(sourcesMutex);
+        auto it = sources.find(path);
+        if (it != sources.end() && it->second.size == id.size
+            && it->second.modificationTime == id.modificationTime) {
+            return it->second;
+        }
+    }
+
+    // New or changed file, hash it (outside the lock, this reads the whole file)
+    id.contentHash = hashFileContents(file);
+    if (id.contentHash == 0) return std::nullopt;
+
+    {
+        std::lock_guard<std::mutex> lock(sourcesMutex);
+        sources[path] = id;
+        sourcesDirty = true;
+    }
+    notify();
+    return id;
+}
+
+uint64_t DiskBufferCache::hashFileContents(const juce::File& file) {
+    juce::FileInputStream stream(file);
+    if (!stream.openedOk()) return 0;
+
+    Hasher64 hasher;
+    juce::HeapBlock<char> block(hashBlockSize);
+    while (!stream.isExhausted()) {
+        const auto bytesRead = stream.read(block.get(), hashBlockSize);
+        if (bytesRead <= 0) break;
+        hasher.update(block.get(), static_cast<size_t>(bytesRead));
+    }
+
+    // 0 is reserved for "couldn't read"
+    return std::max<uint64_t>(hasher.finish(), 1);
+}
+
+juce::File DiskBufferCache::getEntryFile(const SourceId& source, uint64_t chainHash) const {
+    return directory.getChildFile(toHex(source.contentHash) + "-" + toHex(chainHash) + ".ibuf");
+}
+
+juce::File DiskBufferCache::getAnalysisFile(const SourceId& source, uint64_t chainHash) const {
+    return directory.getChildFile(toHex(source.contentHash) + "-" + toHex(chainHash) + ".ianalysis");
+}
+
+std::shared_ptr<const AnalysisMetadata> DiskBufferCache::loadAnalysis(const SourceId& source, uint64_t chainHash) {
+    std::lock_guard<std::mutex> lock(filesMutex);
+
+    auto file = getAnalysisFile(source, chainHash);
+    if (!file.existsAsFile()) return nullptr;
+
+    try {
+        const auto json = nlohmann::json::parse(file.loadFileAsString().toStdString());
+        if (json.at("version").get<uint32_t>() != entryVersion
+            || json.at("content").get<uint64_t>() != source.contentHash
+            || json.at("chain").get<uint64_t>() != chainHash) {
+            file.deleteFile();
+            return nullptr;
+        }
+
+        auto analysis = std::make_shared<AnalysisMetadata>(json.at("analysis").get<AnalysisMetadata>());
+        file.setLastAccessTime(juce::Time::getCurrentTime());
+        return analysis;
+    } catch (const nlohmann::json::exception&) {
+        file.deleteFile();
+        return nullptr;
+    }
+}
+
+void DiskBufferCache::storeAnalysis(const SourceId& source, uint64_t chainHash, const AnalysisMetadata& analysis) {
+    const nlohmann::json json = {
+        {"version", entryVersion},
+        {"content", source.contentHash},
+        {"chain", chainHash},
+        {"analysis", analysis}
+    };
+
+    // Small enough to write straight away, unlike sample entries
+    std::lock_guard<std::mutex> lock(filesMutex);
+    const auto file = getAnalysisFile(source, chainHash);
+    const auto tempFile = file.withFileExtension(".tmp");
+    if (tempFile.replaceWithText(json.dump()) && tempFile.moveFileTo(file)) {
+        currentSize += static_cast<uint64_t>(file.getSize());
+    }
+}
+
+std::shared_ptr<InfoBuffer> DiskBufferCache::load(const SourceId& source, uint64_t chainHash) {
+    std::lock_guard<std::mutex> lock(filesMutex);
+
+    auto file = getEntryFile(source, chainHash);
+    if (!file.existsAsFile()) return nullptr;
+
+    juce::FileInputStream stream(file);
+    if (!stream.openedOk()) return nullptr;
+
+    const auto magic = static_cast<uint32_t>(stream.readInt());
+    const auto version = static_cast<uint32_t>(stream.readInt());
+    const auto numChannels = stream.readInt();
+    const auto numSamples = stream.readInt64();
+    const auto sampleRate = stream.readDouble();
+    const auto maxMagnitude = stream.readFloat();
+    const auto contentHash = static_cast<uint64_t>(stream.readInt64());
+    const auto storedChainHash = static_cast<uint64_t>(stream.readInt64());
+    const auto padStart = stream.readInt();
+    const auto padEnd = stream.readInt();
+    const auto reversed = stream.readBool();
+
+    const auto headerIsValid = magic == entryMagic && version == entryVersion
+        && contentHash == source.contentHash && storedChainHash == chainHash
+        && numChannels > 0 && numSamples >= 0 && numSamples <= std::numeric_limits<int>::max()
+        && padStart >= 0 && padEnd >= 0 && padStart + padEnd <= numSamples
+        && stream.getNumBytesRemaining() >= numChannels * numSamples * static_cast<juce::int64>(sizeof(float));
+
+    if (!headerIsValid) {
+        // Corrupt or from an older version, don't keep tripping over it
+        file.deleteFile();
+        return nullptr;
+    }
+
+    auto info = std::make_shared<InfoBuffer>();
+    info->allocate(numChannels, static_cast<int>(numSamples));
+    info->sampleRate = sampleRate;
+    info->maxMagnitude = maxMagnitude;
+    info->padStart = padStart;
+    info->padEnd = padEnd;
+    info->reversed = reversed;
+
+    const auto channelBytes = static_cast<size_t>(numSamples) * sizeof(float);
+    for (int c = 0; c < numChannels; c++) {
+        if (static_cast<size_t>(stream.read(info->buffer.getWritePointer(c), static_cast<int>(channelBytes))) != channelBytes) {
+            return nullptr;
+        }
+    }
+
+    // Waveform overview follows the samples. Missing or mismatched is fine, it's only for display.
+    if (stream.readBool()) {
+        info->peaks = PeakPyramid::read(stream, numChannels, info->getLengthInSamples());
+    }
+
+    // Access time drives compaction. Set it explicitly since filesystems are often mounted noatime.
+    file.setLastAccessTime(juce::Time::getCurrentTime());
+    return info;
+}
+
+void DiskBufferCache::store(const SourceId& source, uint64_t chainHash, std::shared_ptr<const InfoBuffer> buffer) {
+    // Compact results are quick to rebuild from the float stage before them
+    if (!buffer || buffer->isStreamed() || buffer->isCompact()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pendingWrites.push_back({source, chainHash, std::move(buffer)});
+    }
+    notify();
+}
+
+bool DiskBufferCache::write(const juce::File& file, const SourceId& source, uint64_t chainHash,
+                            const InfoBuffer& info) const {
+    // Write next to the destination and rename, so readers never see a partial entry
+    auto tempFile = file.withFileExtension(".tmp");
+    {
+        juce::FileOutputStream stream(tempFile);
+        if (!stream.openedOk()) return false;
+        stream.setPosition(0);
+        stream.truncate();
+
+        const auto& buffer = info.buffer;
+        stream.writeInt(static_cast<int>(entryMagic));
+        stream.writeInt(static_cast<int>(entryVersion));
+        stream.writeInt(buffer.getNumChannels());
+        stream.writeInt64(buffer.getNumSamples());
+        stream.writeDouble(info.sampleRate);
+        stream.writeFloat(info.maxMagnitude);
+        stream.writeInt64(static_cast<juce::int64>(source.contentHash));
+        stream.writeInt64(static_cast<juce::int64>(chainHash));
+        stream.writeInt(info.padStart);
+        stream.writeInt(info.padEnd);
+        stream.writeBool(info.reversed);
+
+        const auto channelBytes = static_cast<size_t>(buffer.getNumSamples()) * sizeof(float);
+        for (int c = 0; c < buffer.getNumChannels(); c++) {
+            if (!stream.write(buffer.getReadPointer(c), channelBytes)) {
+                tempFile.deleteFile();
+                return false;
+            }
+        }
+
+        stream.writeBool(info.peaks != nullptr);
+        if (info.peaks) info.peaks->write(stream);
+
+        stream.flush();
+        if (stream.getStatus().failed()) {
+            tempFile.deleteFile();
+            return false;
+        }
+    }
+
+    return tempFile.moveFileTo(file);
+}
+
+void DiskBufferCache::run() {
+    while (true) {
+        std::optional<PendingWrite> next;
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            if (!pendingWrites.empty()) {
+                next = std::move(pendingWrites.front());
+                pendingWrites.pop_front();
+            }
+        }
+
+        if (next) {
+            std::lock_guard<std::mutex> lock(filesMutex);
+            auto file = getEntryFile(next->source, next->chainHash);
+            if (!file.existsAsFile() && write(file, next->source, next->chainHash, *next->buffer)) {
+                currentSize += static_cast<uint64_t>(file.getSize());
+                if (currentSize.load() > maxSize.load()) compactionNeeded = true;
+            }
+            continue;
+        }
+
+        if (compactionNeeded.exchange(false)) compact();
+
+        bool saveIndex;
+        {
+            std::lock_guard<std::mutex> lock(sourcesMutex);
+            saveIndex = sourcesDirty;
+        }
+        if (saveIndex) saveSourceIndex();
+
+        // Queue is drained at this point
+        if (threadShouldExit()) break;
+        wait(1000);
+    }
+}
+
+void DiskBufferCache::compact() {
+    std::lock_guard<std::mutex> lock(filesMutex);
+
+    const auto now = juce::Time::getCurrentTime();
+    for (const auto& temp : directory.findChildFiles(juce::File::findFiles, false, "*.tmp")) {
+        if ((now - temp.getLastModificationTime()).inMilliseconds() > staleTempFileMs) {
+            temp.deleteFile();
+        }
+    }
+
+    auto entries = directory.findChildFiles(juce::File::findFiles, false, entryPattern);
+
+    uint64_t total = 0;
+    for (const auto& entry : entries) total += static_cast<uint64_t>(entry.getSize());
+
+    if (total > maxSize.load()) {
+        std::sort(entries.begin(), entries.end(), [](const juce::File& a, const juce::File& b) {
+            return a.getLastAccessTime() < b.getLastAccessTime();
+        });
+
+        for (const auto& entry : entries) {
+            if (total <= maxSize.load()) break;
+            const auto size = static_cast<uint64_t>(entry.getSize());
+            if (entry.deleteFile()) total -= size;
+        }
+    }
+
+    currentSize = total;
+}
+
+void DiskBufferCache::setMaxSize(uint64_t bytes) {
+    maxSize = bytes;
+    compactionNeeded = true;
+    notify();
+}
+
+void DiskBufferCache::clear() {
+    std::lock_guard<std::mutex> lock(filesMutex);
+    for (const auto& entry : directory.findChildFiles(juce::File::findFiles, false, entryPattern)) {
+        entry.deleteFile();
+    }
+    currentSize = 0;
+}
+
+void DiskBufferCache::loadSourceIndex() {
+    const auto indexFile = directory.getChildFile("sources.json");
+    if (!indexFile.existsAsFile()) return;
+
+    try {
+        const auto index = nlohmann::json::parse(indexFile.loadFileAsString().toStdString());
+        std::lock_guard<std::mutex> lock(sourcesMutex);
+        for (const auto& [path, value] : index.items()) {
+            SourceId id;
+            id.size = value.at("size").get<juce::int64>();
+            id.modificationTime = value.at("mtime").get<juce::int64>();
+            id.contentHash = value.at("hash").get<uint64_t>();
+            sources[path] = id;
+        }
+    } catch (const nlohmann::json::exception&) {
+        // Unreadable index, files will just be hashed again
+    }
+}
+
+void DiskBufferCache::saveSourceIndex() {
+    auto index = nlohmann::json::object();
+    {
+        std::lock_guard<std::mutex> lock(sourcesMutex);
+        for (const auto& [path, id] : sources) {
+            index[path] = {
+                {"size", id.size},
+                {"mtime", id.modificationTime},
+                {"hash", id.contentHash}
+            };
+        }
+        sourcesDirty = false;
+    }
+
+    const auto indexFile = directory.getChildFile("sources.json");
+    const auto tempFile = indexFile.withFileExtension(".json.tmp");
+    if (tempFile.replaceWithText(index.dump())) {
+        tempFile.moveFileTo(indexFile);
+    }
+}
+
+} // namespace imagiro
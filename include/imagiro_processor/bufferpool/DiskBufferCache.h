@@ -0,0 +1,89 @@
+#pragma once
+#include "InfoBuffer.h"
+#include <juce_core/juce_core.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+namespace imagiro {
+
+// Persistent second-level cache of transformed buffers, so they survive a restart.
+// Entries are keyed by the content hash of the source file plus the persistent hash of the transform
+// chain, and hold raw float blocks. Source content hashes are remembered per path and only recomputed
+// when the file's size or modification time changes. Results of analysis transforms are kept alongside
+// as small JSON files under the same keys.
+// Writes and LRU compaction happen on a background thread.
+class DiskBufferCache : juce::Thread {
+public:
+    explicit DiskBufferCache(juce::File directory = getDefaultDirectory(),
+                             uint64_t maxSizeBytes = 4ull * 1024 * 1024 * 1024); // 4GB
+    ~DiskBufferCache() override;
+
+    // Resources::getDataFolder()/buffer-cache
+    static juce::File getDefaultDirectory();
+
+    struct SourceId {
+        uint64_t contentHash {0};
+        juce::int64 size {0};
+        juce::int64 modificationTime {0};
+    };
+
+    // Identify a source file by content. Returns nullopt if the file can't be read.
+    std::optional<SourceId> getSourceId(const std::string& path);
+
+    // Read an entry back (blocking file IO - loader threads only)
+    std::shared_ptr<InfoBuffer> load(const SourceId& source, uint64_t chainHash);
+
+    // Queue an entry to be written in the background. The buffer must not be modified afterwards.
+    void store(const SourceId& source, uint64_t chainHash, std::shared_ptr<const InfoBuffer> buffer);
+
+    // Results of analysis transforms, stored without the samples (blocking file IO - loader threads only)
+    std::shared_ptr<const AnalysisMetadata> loadAnalysis(const SourceId& source, uint64_t chainHash);
+    void storeAnalysis(const SourceId& source, uint64_t chainHash, const AnalysisMetadata& analysis);
+
+    void setMaxSize(uint64_t bytes);
+    uint64_t getMaxSize() const { return maxSize.load(); }
+    uint64_t getCurrentSize() const { return currentSize.load(); }
+
+    // Delete every entry
+    void clear();
+
+private:
+    void run() override;
+
+    juce::File getEntryFile(const SourceId& source, uint64_t chainHash) const;
+    juce::File getAnalysisFile(const SourceId& source, uint64_t chainHash) const;
+    bool write(const juce::File& file, const SourceId& source, uint64_t chainHash, const InfoBuffer& buffer) const;
+
+    // Delete least recently used entries until we're under the size cap, and tidy up partial writes
+    void compact();
+
+    void loadSourceIndex();
+    void saveSourceIndex();
+
+    static uint64_t hashFileContents(const juce::File& file);
+
+    const juce::File directory;
+    std::atomic<uint64_t> maxSize;
+    std::atomic<uint64_t> currentSize {0};
+
+    std::mutex sourcesMutex;
+    std::unordered_map<std::string, SourceId> sources;
+    bool sourcesDirty {false};
+
+    struct PendingWrite {
+        SourceId source;
+        uint64_t chainHash;
+        std::shared_ptr<const InfoBuffer> buffer;
+    };
+    std::mutex pendingMutex;
+    std::deque<PendingWrite> pendingWrites;
+    std::atomic<bool> compactionNeeded {true};
+
+    // Serialises file access between the loader threads and the background thread
+    std::mutex filesMutex;
+};
+
+} // namespace imagiro
@@ -0,0 +1,194 @@
+#include "DiskStreamer.h"
+
+namespace imagiro {
+
+StreamingVoice::StreamingVoice(std::shared_ptr<const StreamingSource> s, int capacitySamples)
+    : source(std::move(s)), capacity(std::max(1, capacitySamples)) {
+    ring.resize(static_cast<size_t>(std::max(1, source->numChannels)));
+    for (auto& channel : ring) {
+        channel.resize(static_cast<size_t>(capacity), 0.f);
+    }
+}
+
+void StreamingVoice::requestWindow(juce::int64 start, juce::int64 end, bool reverse) {
+    requestedStart.store(start, std::memory_order_relaxed);
+    requestedEnd.store(end, std::memory_order_relaxed);
+    requestedReverse.store(reverse, std::memory_order_release);
+}
+
+bool StreamingVoice::readWindow(int channel, juce::int64 start, int length, float* dest) {
+    const auto end = start + length;
+    const auto isResident = [&] {
+        return start >= validStart.load(std::memory_order_acquire) &&
+               end <= validEnd.load(std::memory_order_acquire);
+    };
+
+    const auto gen = generation.load(std::memory_order_acquire);
+    if ((gen & 1) != 0 || length > capacity || !isResident()) {
+        reportUnderrun();
+        return false;
+    }
+
+    const auto& data = ring[static_cast<size_t>(channel) % ring.size()];
+    const auto firstSlot = static_cast<int>(start % capacity);
+    const auto firstPart = std::min(length, capacity - firstSlot);
+    std::copy_n(data.data() + firstSlot, firstPart, dest);
+    std::copy_n(data.data(), length - firstPart, dest + firstPart);
+
+    // If the streaming thread evicted any of it while we were copying, the copy can't be trusted
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (generation.load(std::memory_order_relaxed) != gen || !isResident()) {
+        reportUnderrun();
+        return false;
+    }
+
+    return true;
+}
+
+void StreamingVoice::reportUnderrun() {
+    underruns.fetch_add(1, std::memory_order_relaxed);
+    if (streamer != nullptr) streamer->reportUnderrun();
+}
+
+bool StreamingVoice::fill(juce::AudioFormatReader& fileReader, juce::AudioSampleBuffer& scratch) {
+    const auto length = source->lengthInSamples;
+    const auto reverse = requestedReverse.load(std::memory_order_acquire);
+    const auto reqStart = requestedStart.load(std::memory_order_relaxed);
+    const auto reqEnd = requestedEnd.load(std::memory_order_relaxed);
+
+    // Keep a little behind the read position, fill the rest of the ring ahead of it
+    const auto margin = static_cast<juce::int64>(capacity / 8);
+    juce::int64 targetStart, targetEnd;
+    if (!reverse) {
+        targetStart = std::max<juce::int64>(0, reqStart - margin);
+        targetEnd = std::min(length, targetStart + capacity);
+    } else {
+        targetEnd = std::min(length, reqEnd + margin);
+        targetStart = std::max<juce::int64>(0, targetEnd - capacity);
+    }
+    if (targetEnd <= targetStart) return false;
+
+    auto start = validStart.load(std::memory_order_relaxed);
+    auto end = validEnd.load(std::memory_order_relaxed);
+
+    // Seek - nothing useful is resident, start again from the target
+    if (end <= start || targetStart >= end || targetEnd <= start) {
+        const auto seekTo = reverse ? targetEnd : targetStart;
+        generation.fetch_add(1, std::memory_order_acq_rel);
+        validStart.store(seekTo, std::memory_order_relaxed);
+        validEnd.store(seekTo, std::memory_order_relaxed);
+        generation.fetch_add(1, std::memory_order_release);
+        start = end = seekTo;
+    }
+
+    juce::int64 readStart;
+    int numToRead;
+    if (!reverse) {
+        if (end >= targetEnd) return false;
+        numToRead = static_cast<int>(std::min<juce::int64>(scratch.getNumSamples(), targetEnd - end));
+        readStart = end;
+
+        // Evict the oldest samples before their slots are overwritten
+        const auto newStart = std::max(start, end + numToRead - capacity);
+        if (newStart > start) validStart.store(newStart, std::memory_order_release);
+    } else {
+        if (start <= targetStart) return false;
+        numToRead = static_cast<int>(std::min<juce::int64>(scratch.getNumSamples(), start - targetStart));
+        readStart = start - numToRead;
+
+        const auto newEnd = std::min(end, readStart + capacity);
+        if (newEnd < end) validEnd.store(newEnd, std::memory_order_release);
+    }
+
+    const auto numChannels = static_cast<int>(ring.size());
+    if (!fileReader.read(scratch.getArrayOfWritePointers(), numChannels,
+                         source->fileStartSample + readStart, numToRead)) {
+        return false;
+    }
+
+    for (auto c = 0; c < numChannels; c++) {
+        auto& data = ring[static_cast<size_t>(c)];
+        const auto* in = scratch.getReadPointer(c);
+        const auto firstSlot = static_cast<int>(readStart % capacity);
+        const auto firstPart = std::min(numToRead, capacity - firstSlot);
+        std::copy_n(in, firstPart, data.data() + firstSlot);
+        std::copy_n(in + firstPart, numToRead - firstPart, data.data());
+    }
+
+    if (!reverse) validEnd.store(readStart + numToRead, std::memory_order_release);
+    else validStart.store(readStart, std::memory_order_release);
+
+    return true;
+}
+
+DiskStreamer::DiskStreamer() : juce::Thread("DiskStreamer") {
+    afm.registerBasicFormats();
+    scratch.setSize(2, fillChunkSize);
+    startThread(juce::Thread::Priority::high);
+}
+
+DiskStreamer::~DiskStreamer() {
+    stopThread(4000);
+}
+
+std::shared_ptr<StreamingVoice> DiskStreamer::createVoice(std::shared_ptr<const StreamingSource> source,
+                                                          double ringSeconds) {
+    const auto capacity = std::max(fillChunkSize * 2,
+                                   static_cast<int>(ringSeconds * source->sampleRate));
+    auto voice = std::make_shared<StreamingVoice>(std::move(source), capacity);
+    voice->streamer = this;
+
+    {
+        std::lock_guard lock(voicesMutex);
+        voices.push_back(voice);
+    }
+
+    notify();
+    return voice;
+}
+
+int DiskStreamer::getNumActiveVoices() const {
+    std::lock_guard lock(voicesMutex);
+    return static_cast<int>(std::count_if(voices.begin(), voices.end(),
+                                          [](const auto& v) { return !v.expired(); }));
+}
+
+void DiskStreamer::run() {
+    std::vector<std::shared_ptr<StreamingVoice>> activeVoices;
+
+    while (!threadShouldExit()) {
+        activeVoices.clear();
+        {
+            std::lock_guard lock(voicesMutex);
+            voices.erase(std::remove_if(voices.begin(), voices.end(),
+                                        [](const auto& v) { return v.expired(); }),
+                         voices.end());
+            for (const auto& v : voices) {
+                if (auto voice = v.lock()) activeVoices.push_back(std::move(voice));
+            }
+        }
+
+        bool didWork = false;
+        for (auto& voice : activeVoices) {
+            if (threadShouldExit()) return;
+
+            if (!voice->reader) {
+                voice->reader.reset(afm.createReaderFor(juce::File(voice->getSource().filePath)));
+                if (!voice->reader) continue;
+            }
+
+            if (scratch.getNumChannels() < static_cast<int>(voice->ring.size())) {
+                scratch.setSize(static_cast<int>(voice->ring.size()), fillChunkSize);
+            }
+
+            didWork |= voice->fill(*voice->reader, scratch);
+        }
+
+        // Voices release their reader with them
+        activeVoices.clear();
+
+        if (!didWork) wait(5);
+    }
+}
+
+} // namespace imagiro
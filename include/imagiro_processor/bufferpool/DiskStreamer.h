@@ -0,0 +1,92 @@
+#pragma once
+#include "StreamingSource.h"
+#include "juce_audio_formats/juce_audio_formats.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace imagiro {
+
+class DiskStreamer;
+
+// Per-voice ring buffer onto a streamed sample.
+// The audio thread publishes the window it's about to read, and the streaming thread keeps the ring
+// filled ahead of it in the direction of playback.
+class StreamingVoice {
+public:
+    StreamingVoice(std::shared_ptr<const StreamingSource> source, int capacitySamples);
+
+    // Publish the range of samples about to be read (audio thread, non-blocking)
+    void requestWindow(juce::int64 start, juce::int64 end, bool reverse);
+
+    // Copy [start, start + length) of one channel into dest.
+    // Returns false (and counts an underrun) if the samples aren't resident yet (audio thread, non-blocking)
+    bool readWindow(int channel, juce::int64 start, int length, float* dest);
+
+    // Count an underrun for a window the caller couldn't read at all (audio thread, non-blocking)
+    void reportUnderrun();
+
+    int getUnderrunCount() const { return underruns.load(std::memory_order_relaxed); }
+    int getCapacity() const { return capacity; }
+    const StreamingSource& getSource() const { return *source; }
+
+private:
+    friend class DiskStreamer;
+
+    // Streaming thread: reads more of the requested window from disk, returns true if it did any work
+    bool fill(juce::AudioFormatReader& reader, juce::AudioSampleBuffer& scratch);
+
+    std::shared_ptr<const StreamingSource> source;
+    const int capacity;
+    std::vector<std::vector<float>> ring;
+
+    // Resident range, in absolute sample indices. validStart is always advanced before slots are overwritten
+    std::atomic<juce::int64> validStart {0};
+    std::atomic<juce::int64> validEnd {0};
+    std::atomic<uint32_t> generation {0}; // odd while the resident range is being reset
+
+    std::atomic<juce::int64> requestedStart {0};
+    std::atomic<juce::int64> requestedEnd {0};
+    std::atomic<bool> requestedReverse {false};
+
+    std::atomic<int> underruns {0};
+    DiskStreamer* streamer {nullptr};
+
+    // Owned by the streaming thread
+    std::unique_ptr<juce::AudioFormatReader> reader;
+};
+
+// Background thread that keeps every StreamingVoice filled.
+// Shared process-wide, get it with juce::SharedResourcePointer<DiskStreamer>.
+class DiskStreamer : juce::Thread {
+public:
+    DiskStreamer();
+    ~DiskStreamer() override;
+
+    // Create a voice for a streamed sample (not audio thread safe - allocates)
+    std::shared_ptr<StreamingVoice> createVoice(std::shared_ptr<const StreamingSource> source,
+                                                double ringSeconds = 1.0);
+
+    int getTotalUnderruns() const { return totalUnderruns.load(std::memory_order_relaxed); }
+    int getNumActiveVoices() const;
+
+    // Called by voices
+    void reportUnderrun() { totalUnderruns.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+    void run() override;
+
+    juce::AudioFormatManager afm;
+
+    mutable std::mutex voicesMutex;
+    std::vector<std::weak_ptr<StreamingVoice>> voices;
+
+    std::atomic<int> totalUnderruns {0};
+
+    static constexpr int fillChunkSize = 8192;
+    juce::AudioSampleBuffer scratch;
+};
+
+} // namespace imagiro
@@ -1,5 +1,6 @@
 #include "FileBufferCache.h"
 #include "BufferRequestHandle.h"
+#include <unordered_set>
 
 namespace imagiro {
 
@@ -11,16 +12,106 @@ FileBufferCache::FileBufferCache(uint64_t maxCacheSize) {
 
 FileBufferCache::~FileBufferCache() = default;
 
-std::shared_ptr<BufferRequestHandle> FileBufferCache::createHandle(const CacheKey& key) {
-    return std::shared_ptr<BufferRequestHandle>(new BufferRequestHandle(this, key));
+ClientId FileBufferCache::registerClient(uint64_t quotaBytes) {
+    const auto id = nextClientId.fetch_add(1);
+    cache->setClientQuota(id, quotaBytes);
+    return id;
 }
 
-std::optional<std::shared_ptr<InfoBuffer>> FileBufferCache::getBuffer(const CacheKey& key) {
-    return cache->getBuffer(key.getHash());
+void FileBufferCache::unregisterClient(ClientId id) {
+    cache->releaseClient(id);
 }
 
-Result<std::shared_ptr<InfoBuffer>> FileBufferCache::requestBuffer(const CacheKey& key) {
-    return loader->requestBuffer(key);
+void FileBufferCache::enablePersistentCache(const juce::File& directory, uint64_t maxBytes) {
+    diskCache = std::make_shared<DiskBufferCache>(directory, maxBytes);
+    loader->setDiskCache(diskCache);
+}
+
+void FileBufferCache::disablePersistentCache() {
+    // The loader keeps its own reference until any load in progress is done with it
+    loader->setDiskCache(nullptr);
+    diskCache.reset();
+}
+
+Result<std::shared_ptr<PrefetchBatch>> FileBufferCache::prefetch(const std::vector<BufferRequest>& requests,
+                                                                  PrefetchBudget budget) {
+    // Distinct chains that aren't cached yet, and what each client would be charged for them
+    std::unordered_set<std::string> seen;
+    std::vector<const BufferRequest*> toLoad;
+    std::unordered_map<ClientId, uint64_t> neededBytes;
+    uint64_t totalBytes = 0;
+
+    for (const auto& request : requests) {
+        if (request.key.transforms.empty()) continue;
+
+        auto id = request.key.getId();
+        if (!seen.insert(id.canonical).second) continue;
+        toLoad.push_back(&request);
+        if (cache->exists(id)) continue;
+
+        // Transforms after the source are assumed to keep its size
+        const auto bytes = request.key.transforms[0]->estimateSizeInBytes().value_or(0);
+        neededBytes[request.clientId] += bytes;
+        totalBytes += bytes;
+    }
+
+    const auto fits = [&](uint64_t needed, uint64_t capacity, uint64_t used) {
+        if (needed > capacity) return false;
+        return budget == PrefetchBudget::Evict || needed <= capacity - std::min(capacity, used);
+    };
+
+    if (!fits(totalBytes, cache->getMaxSize(), cache->getCurrentSize())) {
+        return Result<std::shared_ptr<PrefetchBatch>>::unexpected_type(
+            "Prefetch needs " + std::to_string(totalBytes) + " bytes, more than the cache has room for");
+    }
+
+    for (const auto& [client, bytes] : neededBytes) {
+        const auto quota = client == NoClient ? 0 : cache->getClientQuota(client);
+        if (quota > 0 && !fits(bytes, quota, cache->getClientUsage(client))) {
+            return Result<std::shared_ptr<PrefetchBatch>>::unexpected_type(
+                "Prefetch needs " + std::to_string(bytes) + " bytes, more than the client's quota has room for");
+        }
+    }
+
+    std::vector<PrefetchBatch::Future> futures;
+    futures.reserve(toLoad.size());
+    for (const auto* request : toLoad) {
+        futures.push_back(loader->requestBufferAsync(request->key, request->clientId, BufferLoader::Priority::Prefetch));
+    }
+
+    return std::make_shared<PrefetchBatch>(std::move(futures), totalBytes);
+}
+
+nlohmann::json FileBufferCache::getMetricsJson() const {
+    auto json = nlohmann::json{
+        {"cache", cache->getMetricsJson()},
+        {"loader", loader->getMetrics().toJson()},
+        {"sampleMemory", SampleStorage::getStats().toJson()}
+    };
+
+    if (const auto disk = diskCache) {
+        json["disk"] = {
+            {"residentBytes", disk->getCurrentSize()},
+            {"maxBytes", disk->getMaxSize()}
+        };
+    }
+    return json;
+}
+
+std::shared_ptr<BufferRequestHandle> FileBufferCache::createHandle(const CacheKey& key, ClientId client) {
+    return std::shared_ptr<BufferRequestHandle>(new BufferRequestHandle(this, key, client));
+}
+
+std::optional<std::shared_ptr<InfoBuffer>> FileBufferCache::getBuffer(const ChainId& id) {
+    return cache->getBuffer(id);
+}
+
+Result<std::shared_ptr<InfoBuffer>> FileBufferCache::requestBuffer(const CacheKey& key, ClientId client) {
+    return loader->requestBuffer(key, client);
+}
+
+Result<std::shared_ptr<InfoBuffer>> FileBufferCache::requestBufferOnThisThread(const CacheKey& key, ClientId client) {
+    return loader->requestBufferOnThisThread(key, client);
 }
 
 } // namespace imagiro
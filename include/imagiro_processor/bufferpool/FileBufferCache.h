@@ -2,11 +2,14 @@
 #include "BufferCache.h"
 #include "BufferLoader.h"
 #include "BufferRequest.h"
+#include "PrefetchBatch.h"
+#include "TransformGraph.h"
 #include <memory>
 
 namespace imagiro {
 
 // Main interface combining cache and loader
+// Can be owned directly, or shared process-wide through SharedFileBufferCache.
 class FileBufferCache {
 public:
     FileBufferCache(uint64_t maxCacheSize = 2u * 1024 * 1024 * 1024); // 2GB
@@ -17,13 +20,61 @@ public:
         return BufferRequest(this, path);
     }
 
-    // Cache management
-    void setMaxCacheSize(size_t bytes) {
-        cache = std::make_unique<BufferCache>(bytes);
+    // Several chains at once, sharing the work they have in common, see TransformGraph
+    TransformGraph graph() {
+        return TransformGraph(this);
     }
+
+    // What prefetch() does when a batch wouldn't fit in the space that's currently free
+    enum class PrefetchBudget {
+        Refuse, // fail without loading anything
+        Evict   // load anyway, evicting least recently used entries to make room
+    };
+
+    // Warm every chain a preset references before its first note, at lower priority than regular
+    // requests. Call it before restoring the rest of the state, so decoding overlaps with that.
+    // Duplicates are collapsed and cached chains cost nothing. Fails up front if the estimated size
+    // is more than the whole budget (or the requesting client's quota).
+    Result<std::shared_ptr<PrefetchBatch>> prefetch(const std::vector<BufferRequest>& requests,
+                                                    PrefetchBudget budget = PrefetchBudget::Evict);
+
+    // Cache management
+    void setMaxCacheSize(size_t bytes) { cache->setMaxSize(bytes); }
     void clearCache() { cache->clear(); }
     size_t getCurrentCacheSize() const { return cache->getCurrentSize(); }
 
+    // Clients share the global budget, and can optionally be limited to their own quota (0 = no quota)
+    ClientId registerClient(uint64_t quotaBytes = 0);
+    void unregisterClient(ClientId id);
+    void setClientQuota(ClientId id, uint64_t quotaBytes) { cache->setClientQuota(id, quotaBytes); }
+    size_t getClientCacheSize(ClientId id) const { return cache->getClientUsage(id); }
+
+    // Keep transformed buffers on disk too, so they survive restarts. Off by default.
+    void enablePersistentCache(const juce::File& directory = DiskBufferCache::getDefaultDirectory(),
+                               uint64_t maxBytes = 4ull * 1024 * 1024 * 1024); // 4GB
+    void disablePersistentCache();
+    std::shared_ptr<DiskBufferCache> getPersistentCache() const { return diskCache; }
+
+    // Losslessly compress cold entries in memory instead of dropping them, see BufferCache
+    void setCompression(bool enabled, std::chrono::milliseconds coldAfter = std::chrono::seconds(30)) {
+        cache->setCompression(enabled, coldAfter);
+    }
+
+    // Share entries between identical audio files at different paths, see BufferLoader
+    void setContentAddressing(bool enabled) { loader->setContentAddressing(enabled); }
+
+    // Pool instrumentation, readable from any thread without locking
+    const CacheMetrics& getCacheMetrics() const { return cache->getMetrics(); }
+    const LoaderMetrics& getLoaderMetrics() const { return loader->getMetrics(); }
+
+    // Huge pages and memory locking for sample storage. These are process-wide, see SampleStorage.
+    static void setHugePages(bool enabled) { SampleStorage::setHugePages(enabled); }
+    static void setMemoryLocking(bool enabled) { SampleStorage::setMemoryLocking(enabled); }
+
+    // Everything above plus resident and disk sizes and how sample memory is backed, e.g. for
+    // logging or a debug view
+    nlohmann::json getMetricsJson() const;
+
     // Listener interface (forwarded from loader)
     using Listener = BufferLoader::Listener;
     void addListener(Listener* l) { loader->addListener(l); }
@@ -32,15 +83,21 @@ public:
 private:
     friend class BufferRequest;
     friend class BufferRequestHandle;
+    friend class TransformGraph;
+    friend class BatchProcessor;
     juce::AudioFormatManager afm;
 
     std::unique_ptr<BufferCache> cache;
     std::unique_ptr<BufferLoader> loader;
+    std::shared_ptr<DiskBufferCache> diskCache;
+
+    std::atomic<ClientId> nextClientId {NoClient + 1};
 
     // Internal methods for BufferRequest/Handle
-    std::shared_ptr<BufferRequestHandle> createHandle(const CacheKey& key);
-    std::optional<std::shared_ptr<InfoBuffer>> getBuffer(const CacheKey& key);
-    Result<std::shared_ptr<InfoBuffer>> requestBuffer(const CacheKey& key);
+    std::shared_ptr<BufferRequestHandle> createHandle(const CacheKey& key, ClientId client = NoClient);
+    std::optional<std::shared_ptr<InfoBuffer>> getBuffer(const ChainId& id);
+    Result<std::shared_ptr<InfoBuffer>> requestBuffer(const CacheKey& key, ClientId client = NoClient);
+    Result<std::shared_ptr<InfoBuffer>> requestBufferOnThisThread(const CacheKey& key, ClientId client = NoClient);
 };
 
 } // namespace imagiro
@@ -0,0 +1,195 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace imagiro {
+
+// Fast non-cryptographic streaming hash.
+// Unlike std::hash this is stable across runs, builds and platforms, so it can be persisted.
+class Hasher64 {
+public:
+    explicit Hasher64(uint64_t seed = 0) : state(seed ^ 0x9E3779B97F4A7C15ull) {}
+
+    Hasher64& update(const void* data, size_t numBytes) {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        length += numBytes;
+
+        // Top up any partial word left from the last update
+        while (tailSize > 0 && tailSize < 8 && numBytes > 0) {
+            tail |= static_cast<uint64_t>(*bytes++) << (8 * tailSize++);
+            numBytes--;
+        }
+        if (tailSize == 8) {
+            mixWord(tail);
+            tail = 0;
+            tailSize = 0;
+        }
+
+        while (numBytes >= 8) {
+            uint64_t word;
+            std::memcpy(&word, bytes, 8);
+            mixWord(word);
+            bytes += 8;
+            numBytes -= 8;
+        }
+
+        while (numBytes > 0) {
+            tail |= static_cast<uint64_t>(*bytes++) << (8 * tailSize++);
+            numBytes--;
+        }
+        return *this;
+    }
+
+    Hasher64& update(uint64_t value) { return update(&value, sizeof(value)); }
+    Hasher64& update(const std::string& s) {
+        update(static_cast<uint64_t>(s.size()));
+        return update(s.data(), s.size());
+    }
+
+    uint64_t finish() const {
+        auto h = state;
+        if (tailSize > 0) h = mix(h, tail);
+        return fmix(h ^ length);
+    }
+
+    static uint64_t fmix(uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+        return k;
+    }
+
+private:
+    uint64_t state;
+    uint64_t length {0};
+    uint64_t tail {0};
+    size_t tailSize {0};
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    static uint64_t mix(uint64_t h, uint64_t word) {
+        word *= 0x87c37b91114253d5ull;
+        word = rotl(word, 31);
+        word *= 0x4cf5ad432745937full;
+        h ^= word;
+        return rotl(h, 27) * 5 + 0x52dce729;
+    }
+
+    void mixWord(uint64_t word) { state = mix(state, word); }
+};
+
+struct Hash128 {
+    uint64_t low {0};
+    uint64_t high {0};
+
+    bool operator==(const Hash128&) const = default;
+
+    std::string toHex() const {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string s(32, '0');
+        for (int i = 0; i < 16; i++) {
+            s[static_cast<size_t>(15 - i)] = digits[(high >> (4 * i)) & 0xf];
+            s[static_cast<size_t>(31 - i)] = digits[(low >> (4 * i)) & 0xf];
+        }
+        return s;
+    }
+};
+
+// For unordered containers - the hash is already well mixed, so just fold it
+struct Hash128Hasher {
+    size_t operator()(const Hash128& h) const {
+        return static_cast<size_t>(h.low ^ (h.high * 0x9E3779B97F4A7C15ull));
+    }
+};
+
+// Streaming 128-bit hash (MurmurHash3 x64_128), for keys where a 64-bit collision would be a real risk
+class Hasher128 {
+public:
+    explicit Hasher128(uint64_t seed = 0) : h1(seed), h2(seed) {}
+
+    Hasher128& update(const void* data, size_t numBytes) {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        length += numBytes;
+
+        if (pendingSize > 0) {
+            const auto toCopy = std::min(numBytes, sizeof(pending) - pendingSize);
+            std::memcpy(pending + pendingSize, bytes, toCopy);
+            pendingSize += toCopy;
+            bytes += toCopy;
+            numBytes -= toCopy;
+            if (pendingSize < sizeof(pending)) return *this;
+            mixBlock(pending);
+            pendingSize = 0;
+        }
+
+        while (numBytes >= 16) {
+            mixBlock(bytes);
+            bytes += 16;
+            numBytes -= 16;
+        }
+
+        std::memcpy(pending, bytes, numBytes);
+        pendingSize = numBytes;
+        return *this;
+    }
+
+    Hasher128& update(uint64_t value) { return update(&value, sizeof(value)); }
+    Hasher128& update(const std::string& s) {
+        update(static_cast<uint64_t>(s.size()));
+        return update(s.data(), s.size());
+    }
+
+    Hash128 finish() const {
+        auto a = h1;
+        auto b = h2;
+
+        if (pendingSize > 0) {
+            uint64_t k1 = 0, k2 = 0;
+            for (size_t i = 0; i < pendingSize && i < 8; i++) k1 |= static_cast<uint64_t>(pending[i]) << (8 * i);
+            for (size_t i = 8; i < pendingSize; i++) k2 |= static_cast<uint64_t>(pending[i]) << (8 * (i - 8));
+
+            k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; b ^= k2;
+            k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; a ^= k1;
+        }
+
+        a ^= length;
+        b ^= length;
+        a += b;
+        b += a;
+        a = Hasher64::fmix(a);
+        b = Hasher64::fmix(b);
+        a += b;
+        b += a;
+        return {a, b};
+    }
+
+private:
+    static constexpr uint64_t c1 = 0x87c37b91114253d5ull;
+    static constexpr uint64_t c2 = 0x4cf5ad432745937full;
+
+    uint64_t h1;
+    uint64_t h2;
+    uint64_t length {0};
+    unsigned char pending[16] {};
+    size_t pendingSize {0};
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    void mixBlock(const unsigned char* block) {
+        uint64_t k1, k2;
+        std::memcpy(&k1, block, 8);
+        std::memcpy(&k2, block + 8, 8);
+
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+};
+
+} // namespace imagiro
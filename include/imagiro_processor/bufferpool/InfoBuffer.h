@@ -4,14 +4,184 @@
 
 #pragma once
 #include "juce_audio_basics/juce_audio_basics.h"
+#include "StreamingSource.h"
+#include "PeakPyramid.h"
+#include "AnalysisMetadata.h"
+#include "CompactSamples.h"
+#include "SampleStorage.h"
+#include <imagiro_processor/grain/MipmappedBuffer.h>
+#include <atomic>
+#include <optional>
+#include <string>
 
 namespace imagiro {
 
+// Watermark for a buffer that's handed out while the loader is still filling it.
+// Samples before readySamples are final and safe to read from any thread.
+struct LoadProgress {
+    std::atomic<int> readySamples {0};
+
+    // Set (after error) if the rest couldn't be loaded. Samples before readySamples are still good.
+    std::atomic<bool> failed {false};
+    std::string error;
+};
+
 struct InfoBuffer {
     juce::AudioSampleBuffer buffer;
     double sampleRate;
     float maxMagnitude;
     juce::File file;
+
+    // Set when only the head of the sample is resident, see DiskStreamer
+    std::shared_ptr<const StreamingSource> stream;
+
+    // Keeps memory that buffer refers to alive, when it doesn't own its data (e.g. a file mapping,
+    // or samples shared with another InfoBuffer - see share())
+    std::shared_ptr<const void> storageOwner;
+
+    // Set when storageOwner is a SampleStorage (see allocate())
+    const SampleStorage* sampleStorage {nullptr};
+
+    // Set when the buffer was published before it was fully loaded (see CacheKey::progressive)
+    std::shared_ptr<const LoadProgress> progress;
+
+    // Playback layout (see PadTransform, ReverseTransform). Guard samples before and after the
+    // content, and whether the content is stored back to front.
+    int padStart {0};
+    int padEnd {0};
+    bool reversed {false};
+
+    // Waveform overview of the content (without guard padding, in storage order). Not set for
+    // streamed buffers.
+    std::shared_ptr<const PeakPyramid> peaks;
+
+    // Set by analysis transforms, and cleared when a later transform changes the samples
+    std::shared_ptr<const AnalysisMetadata> analysis;
+
+    // Set when the samples are held as 16 bit (see CompactTransform). buffer then has the right
+    // number of channels but no samples, and readers convert windows of these instead.
+    std::shared_ptr<const CompactSamples> compact;
+
+    // Decimated copies of the content (without guard padding, in storage order), which grains read
+    // at high pitches so they don't alias. Set by MipmapTransform, which ends a chain.
+    static constexpr int mipmapLevels = 5;
+    using Mipmaps = MipmappedBuffer<mipmapLevels>;
+    std::shared_ptr<const Mipmaps> mipmaps;
+
+    bool isStreamed() const { return stream != nullptr; }
+    bool isCompact() const { return compact != nullptr; }
+
+    // Number of stored samples per channel, including guard padding
+    int getNumStoredSamples() const {
+        return compact ? compact->getNumSamples() : buffer.getNumSamples();
+    }
+
+    // Full length of the sample, including any part that's still on disk, but not guard padding
+    int getLengthInSamples() const {
+        return stream ? static_cast<int>(stream->lengthInSamples) : getNumStoredSamples() - padStart - padEnd;
+    }
+
+    // Number of resident samples that can be read right now. Stops growing if loading fails.
+    int getReadySamples() const {
+        return progress ? progress->readySamples.load(std::memory_order_acquire) : getNumStoredSamples();
+    }
+
+    bool isFullyLoaded() const { return !hasFailed() && getReadySamples() >= getNumStoredSamples(); }
+
+    // Whether a progressive load stopped part way, so the samples after getReadySamples() never arrive
+    bool hasFailed() const { return progress && progress->failed.load(std::memory_order_acquire); }
+    std::optional<std::string> getLoadError() const {
+        return hasFailed() ? std::optional<std::string>(progress->error) : std::nullopt;
+    }
+
+    // The content without guard padding, referring to the same samples (empty for compact buffers)
+    juce::AudioSampleBuffer getContentView() const {
+        if (compact) return {buffer.getNumChannels(), 0};
+        std::vector<float*> channels;
+        for (int c = 0; c < buffer.getNumChannels(); c++) {
+            channels.push_back(const_cast<float*>(buffer.getReadPointer(c, padStart)));
+        }
+        return {channels.data(), buffer.getNumChannels(), buffer.getNumSamples() - padStart - padEnd};
+    }
+
+    // Give the buffer fresh (uninitialised) samples in SampleStorage, so large buffers get huge pages
+    // and can be pinned. They start out in shared storage, see moveToSharedStorage().
+    void allocate(int numChannels, int numSamples) {
+        auto storage = SampleStorage::allocate(numChannels, numSamples);
+        buffer.setDataToReferTo(storage->getChannels(), numChannels, numSamples);
+        sampleStorage = storage.get();
+        storageOwner = std::move(storage);
+    }
+
+    // allocate() and copy samples in
+    void allocateCopyOf(const juce::AudioSampleBuffer& source) {
+        allocate(source.getNumChannels(), source.getNumSamples());
+        for (int c = 0; c < source.getNumChannels(); c++) {
+            juce::FloatVectorOperations::copy(buffer.getWritePointer(c), source.getReadPointer(c), source.getNumSamples());
+        }
+    }
+
+    // Keep the samples in physical memory while the handle is alive, if memory locking is enabled
+    // (see SampleStorage). Locks and unlocks memory, so not for the audio thread.
+    std::shared_ptr<void> pin() const {
+        return sampleStorage ? sampleStorage->pin(storageOwner) : nullptr;
+    }
+
+    // Copy-on-write sharing. Buffers are read-only once they're shared; whoever wants to write to one
+    // calls makeWritable() first, which copies the samples only if someone else can still see them.
+
+    // Move owned samples into reference counted storage, so share() doesn't have to copy them.
+    // Only call while nothing else is reading this buffer.
+    void moveToSharedStorage() {
+        if (storageOwner) return;
+        const auto numChannels = buffer.getNumChannels();
+        const auto numSamples = buffer.getNumSamples();
+        auto storage = std::make_shared<juce::AudioSampleBuffer>(std::move(buffer));
+        buffer.setDataToReferTo(storage->getArrayOfWritePointers(), numChannels, numSamples);
+        storageOwner = std::move(storage);
+    }
+
+    // Another InfoBuffer over the same samples. Copies them if they aren't in shared storage.
+    std::shared_ptr<InfoBuffer> share() const {
+        if (!storageOwner) return std::make_shared<InfoBuffer>(*this);
+
+        auto view = std::make_shared<InfoBuffer>();
+        view->buffer.setDataToReferTo(const_cast<float* const*>(buffer.getArrayOfReadPointers()),
+                                      buffer.getNumChannels(), buffer.getNumSamples());
+        view->sampleRate = sampleRate;
+        view->maxMagnitude = maxMagnitude;
+        view->file = file;
+        view->stream = stream;
+        view->storageOwner = storageOwner;
+        view->sampleStorage = sampleStorage;
+        view->progress = progress;
+        view->padStart = padStart;
+        view->padEnd = padEnd;
+        view->reversed = reversed;
+        view->peaks = peaks;
+        view->analysis = analysis;
+        view->compact = compact;
+        view->mipmaps = mipmaps;
+        return view;
+    }
+
+    bool isShared() const { return storageOwner && storageOwner.use_count() > 1; }
+
+    // Make sure writes to the samples won't be seen through any other InfoBuffer
+    void makeWritable() {
+        if (!isShared()) return;
+        const auto source = buffer;
+        const auto previousOwner = storageOwner; // keeps source valid while copying
+        allocateCopyOf(source);
+    }
+
+    size_t getSizeInBytes() const {
+        return static_cast<size_t>(buffer.getNumSamples()) *
+               static_cast<size_t>(buffer.getNumChannels()) * sizeof(float) +
+               (compact ? compact->getSizeInBytes() : 0) +
+               (peaks ? peaks->getSizeInBytes() : 0) +
+               (mipmaps ? mipmaps->getSizeInBytes() : 0);
+    }
 };
 
 } // namespace imagiro
@@ -0,0 +1,350 @@
+#include "MappedAudioFile.h"
+#include <cstring>
+
+#if JUCE_LINUX
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif
+
+namespace imagiro {
+
+namespace {
+    uint16_t readLE16(const unsigned char* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+    uint32_t readLE32(const unsigned char* p) {
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+               (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+    uint16_t readBE16(const unsigned char* p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+    uint32_t readBE32(const unsigned char* p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+               (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+    }
+
+    // 80-bit IEEE extended, as used for the AIFF sample rate
+    double readExtended(const unsigned char* p) {
+        const int exponent = ((p[0] & 0x7f) << 8) | p[1];
+        uint64_t mantissa = 0;
+        for (int i = 2; i < 10; i++) mantissa = (mantissa << 8) | p[i];
+        const auto value = std::ldexp(static_cast<double>(mantissa), exponent - 16383 - 63);
+        return (p[0] & 0x80) != 0 ? -value : value;
+    }
+
+    bool idIs(const unsigned char* p, const char* id) { return std::memcmp(p, id, 4) == 0; }
+
+    // Left-justified so every bit depth shares the same scale
+    template <int Bytes, bool BigEndian>
+    int32_t decodeInt(const unsigned char* p) {
+        uint32_t v = 0;
+        for (int b = 0; b < Bytes; b++) {
+            v = (v << 8) | (BigEndian ? p[b] : p[Bytes - 1 - b]);
+        }
+        return static_cast<int32_t>(v << (32 - Bytes * 8));
+    }
+
+    template <bool BigEndian>
+    float decodeFloat(const unsigned char* p) {
+        const auto bits = static_cast<uint32_t>(decodeInt<4, BigEndian>(p));
+        float f;
+        std::memcpy(&f, &bits, sizeof(float));
+        return f;
+    }
+
+    // Deinterleave one chunk. Integer formats are gathered into a scratch buffer first, so the
+    // conversion to float runs through the vectorised FloatVectorOperations.
+    template <int Bytes, bool BigEndian>
+    void convertIntChunk(const unsigned char* frames, int bytesPerFrame, int numSourceChannels,
+                         float* const* dest, int numDestChannels, int destOffset, int numFrames,
+                         std::vector<int>& scratch) {
+        for (int c = 0; c < numDestChannels; c++) {
+            const auto* in = frames + (c % numSourceChannels) * Bytes;
+            for (int i = 0; i < numFrames; i++) {
+                scratch[static_cast<size_t>(i)] = decodeInt<Bytes, BigEndian>(in + i * bytesPerFrame);
+            }
+            juce::FloatVectorOperations::convertFixedToFloat(dest[c] + destOffset, scratch.data(),
+                                                             1.0f / 2147483648.0f, numFrames);
+        }
+    }
+
+    template <bool BigEndian>
+    void convertFloatChunk(const unsigned char* frames, int bytesPerFrame, int numSourceChannels,
+                           float* const* dest, int numDestChannels, int destOffset, int numFrames) {
+        for (int c = 0; c < numDestChannels; c++) {
+            const auto* in = frames + (c % numSourceChannels) * 4;
+            auto* out = dest[c] + destOffset;
+            for (int i = 0; i < numFrames; i++) {
+                out[i] = decodeFloat<BigEndian>(in + i * bytesPerFrame);
+            }
+        }
+    }
+
+    constexpr int framesPerChunk = 16384;
+}
+
+std::unique_ptr<MappedAudioFile> MappedAudioFile::open(const juce::File& file) {
+#if JUCE_LINUX
+    std::unique_ptr<MappedAudioFile> mapped(new MappedAudioFile());
+    if (!mapped->map(file)) return nullptr;
+    if (!mapped->parseWav() && !mapped->parseAiff()) return nullptr;
+    if (mapped->numChannels <= 0 || mapped->lengthInSamples <= 0) return nullptr;
+    return mapped;
+#else
+    juce::ignoreUnused(file);
+    return nullptr;
+#endif
+}
+
+MappedAudioFile::~MappedAudioFile() {
+#if JUCE_LINUX
+    if (mapping != nullptr) munmap(mapping, mappingSize);
+#endif
+}
+
+bool MappedAudioFile::map(const juce::File& file) {
+#if JUCE_LINUX
+    const auto fd = ::open(file.getFullPathName().toRawUTF8(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info {};
+    if (fstat(fd, &info) != 0 || info.st_size < 12) {
+        ::close(fd);
+        return false;
+    }
+
+    // Private + writable: the file is never modified, but in-place transforms can write to the
+    // zero-copy buffer and the kernel will copy just the pages they touch
+    mappingSize = static_cast<size_t>(info.st_size);
+    auto* m = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (m == MAP_FAILED) {
+        mappingSize = 0;
+        return false;
+    }
+
+    mapping = m;
+    path = file.getFullPathName().toStdString();
+    device = static_cast<uint64_t>(info.st_dev);
+    inode = static_cast<uint64_t>(info.st_ino);
+    return true;
+#else
+    juce::ignoreUnused(file);
+    return false;
+#endif
+}
+
+bool MappedAudioFile::parseWav() {
+    const auto* b = bytes();
+    if (!idIs(b, "RIFF") || !idIs(b + 8, "WAVE")) return false;
+
+    int formatTag = 0;
+    int bitsPerSample = 0;
+    bool haveFormat = false;
+
+    size_t pos = 12;
+    while (pos + 8 <= mappingSize) {
+        const auto* chunk = b + pos;
+        const auto size = static_cast<size_t>(readLE32(chunk + 4));
+        const auto body = pos + 8;
+
+        if (idIs(chunk, "fmt ") && size >= 16 && body + size <= mappingSize) {
+            formatTag = readLE16(b + body);
+            numChannels = readLE16(b + body + 2);
+            sampleRate = readLE32(b + body + 4);
+            bitsPerSample = readLE16(b + body + 14);
+
+            // WAVE_FORMAT_EXTENSIBLE - the real format is at the start of the sub-format GUID
+            if (formatTag == 0xFFFE && size >= 40) formatTag = readLE16(b + body + 24);
+            haveFormat = true;
+        } else if (idIs(chunk, "data")) {
+            if (!haveFormat) return false;
+            dataOffset = body;
+            dataBytes = static_cast<juce::int64>(std::min(size, mappingSize - body));
+            break;
+        }
+
+        pos = body + size + (size & 1);
+    }
+
+    if (!haveFormat || dataOffset == 0) return false;
+
+    if (formatTag == 1 && (bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32)) {
+        format = bitsPerSample == 16 ? SampleFormat::Int16
+               : bitsPerSample == 24 ? SampleFormat::Int24
+               : SampleFormat::Int32;
+    } else if (formatTag == 3 && bitsPerSample == 32) {
+        format = SampleFormat::Float32;
+    } else {
+        return false;
+    }
+
+    bytesPerSample = bitsPerSample / 8;
+    bigEndian = false;
+    if (numChannels <= 0) return false;
+    lengthInSamples = dataBytes / getBytesPerFrame();
+    return true;
+}
+
+bool MappedAudioFile::parseAiff() {
+    const auto* b = bytes();
+    if (!idIs(b, "FORM") || !(idIs(b + 8, "AIFF") || idIs(b + 8, "AIFC"))) return false;
+    const auto isAifc = idIs(b + 8, "AIFC");
+
+    int bitsPerSample = 0;
+    juce::int64 numFrames = 0;
+    bool haveFormat = false;
+    bool isFloat = false;
+    bigEndian = true;
+
+    size_t pos = 12;
+    while (pos + 8 <= mappingSize) {
+        const auto* chunk = b + pos;
+        const auto size = static_cast<size_t>(readBE32(chunk + 4));
+        const auto body = pos + 8;
+
+        if (idIs(chunk, "COMM") && size >= 18 && body + size <= mappingSize) {
+            numChannels = readBE16(b + body);
+            numFrames = readBE32(b + body + 2);
+            bitsPerSample = readBE16(b + body + 6);
+            sampleRate = readExtended(b + body + 8);
+
+            if (isAifc && size >= 22) {
+                const auto* compression = b + body + 18;
+                if (idIs(compression, "sowt")) bigEndian = false;
+                else if (idIs(compression, "fl32") || idIs(compression, "FL32")) isFloat = true;
+                else if (!idIs(compression, "NONE")) return false;
+            }
+            haveFormat = true;
+        } else if (idIs(chunk, "SSND") && size >= 8 && body + 8 <= mappingSize) {
+            const auto offset = static_cast<size_t>(readBE32(b + body));
+            dataOffset = body + 8 + offset;
+            if (dataOffset > mappingSize) return false;
+            dataBytes = static_cast<juce::int64>(std::min(size - 8 - std::min(offset, size - 8),
+                                                          mappingSize - dataOffset));
+        }
+
+        pos = body + size + (size & 1);
+    }
+
+    if (!haveFormat || dataOffset == 0 || numChannels <= 0) return false;
+
+    if (isFloat && bitsPerSample == 32) {
+        format = SampleFormat::Float32;
+    } else if (!isFloat && (bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32)) {
+        format = bitsPerSample == 16 ? SampleFormat::Int16
+               : bitsPerSample == 24 ? SampleFormat::Int24
+               : SampleFormat::Int32;
+    } else {
+        return false;
+    }
+
+    bytesPerSample = bitsPerSample / 8;
+    lengthInSamples = std::min(numFrames, dataBytes / getBytesPerFrame());
+    return true;
+}
+
+float* MappedAudioFile::getZeroCopyData() const {
+   #if JUCE_BIG_ENDIAN
+    constexpr bool hostBigEndian = true;
+   #else
+    constexpr bool hostBigEndian = false;
+   #endif
+
+    if (numChannels != 1 || format != SampleFormat::Float32 || bigEndian != hostBigEndian) return nullptr;
+    if (dataOffset % alignof(float) != 0) return nullptr;
+    if (!isIntact()) return nullptr;
+    return reinterpret_cast<float*>(static_cast<unsigned char*>(mapping) + dataOffset);
+}
+
+bool MappedAudioFile::isIntact() const {
+#if JUCE_LINUX
+    // A file that's gone or been replaced can't be checked, so it doesn't count either
+    struct stat info {};
+    return stat(path.c_str(), &info) == 0 &&
+           static_cast<uint64_t>(info.st_dev) == device && static_cast<uint64_t>(info.st_ino) == inode &&
+           static_cast<juce::int64>(info.st_size) >= static_cast<juce::int64>(dataOffset) + dataBytes;
+#else
+    return false;
+#endif
+}
+
+void MappedAudioFile::adviseAccess(AccessPattern pattern) const {
+#if JUCE_LINUX
+    const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const auto start = (dataOffset / pageSize) * pageSize;
+    madvise(static_cast<unsigned char*>(mapping) + start, mappingSize - start,
+            pattern == AccessPattern::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+#else
+    juce::ignoreUnused(pattern);
+#endif
+}
+
+void MappedAudioFile::prefetchPages(const unsigned char* start, size_t numBytes) const {
+#if JUCE_LINUX
+    const auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto first = reinterpret_cast<uintptr_t>(start) & ~(pageSize - 1);
+    const auto last = std::min(reinterpret_cast<uintptr_t>(start) + numBytes,
+                               reinterpret_cast<uintptr_t>(bytes()) + mappingSize);
+    if (last > first) madvise(reinterpret_cast<void*>(first), last - first, MADV_WILLNEED);
+#else
+    juce::ignoreUnused(start, numBytes);
+#endif
+}
+
+void MappedAudioFile::releasePages(const unsigned char* start, size_t numBytes) const {
+#if JUCE_LINUX
+    // Only whole pages inside the range - a partial page may still be needed by the next chunk
+    const auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto first = (reinterpret_cast<uintptr_t>(start) + pageSize - 1) & ~(pageSize - 1);
+    const auto last = (reinterpret_cast<uintptr_t>(start) + numBytes) & ~(pageSize - 1);
+    if (last > first) madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+#else
+    juce::ignoreUnused(start, numBytes);
+#endif
+}
+
+bool MappedAudioFile::read(float* const* dest, int numDestChannels, juce::int64 startFrame, int numFrames) const {
+    if (startFrame < 0 || numFrames < 0 || startFrame + numFrames > lengthInSamples) return false;
+    if (!isIntact()) return false;
+
+    const auto bytesPerFrame = getBytesPerFrame();
+    const auto chunkBytes = static_cast<size_t>(framesPerChunk) * static_cast<size_t>(bytesPerFrame);
+
+    // The zero-copy buffer may be referring to these pages, so only drop them when converting
+    const auto canRelease = getZeroCopyData() == nullptr;
+
+    std::vector<int> scratch(static_cast<size_t>(framesPerChunk));
+
+    for (int done = 0; done < numFrames; done += framesPerChunk) {
+        const auto n = std::min(framesPerChunk, numFrames - done);
+        const auto* frames = bytes() + dataOffset + static_cast<size_t>(startFrame + done) * static_cast<size_t>(bytesPerFrame);
+
+        prefetchPages(frames + chunkBytes, chunkBytes);
+
+        switch (format) {
+            case SampleFormat::Int16:
+                if (bigEndian) convertIntChunk<2, true>(frames, bytesPerFrame, numChannels, dest, numDestChannels, done, n, scratch);
+                else convertIntChunk<2, false>(frames, bytesPerFrame, numChannels, dest, numDestChannels, done, n, scratch);
+                break;
+            case SampleFormat::Int24:
+                if (bigEndian) convertIntChunk<3, true>(frames, bytesPerFrame, numChannels, dest, numDestChannels, done, n, scratch);
+                else convertIntChunk<3, false>(frames, bytesPerFrame, numChannels, dest, numDestChannels, done, n, scratch);
+                break;
+            case SampleFormat::Int32:
+                if (bigEndian) convertIntChunk<4, true>(frames, bytesPerFrame, numChannels, dest, numDestChannels, done, n, scratch);
+                else convertIntChunk<4, false>(frames, bytesPerFrame, numChannels, dest, numDestChannels, done, n, scratch);
+                break;
+            case SampleFormat::Float32:
+                if (bigEndian) convertFloatChunk<true>(frames, bytesPerFrame, numChannels, dest, numDestChannels, done, n);
+                else convertFloatChunk<false>(frames, bytesPerFrame, numChannels, dest, numDestChannels, done, n);
+                break;
+        }
+
+        if (canRelease) releasePages(frames, static_cast<size_t>(n) * static_cast<size_t>(bytesPerFrame));
+    }
+
+    return true;
+}
+
+} // namespace imagiro
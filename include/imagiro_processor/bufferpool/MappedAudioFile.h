@@ -0,0 +1,83 @@
+#pragma once
+#include "juce_audio_basics/juce_audio_basics.h"
+#include <memory>
+#include <string>
+
+namespace imagiro {
+
+// Memory-mapped view of an uncompressed PCM WAV or AIFF file (Linux only).
+// Mono native-endian 32-bit float files can be used in place without any copy or conversion;
+// everything else is converted to float on read, streaming through the mapping a chunk at a time
+// and handing consumed pages back to the OS so peak memory stays at the size of the output.
+// Conversion is done up front rather than as pages are first touched, so reading the result never
+// faults on the file.
+//
+// Touching a mapped page past the end of a file that's been truncated raises SIGBUS, so the size is
+// checked again before the mapping is read or handed out. A file truncated while a zero-copy buffer
+// is in use can still crash; don't map files that may be rewritten in place.
+class MappedAudioFile {
+public:
+    enum class SampleFormat { Int16, Int24, Int32, Float32 };
+
+    // How grains are expected to walk the data, passed on to the kernel with madvise
+    enum class AccessPattern { Sequential, Random };
+
+    // Returns nullptr if the file isn't an uncompressed WAV/AIFF, or mapping isn't supported here
+    static std::unique_ptr<MappedAudioFile> open(const juce::File& file);
+
+    ~MappedAudioFile();
+
+    MappedAudioFile(const MappedAudioFile&) = delete;
+    MappedAudioFile& operator=(const MappedAudioFile&) = delete;
+
+    int getNumChannels() const { return numChannels; }
+    juce::int64 getLengthInSamples() const { return lengthInSamples; }
+    double getSampleRate() const { return sampleRate; }
+    SampleFormat getSampleFormat() const { return format; }
+    int getBitsPerSample() const { return bytesPerSample * 8; }
+
+    // Sample data that can be used as-is, or nullptr if the file needs converting (or has changed
+    // since it was opened).
+    // The mapping is private and writable, so in-place transforms copy only the pages they touch.
+    float* getZeroCopyData() const;
+
+    void adviseAccess(AccessPattern pattern) const;
+
+    // Convert numFrames starting at startFrame into the destination channels
+    bool read(float* const* dest, int numDestChannels, juce::int64 startFrame, int numFrames) const;
+
+private:
+    MappedAudioFile() = default;
+
+    bool parseWav();
+    bool parseAiff();
+    bool map(const juce::File& file);
+    void releasePages(const unsigned char* start, size_t numBytes) const;
+    void prefetchPages(const unsigned char* start, size_t numBytes) const;
+
+    // Whether the file still holds all of the sample data
+    bool isIntact() const;
+
+    // The mapped file, to check it's still there at its full size
+    std::string path;
+    uint64_t device {0};
+    uint64_t inode {0};
+
+    void* mapping {nullptr};
+    size_t mappingSize {0};
+
+    size_t dataOffset {0};      // first frame, in bytes from the start of the file
+    juce::int64 dataBytes {0};
+
+    int numChannels {0};
+    juce::int64 lengthInSamples {0};
+    double sampleRate {0};
+    SampleFormat format {SampleFormat::Int16};
+    int bytesPerSample {2};
+    bool bigEndian {false};
+
+    int getBytesPerFrame() const { return bytesPerSample * numChannels; }
+    const unsigned char* bytes() const { return static_cast<const unsigned char*>(mapping); }
+};
+
+} // namespace imagiro
@@ -0,0 +1,180 @@
+#pragma once
+#include "juce_audio_basics/juce_audio_basics.h"
+#include <vector>
+
+namespace imagiro {
+
+// Multi-resolution min/max/RMS overview of a buffer, for drawing waveforms without touching the
+// samples. Level 0 has one peak per baseSamplesPerPeak samples, and each level above halves that,
+// so any zoom level can be drawn in O(pixels).
+// Built by the loader in the same pass that measures a buffer's magnitude.
+class PeakPyramid {
+public:
+    struct Peak {
+        float min {0};
+        float max {0};
+        float rms {0};
+    };
+
+    struct Level {
+        int samplesPerPeak {0};
+        std::vector<std::vector<Peak>> channels;
+    };
+
+    static constexpr int baseSamplesPerPeak = 128;
+
+    PeakPyramid(int numChannels, int length) : numSamples(length) {
+        Level base;
+        base.samplesPerPeak = baseSamplesPerPeak;
+        base.channels.assign(static_cast<size_t>(numChannels),
+                             std::vector<Peak>(static_cast<size_t>(getNumPeaks(length, baseSamplesPerPeak))));
+        levels.push_back(std::move(base));
+    }
+
+    // Measure a range of one channel into the base level, returning its magnitude.
+    // startSample must be a multiple of baseSamplesPerPeak. Channels can be added from different threads.
+    float addSamples(int channel, const float* data, int startSample, int count) {
+        jassert(startSample % baseSamplesPerPeak == 0);
+        auto& peaks = levels[0].channels[static_cast<size_t>(channel)];
+        auto magnitude = 0.f;
+
+        for (int offset = 0; offset < count; offset += baseSamplesPerPeak) {
+            const auto blockSize = std::min(baseSamplesPerPeak, count - offset);
+            const auto* block = data + offset;
+
+            const auto range = juce::FloatVectorOperations::findMinAndMax(block, blockSize);
+            auto sumOfSquares = 0.f;
+            for (int i = 0; i < blockSize; i++) sumOfSquares += block[i] * block[i];
+
+            auto& peak = peaks[static_cast<size_t>((startSample + offset) / baseSamplesPerPeak)];
+            peak.min = range.getStart();
+            peak.max = range.getEnd();
+            peak.rms = std::sqrt(sumOfSquares / static_cast<float>(blockSize));
+            magnitude = std::max({magnitude, -peak.min, peak.max});
+        }
+
+        return magnitude;
+    }
+
+    // Build the coarser levels from the base one, once all samples have been added
+    void finish() {
+        levels.resize(1);
+        while (!levels.back().channels.empty() && levels.back().channels[0].size() > 1) {
+            const auto& finer = levels.back();
+            Level coarser;
+            coarser.samplesPerPeak = finer.samplesPerPeak * 2;
+            for (const auto& finePeaks : finer.channels) {
+                auto& peaks = coarser.channels.emplace_back((finePeaks.size() + 1) / 2);
+                for (size_t i = 0; i < peaks.size(); i++) {
+                    const auto first = static_cast<int>(2 * i);
+                    peaks[i] = merge(finePeaks, finer.samplesPerPeak, first, std::min(first + 2, static_cast<int>(finePeaks.size())));
+                }
+            }
+            levels.push_back(std::move(coarser));
+        }
+    }
+
+    // Same overview after a gain is applied to the samples
+    std::shared_ptr<PeakPyramid> withGain(float gain) const {
+        auto scaled = std::make_shared<PeakPyramid>(*this);
+        for (auto& level : scaled->levels) {
+            for (auto& peaks : level.channels) {
+                for (auto& peak : peaks) {
+                    const auto a = peak.min * gain, b = peak.max * gain;
+                    peak = {std::min(a, b), std::max(a, b), peak.rms * std::abs(gain)};
+                }
+            }
+        }
+        return scaled;
+    }
+
+    int getNumChannels() const { return static_cast<int>(levels[0].channels.size()); }
+    int getNumSamples() const { return numSamples; }
+    int getNumLevels() const { return static_cast<int>(levels.size()); }
+    const Level& getLevel(int index) const { return levels[static_cast<size_t>(index)]; }
+
+    // Fill one peak per pixel for [startSample, endSample) of a channel. Below baseSamplesPerPeak
+    // samples per pixel, each pixel gets the peak it falls in - draw the samples themselves instead.
+    void getPeaks(int channel, double startSample, double endSample, Peak* destination, int numPixels) const {
+        if (numPixels <= 0) return;
+        const auto samplesPerPixel = (endSample - startSample) / numPixels;
+
+        // Coarsest level that still has at least one peak per pixel
+        size_t levelIndex = 0;
+        while (levelIndex + 1 < levels.size() && levels[levelIndex + 1].samplesPerPeak <= samplesPerPixel) levelIndex++;
+        const auto& level = levels[levelIndex];
+        const auto& peaks = level.channels[static_cast<size_t>(channel)];
+        const auto numPeaks = static_cast<int>(peaks.size());
+        if (numPeaks == 0) {
+            std::fill(destination, destination + numPixels, Peak{});
+            return;
+        }
+
+        for (int p = 0; p < numPixels; p++) {
+            const auto from = startSample + p * samplesPerPixel;
+            const auto first = std::clamp(static_cast<int>(from / level.samplesPerPeak), 0, numPeaks - 1);
+            const auto last = std::clamp(static_cast<int>(std::ceil((from + samplesPerPixel) / level.samplesPerPeak)),
+                                         first + 1, numPeaks);
+            destination[p] = merge(peaks, level.samplesPerPeak, first, last);
+        }
+    }
+
+    size_t getSizeInBytes() const {
+        size_t size = 0;
+        for (const auto& level : levels) {
+            for (const auto& peaks : level.channels) size += peaks.size() * sizeof(Peak);
+        }
+        return size;
+    }
+
+    // Only the base level is stored, the rest is quick to rebuild
+    void write(juce::OutputStream& stream) const {
+        stream.writeInt(getNumChannels());
+        stream.writeInt(numSamples);
+        for (const auto& peaks : levels[0].channels) {
+            stream.write(peaks.data(), peaks.size() * sizeof(Peak));
+        }
+    }
+
+    static std::shared_ptr<PeakPyramid> read(juce::InputStream& stream, int expectedChannels, int expectedSamples) {
+        const auto numChannels = stream.readInt();
+        const auto storedSamples = stream.readInt();
+        if (numChannels != expectedChannels || storedSamples != expectedSamples) return nullptr;
+
+        auto pyramid = std::make_shared<PeakPyramid>(numChannels, storedSamples);
+        for (auto& peaks : pyramid->levels[0].channels) {
+            const auto bytes = static_cast<int>(peaks.size() * sizeof(Peak));
+            if (stream.read(peaks.data(), bytes) != bytes) return nullptr;
+        }
+        pyramid->finish();
+        return pyramid;
+    }
+
+private:
+    static int getNumPeaks(int samples, int samplesPerPeak) {
+        return (samples + samplesPerPeak - 1) / samplesPerPeak;
+    }
+
+    // Combine peaks [first, last). RMS is weighted by how many samples each peak covers, since the
+    // last one is usually short.
+    Peak merge(const std::vector<Peak>& peaks, int samplesPerPeak, int first, int last) const {
+        Peak result {peaks[static_cast<size_t>(first)].min, peaks[static_cast<size_t>(first)].max, 0};
+        double sumOfSquares = 0;
+        double count = 0;
+        for (int i = first; i < last; i++) {
+            const auto& peak = peaks[static_cast<size_t>(i)];
+            const auto samples = std::min(samplesPerPeak, numSamples - i * samplesPerPeak);
+            result.min = std::min(result.min, peak.min);
+            result.max = std::max(result.max, peak.max);
+            sumOfSquares += static_cast<double>(peak.rms) * peak.rms * samples;
+            count += samples;
+        }
+        result.rms = count > 0 ? static_cast<float>(std::sqrt(sumOfSquares / count)) : 0.f;
+        return result;
+    }
+
+    int numSamples;
+    std::vector<Level> levels;
+};
+
+} // namespace imagiro
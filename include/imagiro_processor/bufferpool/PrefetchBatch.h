@@ -0,0 +1,64 @@
+#pragma once
+#include "CacheTypes.h"
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <vector>
+
+namespace imagiro {
+
+// Progress of a batch of buffers being warmed by FileBufferCache::prefetch()
+class PrefetchBatch {
+public:
+    using Future = std::shared_future<Result<std::shared_ptr<InfoBuffer>>>;
+
+    PrefetchBatch(std::vector<Future> requests, uint64_t estimatedBytes)
+        : futures(std::move(requests)), estimatedBytes(estimatedBytes) {
+    }
+
+    // Distinct chains in the batch
+    size_t getNumRequests() const { return futures.size(); }
+
+    // Finished loading, whether or not they succeeded
+    size_t getNumCompleted() const {
+        return static_cast<size_t>(std::count_if(futures.begin(), futures.end(), isReady));
+    }
+
+    float getProgress() const {
+        return futures.empty() ? 1.f : static_cast<float>(getNumCompleted()) / static_cast<float>(futures.size());
+    }
+
+    bool isDone() const { return getNumCompleted() == futures.size(); }
+
+    // Memory the batch was expected to need when it was scheduled, not counting chains that were
+    // already cached
+    uint64_t getEstimatedBytes() const { return estimatedBytes; }
+
+    // Returns false on timeout
+    bool waitUntilDone(int timeoutMs) const {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        for (const auto& future : futures) {
+            if (future.wait_until(deadline) != std::future_status::ready) return false;
+        }
+        return true;
+    }
+
+    // Errors from the chains that have finished so far
+    std::vector<std::string> getErrors() const {
+        std::vector<std::string> errors;
+        for (const auto& future : futures) {
+            if (isReady(future) && !future.get().has_value()) errors.push_back(future.get().error());
+        }
+        return errors;
+    }
+
+private:
+    static bool isReady(const Future& future) {
+        return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    std::vector<Future> futures;
+    uint64_t estimatedBytes;
+};
+
+} // namespace imagiro
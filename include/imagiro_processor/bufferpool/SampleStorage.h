@@ -0,0 +1,191 @@
+#pragma once
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace imagiro {
+
+// How sample memory is being backed, process-wide (see SampleStorage)
+struct SampleMemoryStats {
+    std::atomic<uint64_t> hugePageBytes {0};      // advised for transparent huge pages
+    std::atomic<uint64_t> regularBytes {0};       // everything else
+    std::atomic<uint64_t> hugePageFallbacks {0};  // allocations that asked for huge pages and didn't get them
+    std::atomic<uint64_t> lockedBytes {0};
+    std::atomic<uint64_t> lockFailures {0};       // usually RLIMIT_MEMLOCK
+
+    nlohmann::json toJson() const;
+};
+
+// One block holding every channel of a buffer, each channel 64 byte aligned.
+//
+// On Linux, blocks of a huge page or more are mapped on a huge page boundary and advised for
+// transparent huge pages, so random grain reads across large samples need far fewer TLB entries.
+// With memory locking on, pinned blocks (e.g. held by a BufferRequestHandle) are mlock()ed so they
+// can't be paged out under memory pressure. Both degrade to ordinary memory when the system won't allow them, which
+// shows up in getStats().
+class SampleStorage {
+public:
+    static constexpr size_t hugePageSize = 2 * 1024 * 1024;
+
+    // Process-wide settings, for buffers allocated (or pinned) from then on. Huge pages are on by
+    // default, locking is off.
+    static void setHugePages(bool enabled) { useHugePages().store(enabled); }
+    static void setMemoryLocking(bool enabled) { useMemoryLocking().store(enabled); }
+    static bool isHugePagesEnabled() { return useHugePages().load(); }
+    static bool isMemoryLockingEnabled() { return useMemoryLocking().load(); }
+    static const SampleMemoryStats& getStats() { return stats(); }
+
+    static std::shared_ptr<SampleStorage> allocate(int numChannels, int numSamples) {
+        return std::shared_ptr<SampleStorage>(new SampleStorage(numChannels, numSamples));
+    }
+
+    ~SampleStorage() {
+        if (locked) {
+#if defined(__linux__)
+            munlock(data, size);
+#endif
+            stats().lockedBytes.fetch_sub(size);
+        }
+
+        (hugePages ? stats().hugePageBytes : stats().regularBytes).fetch_sub(size);
+
+#if defined(__linux__)
+        if (mapped) {
+            munmap(data, size);
+            return;
+        }
+#endif
+        ::operator delete(data, std::align_val_t {alignment});
+    }
+
+    SampleStorage(const SampleStorage&) = delete;
+    SampleStorage& operator=(const SampleStorage&) = delete;
+
+    float* const* getChannels() const { return channels.data(); }
+
+    // Keep the block resident while the returned handle is alive. Pins nest - the block is locked by
+    // the first and unlocked after the last. nullptr when locking is off.
+    // keepAlive is whatever owns this storage, so the handle can outlive the caller's reference.
+    std::shared_ptr<void> pin(std::shared_ptr<const void> keepAlive) const {
+        if (!isMemoryLockingEnabled()) return nullptr;
+
+        {
+            std::lock_guard lock(pinMutex);
+            if (pinCount++ == 0 && !locked) {
+#if defined(__linux__)
+                locked = mlock(data, size) == 0;
+#endif
+                if (locked) stats().lockedBytes.fetch_add(size);
+                else stats().lockFailures.fetch_add(1);
+            }
+        }
+
+        return std::shared_ptr<void>(const_cast<SampleStorage*>(this), [keepAlive](void* p) {
+            static_cast<const SampleStorage*>(p)->unpin();
+        });
+    }
+
+private:
+    static constexpr size_t alignment = 64;
+
+    void* data {nullptr};
+    size_t size {0};
+    bool mapped {false};
+    bool hugePages {false};
+    std::vector<float*> channels;
+
+    mutable std::mutex pinMutex;
+    mutable int pinCount {0};
+    mutable bool locked {false};
+
+    SampleStorage(int numChannels, int numSamples) {
+        const auto channelStride = (static_cast<size_t>(numSamples) * sizeof(float) + alignment - 1) / alignment * alignment;
+        size = std::max<size_t>(alignment, channelStride * static_cast<size_t>(numChannels));
+
+#if defined(__linux__)
+        if (isHugePagesEnabled() && size >= hugePageSize) mapHugePages();
+#endif
+        if (!mapped) data = ::operator new(size, std::align_val_t {alignment});
+        (hugePages ? stats().hugePageBytes : stats().regularBytes).fetch_add(size);
+
+        for (int c = 0; c < numChannels; c++) {
+            channels.push_back(reinterpret_cast<float*>(static_cast<char*>(data) + channelStride * static_cast<size_t>(c)));
+        }
+    }
+
+#if defined(__linux__)
+    // Map a huge page aligned region (mmap only promises page alignment, so map a huge page extra
+    // and trim it), then ask for it to be backed by huge pages
+    void mapHugePages() {
+        size = (size + hugePageSize - 1) / hugePageSize * hugePageSize;
+        const auto mappedSize = size + hugePageSize;
+        auto* region = static_cast<char*>(mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (region == MAP_FAILED) {
+            stats().hugePageFallbacks.fetch_add(1);
+            return;
+        }
+
+        const auto address = reinterpret_cast<uintptr_t>(region);
+        auto* aligned = reinterpret_cast<char*>((address + hugePageSize - 1) / hugePageSize * hugePageSize);
+        const auto head = static_cast<size_t>(aligned - region);
+        if (head > 0) munmap(region, head);
+        if (mappedSize - head > size) munmap(aligned + size, mappedSize - head - size);
+
+        data = aligned;
+        mapped = true;
+        hugePages = madvise(data, size, MADV_HUGEPAGE) == 0;
+        if (!hugePages) stats().hugePageFallbacks.fetch_add(1); // e.g. THP disabled
+    }
+#endif
+
+    void unpin() const {
+        std::lock_guard lock(pinMutex);
+        if (--pinCount == 0 && locked) {
+#if defined(__linux__)
+            munlock(data, size);
+#endif
+            locked = false;
+            stats().lockedBytes.fetch_sub(size);
+        }
+    }
+
+    static std::atomic<bool>& useHugePages() {
+        static std::atomic<bool> enabled {true};
+        return enabled;
+    }
+
+    static std::atomic<bool>& useMemoryLocking() {
+        static std::atomic<bool> enabled {false};
+        return enabled;
+    }
+
+    static SampleMemoryStats& stats() {
+        static SampleMemoryStats instance;
+        return instance;
+    }
+};
+
+inline nlohmann::json SampleMemoryStats::toJson() const {
+    return {
+        {"hugePagesEnabled", SampleStorage::isHugePagesEnabled()},
+        {"hugePageBytes", hugePageBytes.load(std::memory_order_relaxed)},
+        {"regularBytes", regularBytes.load(std::memory_order_relaxed)},
+        {"hugePageFallbacks", hugePageFallbacks.load(std::memory_order_relaxed)},
+        {"memoryLockingEnabled", SampleStorage::isMemoryLockingEnabled()},
+        {"lockedBytes", lockedBytes.load(std::memory_order_relaxed)},
+        {"lockFailures", lockFailures.load(std::memory_order_relaxed)}
+    };
+}
+
+} // namespace imagiro
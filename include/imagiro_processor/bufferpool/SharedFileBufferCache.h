@@ -0,0 +1,46 @@
+#pragma once
+#include "FileBufferCache.h"
+#include <juce_core/juce_core.h>
+
+namespace imagiro {
+
+// Per-instance handle onto a process-wide FileBufferCache.
+// Every instance holding one of these shares the same cache, loader thread and global memory budget,
+// so a file + transform chain requested by several instances is only decoded and stored once.
+// The shared cache is created with the first handle and destroyed with the last.
+class SharedFileBufferCache {
+public:
+    // quotaBytes limits how much of the shared cache this instance can be charged for (0 = no quota)
+    explicit SharedFileBufferCache(uint64_t quotaBytes = 0)
+        : clientId(pool->registerClient(quotaBytes)) {}
+
+    ~SharedFileBufferCache() {
+        pool->unregisterClient(clientId);
+    }
+
+    SharedFileBufferCache(const SharedFileBufferCache&) = delete;
+    SharedFileBufferCache& operator=(const SharedFileBufferCache&) = delete;
+
+    // Fluent API entry point, requests are charged to this instance
+    BufferRequest request(const std::string& path) {
+        return pool->request(path).client(clientId);
+    }
+
+    void setQuota(uint64_t quotaBytes) { pool->setClientQuota(clientId, quotaBytes); }
+    size_t getUsage() const { return pool->getClientCacheSize(clientId); }
+    ClientId getClientId() const { return clientId; }
+
+    // Listeners are called for loads from every instance, so filter on the key
+    using Listener = FileBufferCache::Listener;
+    void addListener(Listener* l) { pool->addListener(l); }
+    void removeListener(Listener* l) { pool->removeListener(l); }
+
+    // The shared cache itself, e.g. to set the global budget
+    FileBufferCache& getPool() { return *pool; }
+
+private:
+    juce::SharedResourcePointer<FileBufferCache> pool;
+    const ClientId clientId;
+};
+
+} // namespace imagiro
@@ -0,0 +1,18 @@
+#pragma once
+#include "juce_core/juce_core.h"
+#include <string>
+
+namespace imagiro {
+
+// Describes the part of a sample that stays on disk when it's loaded in streaming mode.
+// The InfoBuffer only holds the first headLength samples, the rest is read by the DiskStreamer.
+struct StreamingSource {
+    std::string filePath;
+    juce::int64 fileStartSample {0};    // offset of sample 0 within the file
+    juce::int64 lengthInSamples {0};    // full length of the streamed range
+    int numChannels {0};
+    double sampleRate {0};
+    int headLength {0};                 // samples resident in the InfoBuffer
+};
+
+} // namespace imagiro
@@ -1,30 +1,231 @@
 #pragma once
 #include "juce_audio_basics/juce_audio_basics.h"
+#include "InfoBuffer.h"
+#include "Hash.h"
 #include <string>
 #include <memory>
 #include <functional>
+#include <algorithm>
+#include <charconv>
+#include <optional>
+#include <vector>
 
 namespace imagiro {
 
+// Applies a transform to consecutive chunks of a buffer, in order, keeping any state (e.g. filter
+// history) between them. Used to publish the start of a buffer before the rest has been loaded.
+class ChunkProcessor {
+public:
+    virtual ~ChunkProcessor() = default;
+    virtual void process(juce::AudioSampleBuffer& buffer, int startSample, int numSamples) = 0;
+};
+
+// Source that can be read a chunk at a time
+class ChunkedSource {
+public:
+    virtual ~ChunkedSource() = default;
+
+    // Allocate the full buffer and set its sample rate, without reading any audio
+    virtual bool prepare(InfoBuffer& info) = 0;
+    virtual bool read(InfoBuffer& info, int startSample, int numSamples) = 0;
+    virtual std::string getLastError() const = 0;
+};
+
 class Transform {
 public:
     virtual ~Transform() = default;
 
-    // Apply the transform to a buffer (or create one in case of LoadTransform)
+    // Apply the transform to a buffer (or create one in case of a source such as LoadTransform)
     // Returns true on success, false on error
     virtual bool process(juce::AudioSampleBuffer& buffer, double& sampleRate) const = 0;
 
+    // Apply the transform to an InfoBuffer. Override this instead if the transform needs to read
+    // or attach buffer metadata.
+    virtual bool processInfo(InfoBuffer& info) const {
+        return process(info.buffer, info.sampleRate);
+    }
+
+    // Sources create the buffer rather than transforming one, and must start a chain
+    virtual bool isSource() const { return false; }
+
+    // Size of the buffer a source will produce, from the file header alone, or nullopt if unknown.
+    // Used to check a prefetch against the memory budget before decoding anything.
+    virtual std::optional<uint64_t> estimateSizeInBytes() const { return std::nullopt; }
+
+    // In-place transforms overwrite the samples they're given. Others (e.g. anything that changes the
+    // length) build a new buffer from the input, and override processInto() so the input doesn't
+    // have to be copied first.
+    virtual bool isInPlace() const { return true; }
+
+    // Channels can be processed independently, so the loader may call processInfo() on single channel
+    // views of the buffer in parallel. Only for in-place transforms that change nothing but the
+    // samples, since the rest of each view is thrown away (e.g. not reverse, which swaps the padding).
+    virtual bool isChannelIndependent() const { return false; }
+
+    // Pointwise gains (gain, normalize) report the factor they'd apply to a buffer with the given peak
+    // magnitude, so consecutive ones can be folded into a single pass. nullopt for anything else.
+    virtual std::optional<float> getGainFactor(float /*currentMagnitude*/) const { return std::nullopt; }
+
+    // Analysis transforms only read the samples and attach AnalysisMetadata in processInfo(). The loader
+    // never copies samples for them, and persists their results on their own rather than as another
+    // copy of the buffer.
+    virtual bool isAnalysis() const { return false; }
+
+    virtual bool processInto(const InfoBuffer& input, InfoBuffer& output) const {
+        output.allocateCopyOf(input.buffer);
+        output.sampleRate = input.sampleRate;
+        output.file = input.file;
+        output.padStart = input.padStart;
+        output.padEnd = input.padEnd;
+        output.reversed = input.reversed;
+        return processInfo(output);
+    }
+
+    // For transforms where output up to sample N only depends on input up to N (gain, filters...).
+    // Returns nullptr if the transform needs the whole buffer (e.g. normalize).
+    virtual std::unique_ptr<ChunkProcessor> createChunkProcessor(int /*numChannels*/, double /*sampleRate*/) const {
+        return nullptr;
+    }
+
+    // For sources that can be decoded incrementally, or nullptr
+    virtual std::unique_ptr<ChunkedSource> createChunkedSource() const { return nullptr; }
+
     // Get error message if process() returned false
     virtual std::string getLastError() const { return "Unknown error"; }
 
     // Get unique hash for this transform
     virtual size_t getHash() const = 0;
 
+    // Exact identity of this transform: its type and every parameter that affects the output, with
+    // numbers written so they round-trip. Cache keys are built from these and compared on lookup, so
+    // two transforms must only share a key if they produce identical output.
+    // The default is only safe if getDescription() is exact - override it where it isn't.
+    virtual std::string getCanonicalKey() const { return getDescription(); }
+
+    // Hash that's stable across runs, for the persistent cache. Sources leave out their file path,
+    // since the disk cache identifies source files by content instead.
+    virtual uint64_t getPersistentHash() const {
+        return Hasher64().update(getCanonicalKey()).finish();
+    }
+
+    // File a source reads from, or empty if the result can't be persisted
+    virtual std::string getSourcePath() const { return {}; }
+
     // Clone for polymorphic copying
     virtual std::unique_ptr<Transform> clone() const = 0;
 
     // For debugging/logging
     virtual std::string getDescription() const = 0;
+
+protected:
+    friend class MultiOutputTransform;
+
+    // Shortest representation that parses back to exactly the same value, for canonical keys
+    static std::string exact(double value) {
+        char text[32];
+        const auto result = std::to_chars(text, text + sizeof(text), value);
+        return std::string(text, result.ptr);
+    }
+};
+
+// Transform with several named results from one pass over its input (e.g. a filter bank split).
+// Chains use one of them through an OutputTransform. The loader runs it once and caches every
+// output, so chains selecting the others find them ready.
+class MultiOutputTransform {
+public:
+    virtual ~MultiOutputTransform() = default;
+
+    virtual std::vector<std::string> getOutputNames() const = 0;
+
+    // Fill outputs, which has one empty buffer per output name, in order.
+    // Called concurrently for different inputs, so errors go to `error` rather than member state.
+    virtual bool processOutputs(const InfoBuffer& input, std::vector<InfoBuffer>& outputs, std::string& error) const = 0;
+
+    // See Transform::getCanonicalKey()
+    virtual std::string getCanonicalKey() const = 0;
+
+    virtual std::string getDescription() const = 0;
+
+protected:
+    static std::string exact(double value) { return Transform::exact(value); }
+};
+
+// One output of a MultiOutputTransform, as a step in a chain
+class OutputTransform : public Transform {
+public:
+    OutputTransform(std::shared_ptr<const MultiOutputTransform> source, const std::string& outputName)
+        : source(std::move(source)), name(outputName) {
+        const auto names = this->source->getOutputNames();
+        index = static_cast<size_t>(std::find(names.begin(), names.end(), name) - names.begin());
+        numOutputs = names.size();
+    }
+
+    bool process(juce::AudioSampleBuffer& buffer, double& sampleRate) const override {
+        InfoBuffer input;
+        input.buffer = std::move(buffer);
+        input.sampleRate = sampleRate;
+        InfoBuffer output;
+        if (!processInto(input, output)) return false;
+        buffer.makeCopyOf(output.buffer);
+        sampleRate = output.sampleRate;
+        return true;
+    }
+
+    bool isInPlace() const override { return false; }
+
+    bool processInto(const InfoBuffer& input, InfoBuffer& output) const override {
+        std::vector<InfoBuffer> outputs;
+        if (!processOutputs(input, outputs)) return false;
+        output = std::move(outputs[index]);
+        return true;
+    }
+
+    // Every output of the source, with this one at getOutputIndex()
+    bool processOutputs(const InfoBuffer& input, std::vector<InfoBuffer>& outputs) const {
+        if (index >= numOutputs) {
+            lastError = "No output named " + name;
+            return false;
+        }
+
+        outputs.clear();
+        outputs.resize(numOutputs);
+        for (auto& output : outputs) output.sampleRate = input.sampleRate;
+        return source->processOutputs(input, outputs, lastError);
+    }
+
+    size_t getOutputIndex() const { return index; }
+
+    // The same source, selecting another output
+    std::unique_ptr<OutputTransform> withOutput(size_t outputIndex) const {
+        return std::make_unique<OutputTransform>(source, source->getOutputNames().at(outputIndex));
+    }
+
+    const MultiOutputTransform& getSource() const { return *source; }
+
+    std::string getLastError() const override { return lastError; }
+
+    size_t getHash() const override {
+        return std::hash<std::string>{}(getCanonicalKey());
+    }
+
+    std::unique_ptr<Transform> clone() const override {
+        return std::make_unique<OutputTransform>(source, name);
+    }
+
+    std::string getDescription() const override {
+        return source->getDescription() + " [" + name + "]";
+    }
+
+    std::string getCanonicalKey() const override {
+        return "output|" + source->getCanonicalKey() + "|" + name;
+    }
+
+private:
+    std::shared_ptr<const MultiOutputTransform> source;
+    std::string name;
+    size_t index {0};
+    size_t numOutputs {0};
+    mutable std::string lastError;
 };
 
 } // namespace imagiro
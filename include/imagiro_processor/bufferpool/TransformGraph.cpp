@@ -0,0 +1,114 @@
+#include "TransformGraph.h"
+#include "FileBufferCache.h"
+#include "CommonTransforms.h"
+#include <map>
+
+namespace imagiro {
+
+TransformGraph::Node TransformGraph::load(const std::string& path) {
+    return source(std::make_unique<LoadTransform>(path, cache->afm));
+}
+
+TransformGraph::Node TransformGraph::source(std::unique_ptr<Transform> source) {
+    CacheKey key;
+    key.transforms.push_back(std::move(source));
+    return addNode(std::nullopt, std::move(key));
+}
+
+TransformGraph::Node TransformGraph::add(Node input, std::unique_ptr<Transform> transform) {
+    auto key = nodes.at(input).key;
+    key.transforms.push_back(std::move(transform));
+    return addNode(input, std::move(key));
+}
+
+TransformGraph::Node TransformGraph::select(Node input, std::shared_ptr<const MultiOutputTransform> transform,
+                                            const std::string& outputName) {
+    return add(input, std::make_unique<OutputTransform>(std::move(transform), outputName));
+}
+
+TransformGraph& TransformGraph::output(const std::string& name, Node node) {
+    outputs.emplace_back(name, node);
+    return *this;
+}
+
+TransformGraph& TransformGraph::client(ClientId id) {
+    clientId = id;
+    return *this;
+}
+
+TransformGraph::Node TransformGraph::addNode(std::optional<Node> input, CacheKey key) {
+    auto canonical = key.getId().canonical;
+    auto it = nodesByChain.find(canonical);
+    if (it != nodesByChain.end()) return it->second;
+
+    nodes.push_back({input, std::move(key)});
+    nodesByChain.emplace(std::move(canonical), nodes.size() - 1);
+    return nodes.size() - 1;
+}
+
+std::vector<BufferLoader::GraphStep> TransformGraph::plan(std::vector<Node>* stepNodes) const {
+    const auto selectedOutput = [&](Node node) -> const OutputTransform* {
+        return dynamic_cast<const OutputTransform*>(nodes[node].key.transforms.back().get());
+    };
+
+    // Nodes some output depends on, and how many of their children lead to one
+    std::vector<bool> needed(nodes.size(), false);
+    std::vector<int> neededChildren(nodes.size(), 0);
+    std::vector<bool> isOutput(nodes.size(), false);
+    for (const auto& [name, node] : outputs) {
+        isOutput[node] = true;
+        for (std::optional<Node> n = node; n && !needed[*n]; n = nodes[*n].input) {
+            needed[*n] = true;
+            if (nodes[*n].input) neededChildren[*nodes[*n].input]++;
+        }
+    }
+
+    // Nodes are only ever added after their input, so this visits inputs before the steps that
+    // follow them
+    std::vector<std::optional<size_t>> stepOf(nodes.size());
+    std::map<std::pair<Node, std::string>, size_t> firstSelections; // by input and transform key
+    std::vector<BufferLoader::GraphStep> steps;
+
+    for (Node node = 0; node < nodes.size(); ++node) {
+        if (!needed[node]) continue;
+
+        const auto* selected = selectedOutput(node);
+        if (!isOutput[node] && neededChildren[node] < 2 && !selected) continue;
+
+        BufferLoader::GraphStep step;
+        step.key = nodes[node].key;
+
+        for (auto n = nodes[node].input; n && !step.after; n = nodes[*n].input) {
+            step.after = stepOf[*n];
+        }
+
+        if (selected && nodes[node].input) {
+            auto [it, first] = firstSelections.try_emplace({*nodes[node].input, selected->getSource().getCanonicalKey()},
+                                                           steps.size());
+            if (!first) step.after = it->second;
+        }
+
+        stepOf[node] = steps.size();
+        steps.push_back(std::move(step));
+        if (stepNodes) stepNodes->push_back(node);
+    }
+
+    return steps;
+}
+
+std::shared_ptr<GraphResult> TransformGraph::execute() const {
+    std::vector<Node> stepNodes;
+    auto steps = plan(&stepNodes);
+    const auto numSteps = steps.size();
+    const auto futures = cache->loader->requestGraph(std::move(steps), clientId);
+
+    std::unordered_map<std::string, GraphResult::Future> results;
+    for (const auto& [name, node] : outputs) {
+        const auto step = std::find(stepNodes.begin(), stepNodes.end(), node) - stepNodes.begin();
+        results[name] = futures[static_cast<size_t>(step)];
+    }
+
+    return std::make_shared<GraphResult>(std::move(results), numSteps);
+}
+
+} // namespace imagiro
@@ -0,0 +1,126 @@
+#pragma once
+#include "CacheTypes.h"
+#include "BufferLoader.h"
+#include "PrefetchBatch.h"
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace imagiro {
+
+class FileBufferCache;
+
+// Results of TransformGraph::execute(), by output name
+class GraphResult {
+public:
+    using Future = PrefetchBatch::Future;
+
+    GraphResult(std::unordered_map<std::string, Future> outputs, size_t numSteps)
+        : outputs(std::move(outputs)), numSteps(numSteps) {
+    }
+
+    std::optional<Future> getFuture(const std::string& name) const {
+        auto it = outputs.find(name);
+        if (it == outputs.end()) return std::nullopt;
+        return it->second;
+    }
+
+    // Blocking
+    Result<std::shared_ptr<InfoBuffer>> get(const std::string& name, int timeoutMs = 30000) const {
+        auto future = getFuture(name);
+        if (!future) {
+            return Result<std::shared_ptr<InfoBuffer>>::unexpected_type("No output named " + name);
+        }
+        if (future->wait_for(std::chrono::milliseconds(timeoutMs)) != std::future_status::ready) {
+            return Result<std::shared_ptr<InfoBuffer>>::unexpected_type("Timeout waiting for buffer");
+        }
+        return future->get();
+    }
+
+    // Returns false on timeout
+    bool waitUntilDone(int timeoutMs) const {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        for (const auto& [name, future] : outputs) {
+            if (future.wait_until(deadline) != std::future_status::ready) return false;
+        }
+        return true;
+    }
+
+    // Chains the graph was evaluated as - shared nodes are only counted once
+    size_t getNumSteps() const { return numSteps; }
+
+private:
+    std::unordered_map<std::string, Future> outputs;
+    size_t numSteps;
+};
+
+// Several transform chains described together, so that work they have in common is only done once.
+//
+// Nodes are hash-consed: adding a transform that a node already has as a child returns that child,
+// so chains that start the same way share nodes however they were built. Executing the graph loads
+// each shared node once, then the branches after it in parallel. Every node stands for an ordinary
+// linear chain, so results are cached (and found in the memory and disk caches) exactly as if they
+// had been requested one at a time.
+//
+//     auto graph = cache.graph();
+//     auto source = graph.load(path);
+//     auto split = std::make_shared<BandSplitTransform>(200.f);
+//     graph.output("low", graph.select(source, split, "low"));
+//     graph.output("high", graph.add(graph.select(source, split, "high"), std::make_unique<GainTransform>(-6.f)));
+//     auto result = graph.execute();
+class TransformGraph {
+    friend class FileBufferCache;
+
+public:
+    using Node = size_t;
+
+    // Sources
+    Node load(const std::string& path);
+    Node source(std::unique_ptr<Transform> source);
+
+    // Apply a transform to a node's result
+    Node add(Node input, std::unique_ptr<Transform> transform);
+
+    // One output of a multi output transform applied to a node's result. Any number of outputs of
+    // the same transform can be selected, it still only runs once.
+    Node select(Node input, std::shared_ptr<const MultiOutputTransform> transform, const std::string& outputName);
+
+    // Name a node whose result is wanted
+    TransformGraph& output(const std::string& name, Node node);
+
+    // Charge cached results to a client's quota
+    TransformGraph& client(ClientId id);
+
+    // The chain a node stands for
+    const CacheKey& getKey(Node node) const { return nodes.at(node).key; }
+    size_t getNumNodes() const { return nodes.size(); }
+
+    // Start loading every output
+    std::shared_ptr<GraphResult> execute() const;
+
+    // The chains execute() loads: one per output, per node several outputs depend on, and per
+    // selected output of a multi output transform. Each follows the nearest of these it depends on,
+    // and outputs of a multi output transform after the first follow that first one, since it
+    // caches them all. stepNodes receives the node of each step.
+    std::vector<BufferLoader::GraphStep> plan(std::vector<Node>* stepNodes = nullptr) const;
+
+private:
+    struct NodeData {
+        std::optional<Node> input;
+        CacheKey key;
+    };
+
+    FileBufferCache* cache;
+    ClientId clientId = NoClient;
+    std::vector<NodeData> nodes;
+    std::unordered_map<std::string, Node> nodesByChain; // by canonical chain key
+    std::vector<std::pair<std::string, Node>> outputs;
+
+    explicit TransformGraph(FileBufferCache* c) : cache(c) {}
+
+    Node addNode(std::optional<Node> input, CacheKey key);
+};
+
+} // namespace imagiro
@@ -9,6 +9,12 @@
 #include "imagiro_util/util.h"
 #include "juce_audio_basics/juce_audio_basics.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 namespace imagiro {
     static float interp_linear(const juce::AudioSampleBuffer& b, int channel, double index) {
         jassert(index >= INTERP_PRE_SAMPLES && index < b.getNumSamples() - INTERP_POST_SAMPLES);
@@ -70,6 +76,112 @@ namespace imagiro {
         return ((c3*z+c2)*z+c1)*z+c0;
     }
 
+    // Same as above, for buffers with at least one guard sample before index 0 (see PadTransform),
+    // so the edge check can be skipped
+    static float interp4p3o_2x_guarded(const float* in, double index) {
+        const int floored = static_cast<int>(index);
+        const auto x = index - floored;
+
+        const auto ym1 = in[floored - 1];
+        const auto y0 = in[floored];
+        const auto y1 = in[floored + 1];
+        const auto y2 = in[floored + 2];
+
+        float z = x - 1/2.0;
+        float even1 = y1+y0, odd1 = y1-y0;
+        float even2 = y2+ym1, odd2 = y2-ym1;
+        float c0 = even1*0.45868970870461956 + even2*0.04131401926395584;
+        float c1 = odd1*0.48068024766578432 + odd2*0.17577925564495955;
+        float c2 = even1*-0.246185007019907091 + even2*0.24614027139700284;
+        float c3 = odd1*-0.36030925263849456 + odd2*0.10174985775982505;
+        return ((c3*z+c2)*z+c1)*z+c0;
+    }
+
+    /*
+     * Block version of interp4p3o_2x (or interp4p3o_2x_guarded): out[i] = interp(in, indices[i]).
+     * Eight positions at a time with AVX2, four with NEON, the scalar functions otherwise and for the
+     * tail. Lanes evaluate the polynomial in single precision, where the scalar version rounds its
+     * coefficients from double, so results can differ from it in the last bit or two.
+     */
+    template <bool Guarded>
+    static void interp4p3o_2x_block(const float* in, const double* indices, float* out, int num) {
+        int i = 0;
+
+#if defined(__AVX2__)
+        const auto halfD = _mm256_set1_pd(0.5);
+        const auto one = _mm256_set1_epi32(1);
+        const auto zero = _mm256_setzero_si256();
+
+        for (; i + 8 <= num; i += 8) {
+            const auto indexLo = _mm256_loadu_pd(indices + i);
+            const auto indexHi = _mm256_loadu_pd(indices + i + 4);
+            const auto flooredLo = _mm256_cvttpd_epi32(indexLo);
+            const auto flooredHi = _mm256_cvttpd_epi32(indexHi);
+            const auto floored = _mm256_set_m128i(flooredHi, flooredLo);
+
+            // Same rounding as the scalar version: x - 0.5 in double, then to float
+            const auto zLo = _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_sub_pd(indexLo, _mm256_cvtepi32_pd(flooredLo)), halfD));
+            const auto zHi = _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_sub_pd(indexHi, _mm256_cvtepi32_pd(flooredHi)), halfD));
+            const auto z = _mm256_set_m128(zHi, zLo);
+
+            auto previous = _mm256_sub_epi32(floored, one);
+            if constexpr (!Guarded) previous = _mm256_max_epi32(previous, zero);
+
+            const auto ym1 = _mm256_i32gather_ps(in, previous, 4);
+            const auto y0 = _mm256_i32gather_ps(in, floored, 4);
+            const auto y1 = _mm256_i32gather_ps(in + 1, floored, 4);
+            const auto y2 = _mm256_i32gather_ps(in + 2, floored, 4);
+
+            const auto even1 = _mm256_add_ps(y1, y0), odd1 = _mm256_sub_ps(y1, y0);
+            const auto even2 = _mm256_add_ps(y2, ym1), odd2 = _mm256_sub_ps(y2, ym1);
+            const auto weigh = [](__m256 a, float ka, __m256 b, float kb) {
+                return _mm256_add_ps(_mm256_mul_ps(a, _mm256_set1_ps(ka)), _mm256_mul_ps(b, _mm256_set1_ps(kb)));
+            };
+            const auto c0 = weigh(even1, 0.45868970870461956f, even2, 0.04131401926395584f);
+            const auto c1 = weigh(odd1, 0.48068024766578432f, odd2, 0.17577925564495955f);
+            const auto c2 = weigh(even1, -0.246185007019907091f, even2, 0.24614027139700284f);
+            const auto c3 = weigh(odd1, -0.36030925263849456f, odd2, 0.10174985775982505f);
+
+            auto v = _mm256_add_ps(_mm256_mul_ps(c3, z), c2);
+            v = _mm256_add_ps(_mm256_mul_ps(v, z), c1);
+            v = _mm256_add_ps(_mm256_mul_ps(v, z), c0);
+            _mm256_storeu_ps(out + i, v);
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        // No gathers, so the taps are loaded per lane and only the polynomial is vectorised
+        for (; i + 4 <= num; i += 4) {
+            alignas(16) float ym1[4], y0[4], y1[4], y2[4], zs[4];
+            for (int l = 0; l < 4; l++) {
+                const auto index = indices[i + l];
+                const int floored = static_cast<int>(index);
+                zs[l] = static_cast<float>(index - floored - 1/2.0);
+                ym1[l] = Guarded || floored > 0 ? in[floored - 1] : in[0];
+                y0[l] = in[floored];
+                y1[l] = in[floored + 1];
+                y2[l] = in[floored + 2];
+            }
+
+            const auto z = vld1q_f32(zs);
+            const auto a = vld1q_f32(y0), b = vld1q_f32(y1), p = vld1q_f32(ym1), q = vld1q_f32(y2);
+            const auto even1 = vaddq_f32(b, a), odd1 = vsubq_f32(b, a);
+            const auto even2 = vaddq_f32(q, p), odd2 = vsubq_f32(q, p);
+            const auto c0 = vmlaq_n_f32(vmulq_n_f32(even1, 0.45868970870461956f), even2, 0.04131401926395584f);
+            const auto c1 = vmlaq_n_f32(vmulq_n_f32(odd1, 0.48068024766578432f), odd2, 0.17577925564495955f);
+            const auto c2 = vmlaq_n_f32(vmulq_n_f32(even1, -0.246185007019907091f), even2, 0.24614027139700284f);
+            const auto c3 = vmlaq_n_f32(vmulq_n_f32(odd1, -0.36030925263849456f), odd2, 0.10174985775982505f);
+
+            auto v = vmlaq_f32(c2, c3, z);
+            v = vmlaq_f32(c1, v, z);
+            v = vmlaq_f32(c0, v, z);
+            vst1q_f32(out + i, v);
+        }
+#endif
+
+        for (; i < num; i++) {
+            out[i] = Guarded ? interp4p3o_2x_guarded(in, indices[i]) : interp4p3o_2x(in, indices[i]);
+        }
+    }
+
     /*
      * 4-point, 3rd order for 4x oversampled audio
      */
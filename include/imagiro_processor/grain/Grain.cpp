@@ -3,8 +3,15 @@
 //
 #include "Grain.h"
 
+namespace {
+// Shared by every grain, for pan coefficients
+const juce::dsp::LookupTableTransform<float> sinApprox {
+    [] (const float x) { return std::sin(x); },
+    -6.5f, 6.5f, 80};
+}
+
 Grain::Grain(std::vector<GrainSampleData> &data, size_t i)
-    : indexInStream(i), isLooping(false), sampleDataBuffer(data), windowFunction(),
+    : indexInStream(i), isLooping(false), sampleDataBuffer(data), window(windowBank->getFlatWindow()),
       cachedPanCoeffs{}, gain(0), pointer(0),
       sampleRate(0)
 {
@@ -40,31 +47,29 @@ void Grain::play(int sampleDelay) {
         return;
     }
 
+    selectBufferVariant();
+
     spreadVal = (imagiro::rand01() * 2 - 1) * settings.spread;
 
     // if the grain is infinitely long, don't use the window function, just play full volume
     if (settings.duration < 0) {
         progressPerSample = 0;
-        windowFunction.initialise([](float p) {
-            return 1.f;
-        }, 0.f, 1.f, 2);
+        window = windowBank->getFlatWindow();
     } else {
         progressPerSample = 1.f / (settings.duration * (float) sampleRate);
-        windowFunction.initialise([shape = settings.shape, skew = settings.skew](const float p) {
-            return getGrainShapeGain(p, shape, skew);
-        }, 0.f, 1.f, 100);
+        window = windowBank->getWindow(settings.shape, settings.skew);
     }
 
 
     updateSampleRateRatio();
 
-    auto spawnPosition = std::clamp(settings.position, 0.f, 1.f) * static_cast<float>(currentBuffer->buffer.getNumSamples());
+    auto spawnPosition = std::clamp(settings.position, 0.f, 1.f) * static_cast<float>(currentBuffer->getLengthInSamples());
 
     setNewLoopSettingsInternal(settings.loopSettings);
 
     if (settings.loopSettings.loopActive) {
-        const auto loopStart = settings.loopSettings.getLoopStartSample(currentBuffer->buffer.getNumSamples());
-        const auto loopEnd = settings.loopSettings.getLoopEndSample(currentBuffer->buffer.getNumSamples());
+        const auto loopStart = settings.loopSettings.getLoopStartSample(currentBuffer->getLengthInSamples());
+        const auto loopEnd = settings.loopSettings.getLoopEndSample(currentBuffer->getLengthInSamples());
         bool pastLoop = false;
         if (!settings.reverse) {
             pastLoop = spawnPosition >= loopEnd;
@@ -77,7 +82,7 @@ void Grain::play(int sampleDelay) {
 
     pointer = spawnPosition;
     pointer = std::min(
-        static_cast<double>(currentBuffer->buffer.getNumSamples()) - INTERP_POST_SAMPLES - INTERP_PRE_SAMPLES - 1 -
+        static_cast<double>(currentBuffer->getLengthInSamples()) - INTERP_POST_SAMPLES - INTERP_PRE_SAMPLES - 1 -
         quickfadeSamples, pointer);
     pointer = std::max(static_cast<double>(INTERP_PRE_SAMPLES), pointer);
     progress = 0;
@@ -89,6 +94,7 @@ void Grain::play(int sampleDelay) {
     quickfading = false;
     quickfadeGain = 1.f;
     firstBlockFlag = true;
+    mipLevel = -1;
 
     isLooping = false;
     loopFadePointer = -1;
@@ -108,7 +114,7 @@ int Grain::getSamplesUntilEndOfBuffer() const {
     if (settings.reverse) {
         s = (int) ((pointer - INTERP_PRE_SAMPLES) / maxPitchRatio);
     } else {
-        s = (int) ((currentBuffer->buffer.getNumSamples() - INTERP_POST_SAMPLES - pointer) / (maxPitchRatio));
+        s = (int) ((currentBuffer->getLengthInSamples() - INTERP_POST_SAMPLES - pointer) / (maxPitchRatio));
     }
 
     return s;
@@ -121,11 +127,56 @@ void Grain::updateLoopSettings(LoopSettings s, bool force) {
     else setNewLoopSettingsInternal(s);
 }
 
-void Grain::resetBuffer() { currentBuffer.reset(); }
+void Grain::resetBuffer() {
+    currentBuffer.reset();
+    bufferVariants = {};
+}
 
 void Grain::setBuffer(const std::shared_ptr<imagiro::InfoBuffer>& buf) {
-    if (buf == currentBuffer) return;
-    currentBuffer = buf;
+    if (buf == bufferVariants[0]) return;
+    setBufferVariants({buf});
+}
+
+void Grain::setBufferVariants(const BufferVariants& variants) {
+    const auto bufferChanged = variants[0] != bufferVariants[0];
+    bufferVariants = variants;
+
+    // A playing grain stays on its variant, new ones are picked up on the next play()
+    if (!bufferChanged) return;
+    currentBuffer = bufferVariants[0];
+
+    // Streamed buffers only hold their head, the rest is read through a streaming voice
+    streamingVoice.reset();
+    if (currentBuffer && currentBuffer->isStreamed()) {
+        if (!diskStreamer) diskStreamer.emplace();
+        streamingVoice = (*diskStreamer)->createVoice(currentBuffer->stream);
+    }
+}
+
+void Grain::selectBufferVariant() {
+    // Prefer a layout that plays forwards through memory, then one that needs no resampling,
+    // then one with guard samples for the branch-free interpolator
+    const auto score = [&](const imagiro::InfoBuffer& b) {
+        auto s = 0;
+        if (b.reversed == settings.reverse) s += 4;
+        if (juce::approximatelyEqual(b.sampleRate, sampleRate)) s += 2;
+        if (b.padStart >= INTERP_PRE_SAMPLES && b.padEnd >= INTERP_POST_SAMPLES) s += 1;
+        return s;
+    };
+
+    currentBuffer = bufferVariants[0];
+    auto bestScore = currentBuffer ? score(*currentBuffer) : -1;
+    for (size_t i = 1; i < bufferVariants.size(); i++) {
+        const auto& variant = bufferVariants[i];
+        // Only the plain buffer gets a streaming voice, and variants still loading aren't worth waiting on
+        if (!variant || variant->isStreamed() || !variant->isFullyLoaded()) continue;
+
+        const auto s = score(*variant);
+        if (s > bestScore) {
+            bestScore = s;
+            currentBuffer = variant;
+        }
+    }
 }
 
 void Grain::processBlock(juce::AudioSampleBuffer &out, int outStartSample, int numSamples, bool setNotAdd) {
@@ -202,60 +253,97 @@ void Grain::processBlock(juce::AudioSampleBuffer &out, int outStartSample, int n
                                       : samplesThisChunk;
         samplesThisChunk = std::min(samplesThisChunk, maxQuickfadeSamples);
 
-        // Ensure our buffer is large enough
+        // Ensure our buffers are large enough
         if (sampleDataBuffer.size() < static_cast<size_t>(samplesThisChunk)) {
             sampleDataBuffer.resize(samplesThisChunk);
         }
+        if (renderScratch.size() < static_cast<size_t>(samplesThisChunk)) {
+            allocateRenderScratch(samplesThisChunk);
+        }
 
         // Pre-calculate all position and loop data
         double pos = pointer;
         bool looping = isLooping;
-        for (int s = 0; s < samplesThisChunk; s++) {
-            auto pitchRatio = startPitchRatio + static_cast<float>(s) * pitchRatioPerSample;
-            pos += pitchRatio;
-
-            // Handle loop wrapping
-            if (isLoopActive) {
-                if (!isReverse && pos >= bounds.loopEndSample) {
-                    pos -= bounds.loopLengthSamples;
-                    pos += bounds.loopCrossfadeSamples;
-                    looping = false;
-                } else if (isReverse && pos <= bounds.loopStartSample) {
-                    pos += bounds.loopLengthSamples;
-                    pos -= bounds.loopCrossfadeSamples;
-                    looping = false;
-                }
+        const GrainSegmentPlanner::Ramp ramp {startPitchRatio, pitchRatioPerSample, samplesThisChunk};
+        GrainSegmentPlanner(bounds, isLoopActive, isReverse).plan(sampleDataBuffer.data(), ramp, pos, looping);
+
+        // Streamed buffers are read through the voice's ring buffer once we're past the resident head
+        StreamWindow mainWindow, fadeWindow;
+        const auto useStream = streamingVoice && currentBuffer->isStreamed() &&
+                               planStreamWindows(samplesThisChunk, isReverse, mainWindow, fadeWindow);
+
+        // Progressively loaded buffers can only be read up to what the loader has finished so far
+        auto notLoadedYet = false;
+        if (!useStream && currentBuffer->progress) {
+            const auto readySamples = currentBuffer->getReadySamples();
+            if (readySamples < currentBuffer->buffer.getNumSamples()) {
+                getReadWindows(samplesThisChunk, mainWindow, fadeWindow);
+                const auto padStart = currentBuffer->padStart;
+                notLoadedYet = padStart + mainWindow.start + mainWindow.length > readySamples ||
+                               (fadeWindow.length > 0 && padStart + fadeWindow.start + fadeWindow.length > readySamples);
+            }
+        }
 
-                // Check for loop fade start
-                if (!isReverse && pos - pitchRatio < bounds.loopFadeStart && pos >= bounds.loopFadeStart) {
-                    looping = true;
-                } else if (isReverse && pos - pitchRatio > bounds.loopFadeStartReverse && pos <= bounds.
-                           loopFadeStartReverse) {
-                    looping = true;
-                }
+        // The rest of the buffer failed to load and is never coming, so there's nothing left to play
+        if (notLoadedYet && currentBuffer->hasFailed()) {
+            if (setNotAdd) out.clear(outStartSample, numSamples);
+            stop(false);
+            return;
+        }
+
+        // Compact buffers are converted to float a window at a time
+        const auto useCompact = !useStream && currentBuffer->isCompact();
+        if (useCompact) getReadWindows(samplesThisChunk, mainWindow, fadeWindow);
+
+        // Positions are in the buffer's logical (unpadded, forwards) samples. Reversed layouts are read
+        // mirrored, so reverse grains walk forwards through memory.
+        const auto readReversed = currentBuffer->reversed && !useStream;
+        const auto readSign = readReversed ? -1.0 : 1.0;
+        const auto guarded = !useStream && !useCompact && currentBuffer->padStart >= 1;
+
+        // At high pitches read a decimated level instead (see imagiro::MipmapTransform), so the
+        // interpolator doesn't alias. A chunk that changes level fades over from the previous one.
+        const auto* mipmaps = !useStream && !useCompact ? currentBuffer->mipmaps.get() : nullptr;
+        const auto targetMipLevel = mipmaps
+            ? static_cast<int>(Mipmaps::getLevelForIncrement(std::max(std::abs(startPitchRatio), std::abs(endPitchRatio))))
+            : 0;
+        const auto previousMipLevel = mipmaps && mipLevel >= 0 ? mipLevel : targetMipLevel;
+        mipLevel = targetMipLevel;
+
+        // A quickfade that reaches zero ends the chunk at the first silent sample
+        auto renderSamples = samplesThisChunk;
+        if (quickfading) {
+            const auto quickfadeAt = [&](int s) { return quickfadeGainStart - quickfadeGainPerSample * static_cast<float>(s); };
+            auto silentFrom = static_cast<int>(quickfadeGainStart / quickfadeGainPerSample);
+            while (silentFrom > 0 && quickfadeAt(silentFrom - 1) <= 0.f) silentFrom--;
+            while (quickfadeAt(silentFrom) > 0.f) silentFrom++;
+            renderSamples = std::min(renderSamples, silentFrom);
+        }
+
+        // Window, gain, quickfade and pan are the same for every channel, so they're worked out once
+        // per chunk
+        for (int s = 0; s < renderSamples; s++) {
+            renderGains[static_cast<size_t>(s)] =
+                window.getGain(progress + static_cast<float>(s) * progressPerSample) * settings.gain;
+        }
+        if (quickfading) {
+            for (int s = 0; s < renderSamples; s++) {
+                renderGains[static_cast<size_t>(s)] *= quickfadeGainStart - quickfadeGainPerSample * static_cast<float>(s);
             }
+        }
 
-            sampleDataBuffer[s].position = pos;
-            sampleDataBuffer[s].looping = looping;
-
-
-            // Pre-calculate loop fade data if needed
-            if (looping && bounds.loopCrossfadeSamples > 0) {
-                if (!isReverse && pos >= bounds.loopFadeStart && pos <= bounds.loopEndSample + 1) {
-                    const auto distanceIntoFade = pos - bounds.loopFadeStart;
-                    sampleDataBuffer[s].loopFadePointer = bounds.loopStartSample + distanceIntoFade;
-                    sampleDataBuffer[s].loopFadeProgress = distanceIntoFade / bounds.loopCrossfadeSamples;
-                } else if (isReverse && pos >= bounds.loopStartSample - 1 && pos <= bounds.loopFadeStartReverse) {
-                    const auto distanceIntoFade = bounds.loopFadeStartReverse - pos;
-                    sampleDataBuffer[s].loopFadePointer = bounds.loopEndSample - distanceIntoFade;
-                    sampleDataBuffer[s].loopFadeProgress = distanceIntoFade / bounds.loopCrossfadeSamples;
-                } else {
-                    sampleDataBuffer[s].loopFadePointer = -1;
-                    sampleDataBuffer[s].loopFadeProgress = 0;
+        if (numBufferChannels > 1) {
+            if (panPerSample == 0.f) {
+                const auto* coeffs = calculatePanCoeffs(startPan + spreadVal);
+                for (size_t side = 0; side < 2; side++) {
+                    juce::FloatVectorOperations::multiply(panGains[side].data(), renderGains.data(), coeffs[side], renderSamples);
                 }
             } else {
-                sampleDataBuffer[s].loopFadePointer = -1;
-                sampleDataBuffer[s].loopFadeProgress = 0;
+                for (int s = 0; s < renderSamples; s++) {
+                    const auto* coeffs = calculatePanCoeffs(startPan + static_cast<float>(s) * panPerSample + spreadVal);
+                    panGains[0][static_cast<size_t>(s)] = renderGains[static_cast<size_t>(s)] * coeffs[0];
+                    panGains[1][static_cast<size_t>(s)] = renderGains[static_cast<size_t>(s)] * coeffs[1];
+                }
             }
         }
 
@@ -263,38 +351,109 @@ void Grain::processBlock(juce::AudioSampleBuffer &out, int outStartSample, int n
         for (int c = 0; c < numOutChannels; c++) {
             auto inChannel = c % numBufferChannels;
             auto stereoOutChannel = c % 2;
-            const auto* bufferPointer = currentBuffer->buffer.getReadPointer(inChannel);
+            const auto* bufferPointer = currentBuffer->buffer.getReadPointer(inChannel) + currentBuffer->padStart;
+            const auto* fadeBufferPointer = bufferPointer;
+            double readBase = readReversed ? currentBuffer->getLengthInSamples() - 1 : 0;
+            double fadeReadBase = readBase;
+
+            if (notLoadedYet) {
+                if (setNotAdd) out.clear(c, outStartSample, samplesThisChunk);
+                continue;
+            }
 
-            for (int s = 0; s < samplesThisChunk; s++) {
-                const auto &sample = sampleDataBuffer[s];
+            if (useStream) {
+                auto* mainScratch = streamScratch.data();
+                auto* fadeScratch = streamScratch.data() + streamScratch.size() / 2;
+                const auto readWindow = [&](const StreamWindow& w, float* dest) {
+                    // Too big for the scratch space (pitched up past 8x), counted like any other underrun
+                    if (w.length > static_cast<int>(streamScratch.size() / 2)) {
+                        streamingVoice->reportUnderrun();
+                        return false;
+                    }
+                    return streamingVoice->readWindow(inChannel, w.start, w.length, dest);
+                };
+
+                const auto mainOk = readWindow(mainWindow, mainScratch);
+                const auto fadeOk = fadeWindow.length == 0 || readWindow(fadeWindow, fadeScratch);
+
+                // Underrun - output silence rather than stale samples
+                if (!mainOk || !fadeOk) {
+                    if (setNotAdd) out.clear(c, outStartSample, samplesThisChunk);
+                    continue;
+                }
 
-                auto v = interp4p3o_2x(bufferPointer, sample.position);
+                bufferPointer = mainScratch;
+                readBase = -static_cast<double>(mainWindow.start);
+                if (fadeWindow.length > 0) {
+                    fadeBufferPointer = fadeScratch;
+                    fadeReadBase = -static_cast<double>(fadeWindow.start);
+                }
+            } else if (useCompact) {
+                auto* mainScratch = streamScratch.data();
+                auto* fadeScratch = streamScratch.data() + streamScratch.size() / 2;
+                const auto capacity = static_cast<int>(streamScratch.size() / 2);
+
+                // Window too big for the scratch space (pitched up past 8x) - output silence
+                if (!decodeCompactWindow(inChannel, mainWindow, mainScratch, capacity, readBase) ||
+                    (fadeWindow.length > 0 &&
+                     !decodeCompactWindow(inChannel, fadeWindow, fadeScratch, capacity, fadeReadBase))) {
+                    if (setNotAdd) out.clear(c, outStartSample, samplesThisChunk);
+                    continue;
+                }
 
-                // Apply loop crossfade if needed
-                if (sample.loopFadePointer >= 0) {
-                    const auto fadeSample = interp4p3o_2x(bufferPointer,
-                                                                   static_cast<float>(sample.loopFadePointer));
-                    v = v * (1 - sample.loopFadeProgress) + fadeSample * sample.loopFadeProgress;
+                bufferPointer = mainScratch;
+                if (fadeWindow.length > 0) fadeBufferPointer = fadeScratch;
+            }
+
+            // Interpolate the whole chunk from one level, then apply the loop crossfade where there is one
+            const auto renderLevel = [&](int level, float* dest) {
+                const auto* levelPointer = bufferPointer;
+                const auto* levelFadePointer = fadeBufferPointer;
+                auto scale = 1.0;
+                if (level > 0) {
+                    // Levels have no guard samples, and sample n is sample n * decimation of the content
+                    levelPointer = levelFadePointer = mipmaps->getReadPointer(static_cast<size_t>(level), inChannel);
+                    scale = 1.0 / Mipmaps::getDecimation(static_cast<size_t>(level));
+                }
+                const auto levelGuarded = guarded && level == 0;
+
+                auto* indices = readIndices.data();
+                for (int s = 0; s < renderSamples; s++) {
+                    indices[s] = (readBase + readSign * sampleDataBuffer[s].position) * scale;
                 }
 
-                // Apply window function
-                v *= windowFunction.processSampleUnchecked(progress + static_cast<float>(s) * progressPerSample);
-                v *= settings.gain;
+                // Guard samples make the edge check unnecessary
+                if (levelGuarded) imagiro::interp4p3o_2x_block<true>(levelPointer, indices, dest, renderSamples);
+                else imagiro::interp4p3o_2x_block<false>(levelPointer, indices, dest, renderSamples);
+
+                for (int s = 0; s < renderSamples; s++) {
+                    const auto &sample = sampleDataBuffer[s];
+                    if (sample.loopFadePointer < 0) continue;
 
-                // Apply quickfade
-                if (quickfading) {
-                    const auto quickfadeAmount = quickfadeGainStart - quickfadeGainPerSample * static_cast<float>(s);
-                    if (quickfadeAmount <= 0.f) break;
-                    v *= quickfadeAmount;
+                    const auto fadeIndex = (fadeReadBase + readSign * sample.loopFadePointer) * scale;
+                    const auto fadeSample = levelGuarded ? imagiro::interp4p3o_2x_guarded(levelFadePointer, fadeIndex)
+                                                         : imagiro::interp4p3o_2x(levelFadePointer, fadeIndex);
+                    dest[s] = dest[s] * (1 - sample.loopFadeProgress) + fadeSample * sample.loopFadeProgress;
                 }
+            };
 
-                // Apply panning
-                const auto pan = startPan + static_cast<float>(s) * panPerSample;
-                v *= numBufferChannels > 1 ? calculatePanCoeffs(pan + spreadVal)[stereoOutChannel] : 1.f;
+            auto* rendered = renderScratch.data();
+            renderLevel(targetMipLevel, rendered);
 
-                if (setNotAdd) out.setSample(c, outStartSample + s, v);
-                else out.addSample(c, outStartSample + s, v);
+            if (previousMipLevel != targetMipLevel) {
+                auto* previous = levelFadeScratch.data();
+                renderLevel(previousMipLevel, previous);
+                for (int s = 0; s < renderSamples; s++) {
+                    const auto t = static_cast<float>(s + 1) / static_cast<float>(renderSamples);
+                    rendered[s] = previous[s] + (rendered[s] - previous[s]) * t;
+                }
             }
+
+            const auto* gains = numBufferChannels > 1 ? panGains[static_cast<size_t>(stereoOutChannel)].data()
+                                                      : renderGains.data();
+            auto* destination = out.getWritePointer(c, outStartSample);
+            if (setNotAdd) juce::FloatVectorOperations::multiply(destination, rendered, gains, renderSamples);
+            else juce::FloatVectorOperations::addWithMultiply(destination, rendered, gains, renderSamples);
         }
 
         // Update grain state with final values
@@ -329,6 +488,70 @@ void Grain::processBlock(juce::AudioSampleBuffer &out, int outStartSample, int n
 }
 
 
+void Grain::getReadWindows(int numSamples, StreamWindow& mainWindow, StreamWindow& fadeWindow) const {
+    auto minPos = std::numeric_limits<double>::max();
+    auto maxPos = std::numeric_limits<double>::lowest();
+    auto minFade = std::numeric_limits<double>::max();
+    auto maxFade = std::numeric_limits<double>::lowest();
+
+    for (int s = 0; s < numSamples; s++) {
+        const auto& sample = sampleDataBuffer[s];
+        minPos = std::min(minPos, sample.position);
+        maxPos = std::max(maxPos, sample.position);
+        if (sample.loopFadePointer >= 0) {
+            minFade = std::min(minFade, sample.loopFadePointer);
+            maxFade = std::max(maxFade, sample.loopFadePointer);
+        }
+    }
+
+    // The interpolator reads one sample behind and two ahead of each position
+    const auto toWindow = [](double lo, double hi) {
+        StreamWindow w;
+        w.start = std::max<juce::int64>(0, static_cast<juce::int64>(lo) - 1);
+        w.length = static_cast<int>(static_cast<juce::int64>(hi) + 3 - w.start);
+        return w;
+    };
+
+    mainWindow = toWindow(minPos, maxPos);
+    fadeWindow = maxFade >= 0 ? toWindow(minFade, maxFade) : StreamWindow{};
+}
+
+bool Grain::planStreamWindows(int numSamples, bool reverse, StreamWindow& mainWindow, StreamWindow& fadeWindow) {
+    getReadWindows(numSamples, mainWindow, fadeWindow);
+
+    // Always publish where we are, so the ring is filled before we leave the head
+    streamingVoice->requestWindow(mainWindow.start, mainWindow.start + mainWindow.length, reverse);
+
+    const auto headLength = currentBuffer->buffer.getNumSamples();
+    return mainWindow.start + mainWindow.length > headLength ||
+           (fadeWindow.length > 0 && fadeWindow.start + fadeWindow.length > headLength);
+}
+
+bool Grain::decodeCompactWindow(int channel, const StreamWindow& window, float* destination, int capacity,
+                                double& readBase) const {
+    const auto& compact = *currentBuffer->compact;
+    const auto padStart = currentBuffer->padStart;
+    const auto length = currentBuffer->getLengthInSamples();
+
+    // Logical window, with room for the interpolator's neighbours whichever way it's stored
+    const auto lo = window.start - 2;
+    const auto hi = window.start + window.length + 2;
+
+    auto start = currentBuffer->reversed ? padStart + length - hi : padStart + lo;
+    auto end = currentBuffer->reversed ? padStart + length - lo : padStart + hi;
+    start = std::max<juce::int64>(0, start);
+    end = std::min<juce::int64>(compact.getNumSamples(), end);
+    if (end - start > capacity) return false;
+
+    if (end > start) compact.toFloat(channel, static_cast<int>(start), static_cast<int>(end - start), destination);
+    readBase = static_cast<double>(padStart + (currentBuffer->reversed ? length - 1 : 0) - start);
+    return true;
+}
+
+int Grain::getStreamUnderruns() const {
+    return streamingVoice ? streamingVoice->getUnderrunCount() : 0;
+}
+
 void Grain::updateSampleRateRatio() {
     if (!currentBuffer) return;
     sampleRateRatio = currentBuffer->sampleRate / sampleRate;
@@ -338,7 +561,7 @@ void Grain::setNewLoopSettingsInternal(const LoopSettings loopSettings) {
     settings.loopSettings = loopSettings;
 
     // check if we've just gone over the current position
-    const auto bufferLength = currentBuffer->buffer.getNumSamples();
+    const auto bufferLength = currentBuffer->getLengthInSamples();
     const auto loopStartSample = settings.loopSettings.getLoopStartSample(bufferLength);
     const auto loopCrossfadeSamples = settings.loopSettings.getCrossfadeSamples(bufferLength);
     const auto loopEndSample = settings.loopSettings.getLoopEndSample(bufferLength);
@@ -350,7 +573,7 @@ void Grain::setNewLoopSettingsInternal(const LoopSettings loopSettings) {
     // adding a little padding to compensate for float rounding
     const auto nextPointerPos = pointer + getCurrentPitchRatio();
     constexpr auto bufferStart = INTERP_PRE_SAMPLES;
-    const auto bufferEnd = currentBuffer->buffer.getNumSamples() - 1 - INTERP_POST_SAMPLES;
+    const auto bufferEnd = currentBuffer->getLengthInSamples() - 1 - INTERP_POST_SAMPLES;
 
     if (!settings.reverse) {
         auto minLoopEnd = std::min(bufferEnd, static_cast<int>(nextPointerPos + loopCrossfadeSamples));
@@ -405,11 +628,24 @@ void Grain::prepareToPlay(double sr, int maxBlockSize) {
     smoothedPan.reset(sr, 0.01);
 
     quickfadeSamples = static_cast<int>(quickfadeSeconds * (float) sr);
+
+    // room for two windows of a block played back at up to 8x speed
+    streamScratch.resize(static_cast<size_t>(2 * (maxBlockSize * 8 + 16)));
+    allocateRenderScratch(maxBlockSize);
     quickfadeGainPerSample = 1.f / static_cast<float>(quickfadeSamples);
 }
 
+void Grain::allocateRenderScratch(int numSamples) {
+    const auto size = static_cast<size_t>(numSamples);
+    readIndices.resize(size);
+    renderScratch.resize(size);
+    levelFadeScratch.resize(size);
+    renderGains.resize(size);
+    for (auto& side : panGains) side.resize(size);
+}
+
 void Grain::updateCachedLoopBoundaries() {
-    const auto numSamples = currentBuffer->buffer.getNumSamples();
+    const auto numSamples = currentBuffer->getLengthInSamples();
     cachedLoopBoundaries.loopStartSample = settings.loopSettings.getLoopStartSample(numSamples);
     cachedLoopBoundaries.loopEndSample = settings.loopSettings.getLoopEndSample(numSamples);
     cachedLoopBoundaries.loopCrossfadeSamples = settings.loopSettings.getCrossfadeSamples(numSamples);
@@ -417,26 +653,3 @@ void Grain::updateCachedLoopBoundaries() {
     cachedLoopBoundaries.loopFadeStartReverse = settings.loopSettings.getReverseCrossfadeStartSample(numSamples);
     cachedLoopBoundaries.loopLengthSamples = settings.loopSettings.getLoopLengthSamples(numSamples);
 }
-
-float Grain::getGrainShapeGain(float p, float sym, float skew) {
-    if (skew < 0)
-        p = pow(p, fastexp(skew));
-    else if (skew > 0) {
-        p = pow(1 - p, fastexp(-skew));
-    }
-
-    auto alphaStart = std::max(1 - sym, 0.001f);
-    auto alphaEnd = alphaStart;
-    auto pInv = 1 - p;
-
-    float v;
-    if (2 * pInv <= alphaEnd) {
-        v = 0.5f * (1 - fastcos((juce::MathConstants<float>::twoPi * pInv) / alphaEnd));
-    } else if (2 * p <= alphaStart) {
-        v = 0.5f * (1 - fastcos((juce::MathConstants<float>::twoPi * p) / alphaStart));
-    } else v = 1.f;
-
-    jassert(!std::isnan(v));
-
-    return v;
-}
@@ -7,7 +7,10 @@
 #include <juce_dsp/juce_dsp.h>
 
 #include "GrainSampleData.h"
+#include "GrainSegmentPlanner.h"
+#include "GrainWindowBank.h"
 #include "imagiro_processor/bufferpool/InfoBuffer.h"
+#include "imagiro_processor/bufferpool/DiskStreamer.h"
 
 class Grain {
 public:
@@ -65,7 +68,7 @@ public:
         else smoothPitchRatio.setTargetValue(settings.getPitchRatio());
     }
 
-    float getCurrentGain() const { return settings.gain * windowFunction(progress); }
+    float getCurrentGain() const { return settings.gain * window.getGain(progress); }
     float getCurrentPitchRatio() const { return smoothPitchRatio.getCurrentValue(); }
     size_t getIndexInStream() const { return indexInStream; }
 
@@ -74,8 +77,19 @@ public:
 
     void resetBuffer();
 
+    // Not audio thread safe for streamed buffers - a streaming voice is created for them.
+    // Buffers aren't pinned here (see InfoBuffer::pin()), hold them through a BufferRequestHandle.
     void setBuffer(const std::shared_ptr<imagiro::InfoBuffer>& buf);
-    const std::shared_ptr<imagiro::InfoBuffer>& getBuffer() { return currentBuffer; }
+    const std::shared_ptr<imagiro::InfoBuffer>& getBuffer() { return bufferVariants[0]; }
+
+    // Alternative layouts of the same audio (see PadTransform, ReverseTransform and ResampleTransform),
+    // with the plain buffer first. play() picks whichever suits the grain best.
+    static constexpr int maxBufferVariants = 4;
+    using BufferVariants = std::array<std::shared_ptr<imagiro::InfoBuffer>, maxBufferVariants>;
+    void setBufferVariants(const BufferVariants& variants);
+
+    // Number of blocks that couldn't be streamed from disk in time
+    int getStreamUnderruns() const;
 
 private:
     const size_t indexInStream;
@@ -84,24 +98,14 @@ private:
     bool isLooping;
     std::optional<LoopSettings> queuedLoopSettings;
 
-    struct CachedLoopBoundaries {
-        int loopStartSample = 0;
-        int loopEndSample = 0;
-        int loopCrossfadeSamples = 0;
-        int loopFadeStart = 0;
-        int loopFadeStartReverse = 0;
-        int loopLengthSamples = 0;
-    } cachedLoopBoundaries;
+    GrainSegmentPlanner::LoopBounds cachedLoopBoundaries;
     void updateCachedLoopBoundaries();
 
     std::vector<GrainSampleData>& sampleDataBuffer;
 
-    juce::dsp::LookupTableTransform<float> sinApprox {
-        [] (const float x) { return std::sin(x); },
-        -6.5f, 6.5f, 80};
-
-    juce::dsp::LookupTableTransform<float> windowFunction;
-    static float getGrainShapeGain(float p, float sym, float skew);
+    // Points into the shared bank, set when the grain starts
+    juce::SharedResourcePointer<GrainWindowBank> windowBank;
+    GrainWindowBank::Window window;
 
     float getGrainSpeed() const;
 
@@ -111,7 +115,38 @@ private:
     float cachedPan {0};
     float spreadVal {0};
 
+    // The buffer being played, one of bufferVariants
     std::shared_ptr<imagiro::InfoBuffer> currentBuffer;
+    BufferVariants bufferVariants;
+    void selectBufferVariant();
+
+    // Pyramid level read in the last chunk (see InfoBuffer::mipmaps), or -1 before the first
+    using Mipmaps = imagiro::InfoBuffer::Mipmaps;
+    int mipLevel {-1};
+
+    // Disk streaming
+    std::optional<juce::SharedResourcePointer<imagiro::DiskStreamer>> diskStreamer;
+    std::shared_ptr<imagiro::StreamingVoice> streamingVoice;
+    std::vector<float> streamScratch; // also holds windows converted from compact buffers
+
+    // Per chunk scratch for the block renderer (see processBlock())
+    std::vector<double> readIndices;
+    std::vector<float> renderScratch;
+    std::vector<float> levelFadeScratch;           // the previous mipmap level, while fading from it
+    std::vector<float> renderGains;                // window, gain and quickfade
+    std::array<std::vector<float>, 2> panGains;    // renderGains with each side's pan applied
+    void allocateRenderScratch(int numSamples);
+
+    struct StreamWindow {
+        juce::int64 start {0};
+        int length {0};
+    };
+    // Range of samples the interpolator will touch for the next numSamples
+    void getReadWindows(int numSamples, StreamWindow& mainWindow, StreamWindow& fadeWindow) const;
+    bool planStreamWindows(int numSamples, bool reverse, StreamWindow& mainWindow, StreamWindow& fadeWindow);
+    // Convert a window of a compact buffer to float, setting the read base for positions in it
+    bool decodeCompactWindow(int channel, const StreamWindow& window, float* destination, int capacity,
+                             double& readBase) const;
 
     GrainSettings settings;
 
@@ -0,0 +1,280 @@
+//
+// Many lightweight grains playing from one buffer.
+//
+#include "GrainCloud.h"
+
+void GrainCloud::prepareToPlay(double sr, int blockSize, int maxGrains, int numChannels) {
+    sampleRate = sr;
+    maxBlockSize = blockSize;
+    numOutputChannels = numChannels;
+    capacity = static_cast<uint32_t>(std::max(0, maxGrains));
+    if (buffer) sampleRateRatio = buffer->sampleRate / sampleRate;
+
+    const auto n = static_cast<size_t>(capacity);
+    position.assign(n, 0);
+    increment.assign(n, 0);
+    phase.assign(n, 0);
+    phasePerSample.assign(n, 0);
+    gain.assign(n, 0);
+    panGains.assign(n, {1.f, 1.f});
+    delay.assign(n, 0);
+    windows.assign(n, windowBank->getFlatWindow());
+    spawnSettings.assign(n, {});
+
+    active.clear();
+    active.reserve(n);
+    finished.assign(n, 0);
+    numFinished = 0;
+
+    // Every slot starts free, linked in order
+    next = std::vector<std::atomic<uint32_t>>(n);
+    for (uint32_t i = 0; i < capacity; i++) next[i].store(i + 1 < capacity ? i + 1 : endOfList, std::memory_order_relaxed);
+    freeHead.store(capacity > 0 ? 0 : endOfList, std::memory_order_release);
+    pendingHead.store(endOfList, std::memory_order_release);
+
+    allocateParts();
+}
+
+void GrainCloud::setRenderPool(GrainRenderPool* pool) {
+    renderPool = pool;
+    allocateParts();
+}
+
+void GrainCloud::allocateParts() {
+    parts.resize(renderPool ? maxParts : 1);
+
+    const auto blockSize = static_cast<size_t>(maxBlockSize);
+    for (auto& part : parts) {
+        part.readIndices.resize(blockSize);
+        part.rendered.resize(blockSize);
+        part.renderGains.resize(blockSize);
+    }
+
+    // Only needed when the cloud is split (parts.size() > 1)
+    for (auto& part : parts) part.accumulator.setSize(parts.size() > 1 ? numOutputChannels : 0, maxBlockSize);
+}
+
+void GrainCloud::setBuffer(const std::shared_ptr<imagiro::InfoBuffer>& buf) {
+    if (buf == buffer) return;
+
+    if (buf && (buf->isCompact() || buf->isStreamed())) {
+        jassertfalse; // only resident float buffers can be played by a cloud
+        return;
+    }
+
+    stopAll();
+    buffer = buf;
+    if (buffer && sampleRate > 0) sampleRateRatio = buffer->sampleRate / sampleRate;
+}
+
+bool GrainCloud::spawn(const GrainSettings& settings, int sampleDelay) {
+    const auto slot = popFree();
+    if (slot == endOfList) return false;
+
+    spawnSettings[slot] = settings;
+    delay[slot] = std::max(0, sampleDelay);
+
+    // Hand the slot to the renderer, releasing what was written above
+    auto head = pendingHead.load(std::memory_order_relaxed);
+    do {
+        next[slot].store(head, std::memory_order_relaxed);
+    } while (!pendingHead.compare_exchange_weak(head, slot, std::memory_order_release, std::memory_order_relaxed));
+
+    return true;
+}
+
+uint32_t GrainCloud::popFree() {
+    auto head = freeHead.load(std::memory_order_acquire);
+    while (true) {
+        const auto slot = static_cast<uint32_t>(head);
+        if (slot == endOfList) return endOfList;
+
+        const auto tag = head >> 32;
+        const auto newHead = (tag << 32) | next[slot].load(std::memory_order_relaxed);
+        if (freeHead.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire)) return slot;
+    }
+}
+
+void GrainCloud::pushFree(uint32_t slot) {
+    auto head = freeHead.load(std::memory_order_relaxed);
+    while (true) {
+        next[slot].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        const auto newHead = (((head >> 32) + 1) << 32) | slot;
+        if (freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed)) return;
+    }
+}
+
+void GrainCloud::startPending() {
+    auto slot = pendingHead.exchange(endOfList, std::memory_order_acquire);
+
+    // The list is newest first, so reverse it to start grains in the order they were spawned
+    auto firstNew = active.size();
+    for (; slot != endOfList; slot = next[slot].load(std::memory_order_relaxed)) active.push_back(slot);
+    std::reverse(active.begin() + static_cast<std::ptrdiff_t>(firstNew), active.end());
+
+    for (auto i = firstNew; i < active.size(); i++) startGrain(active[i]);
+}
+
+void GrainCloud::startGrain(uint32_t slot) {
+    const auto& settings = spawnSettings[slot];
+    const auto length = static_cast<double>(buffer ? buffer->getLengthInSamples() : 0);
+
+    // Same spawn position and limits as Grain::play()
+    auto pos = std::clamp(static_cast<double>(settings.position), 0.0, 1.0) * length;
+    pos = std::min(length - INTERP_POST_SAMPLES - INTERP_PRE_SAMPLES - 1, pos);
+    position[slot] = std::max(static_cast<double>(INTERP_PRE_SAMPLES), pos);
+
+    increment[slot] = settings.getPitchRatio() * sampleRateRatio;
+    phase[slot] = 0;
+    gain[slot] = settings.gain;
+
+    if (settings.duration < 0) {
+        phasePerSample[slot] = 0;
+        windows[slot] = windowBank->getFlatWindow();
+    } else {
+        phasePerSample[slot] = 1.f / (settings.duration * static_cast<float>(sampleRate));
+        windows[slot] = windowBank->getWindow(settings.shape, settings.skew);
+    }
+
+    const auto pan = settings.pan + (random.nextFloat01() * 2 - 1) * settings.spread;
+    panGains[slot] = {std::sin((1 - pan) * juce::MathConstants<float>::halfPi),
+                      std::sin(pan * juce::MathConstants<float>::halfPi)};
+}
+
+void GrainCloud::stopAll() {
+    startPending();
+    for (const auto slot : active) pushFree(slot);
+    numFinished += active.size();
+    active.clear();
+}
+
+void GrainCloud::processBlock(juce::AudioSampleBuffer& out, int startSample, int numSamples) {
+    startPending();
+    if (!buffer) {
+        stopAll();
+        return;
+    }
+
+    // Grains wait for a buffer that's still loading, rather than read what isn't there yet
+    if (!buffer->isFullyLoaded()) return;
+
+    for (int done = 0; done < numSamples;) {
+        const auto n = std::min(numSamples - done, maxBlockSize);
+        renderBlock(out, startSample + done, n);
+        done += n;
+    }
+}
+
+void GrainCloud::renderBlock(juce::AudioSampleBuffer& out, int startSample, int numSamples) {
+    const auto numActive = active.size();
+    auto numParts = std::min(parts.size(), numActive / minGrainsPerPart);
+    if (out.getNumChannels() != numOutputChannels) numParts = 1;
+
+    if (numParts <= 1) {
+        for (size_t i = 0; i < numActive; i++) finished[i] = !renderGrain(active[i], out, startSample, numSamples, parts[0]);
+    } else {
+        auto renderPart = [&](int part) {
+            auto& scratch = parts[static_cast<size_t>(part)];
+            scratch.accumulator.clear(0, numSamples);
+
+            const auto begin = numActive * static_cast<size_t>(part) / numParts;
+            const auto end = numActive * static_cast<size_t>(part + 1) / numParts;
+            for (auto i = begin; i < end; i++) {
+                finished[i] = !renderGrain(active[i], scratch.accumulator, 0, numSamples, scratch);
+            }
+        };
+        renderPool->run(static_cast<int>(numParts), renderPart);
+
+        // Always summed in the same order, whichever threads rendered the parts
+        for (size_t part = 0; part < numParts; part++) {
+            for (int c = 0; c < out.getNumChannels(); c++) {
+                juce::FloatVectorOperations::add(out.getWritePointer(c, startSample),
+                                                 parts[part].accumulator.getReadPointer(c), numSamples);
+            }
+        }
+    }
+
+    // Keep the grains that are still playing in the order they started, so the parts stay the same
+    size_t numKept = 0;
+    for (size_t i = 0; i < numActive; i++) {
+        if (finished[i]) pushFree(active[i]);
+        else active[numKept++] = active[i];
+    }
+    numFinished += numActive - numKept;
+    active.resize(numKept);
+}
+
+bool GrainCloud::renderGrain(uint32_t slot, juce::AudioSampleBuffer& out, int startSample, int numSamples,
+                             RenderScratch& scratch) {
+    auto& samplesUntilStart = delay[slot];
+    if (samplesUntilStart >= numSamples) {
+        samplesUntilStart -= numSamples;
+        return true;
+    }
+    startSample += samplesUntilStart;
+    numSamples -= samplesUntilStart;
+    samplesUntilStart = 0;
+
+    auto pos = position[slot];
+    auto p = phase[slot];
+    const auto inc = increment[slot];
+    const auto pps = phasePerSample[slot];
+
+    // Samples left before the window closes or reading would pass the end of the buffer
+    const auto length = buffer->getLengthInSamples();
+    auto remaining = numSamples;
+    if (pps > 0) remaining = std::min(remaining, static_cast<int>((1 - p) / pps));
+    if (inc > 0) remaining = std::min(remaining, static_cast<int>(std::max(0.0, (length - INTERP_POST_SAMPLES - 1 - pos) / inc)));
+    if (inc < 0) remaining = std::min(remaining, static_cast<int>(std::max(0.0, (pos - INTERP_PRE_SAMPLES) / -inc)));
+
+    const auto numBufferChannels = buffer->buffer.getNumChannels();
+    const auto numOutChannels = out.getNumChannels();
+    const auto guarded = buffer->padStart >= INTERP_PRE_SAMPLES && buffer->padEnd >= INTERP_POST_SAMPLES;
+
+    // Positions are in playback order, buffers from ReverseTransform are stored back to front
+    const auto readSign = buffer->reversed ? -1.0 : 1.0;
+    const auto readBase = buffer->reversed ? static_cast<double>(length - 1) : 0.0;
+
+    const auto& window = windows[slot];
+    const auto g = gain[slot];
+
+    // Blocks are never longer than the scratch space, see processBlock()
+    auto* readIndices = scratch.readIndices.data();
+    auto* rendered = scratch.rendered.data();
+    auto* renderGains = scratch.renderGains.data();
+    const auto n = remaining;
+
+    for (int s = 0; s < n; s++) {
+        readIndices[s] = readBase + readSign * (pos + static_cast<double>(s + 1) * inc);
+        renderGains[s] = window.getGain(p + static_cast<float>(s) * pps) * g;
+    }
+
+    // As with Grain, pan only applies to multichannel buffers
+    int renderedChannel = -1;
+    for (int c = 0; c < numOutChannels && n > 0; c++) {
+        const auto inChannel = c % numBufferChannels;
+        if (inChannel != renderedChannel) {
+            const auto* in = buffer->buffer.getReadPointer(inChannel) + buffer->padStart;
+            if (guarded) imagiro::interp4p3o_2x_block<true>(in, readIndices, rendered, n);
+            else imagiro::interp4p3o_2x_block<false>(in, readIndices, rendered, n);
+            juce::FloatVectorOperations::multiply(rendered, renderGains, n);
+            renderedChannel = inChannel;
+        }
+
+        auto* destination = out.getWritePointer(c, startSample);
+        if (numBufferChannels > 1) {
+            juce::FloatVectorOperations::addWithMultiply(destination, rendered, panGains[slot][static_cast<size_t>(c % 2)], n);
+        } else {
+            juce::FloatVectorOperations::add(destination, rendered, n);
+        }
+    }
+
+    pos += static_cast<double>(n) * inc;
+    p += static_cast<float>(n) * pps;
+
+    position[slot] = pos;
+    phase[slot] = p;
+
+    // Stopped short by the window or the buffer, or the window ends before the next sample
+    return remaining == numSamples && !(pps > 0 && p + pps >= 1);
+}
@@ -0,0 +1,132 @@
+//
+// Many lightweight grains playing from one buffer.
+//
+
+#pragma once
+#include "GrainSettings.h"
+#include "GrainRenderPool.h"
+#include "GrainWindowBank.h"
+#include <juce_audio_basics/juce_audio_basics.h>
+
+#include <atomic>
+#include "imagiro_processor/bufferpool/InfoBuffer.h"
+#include "imagiro_processor/dsp/FastRandom.h"
+
+// A Grain carries its own listeners, smoothers, lookup tables and loop handling, which limits a voice
+// to a few dozen of them. A GrainCloud keeps only what a simple grain needs (position, increment,
+// window phase, gain and pan) in one array per field, and renders every active grain of its buffer
+// in one pass, so a voice can run thousands.
+//
+// Grains are kept in a fixed number of slots. spawn() takes a slot from a lock-free free list and
+// hands it to the renderer through a lock-free pending list, so any thread can spawn without
+// blocking the audio thread. processBlock() starts pending grains and gives finished ones' slots
+// back to the free list.
+//
+// With a render pool, a cloud with enough grains splits them into up to maxParts parts, each
+// rendered into an accumulator of its own on whichever thread takes it, and adds the accumulators
+// to the output in order. The split only depends on the number of grains, so the output is the same
+// however many workers the pool has or were free.
+//
+// Cloud grains don't loop.
+class GrainCloud {
+public:
+    GrainCloud() = default;
+    GrainCloud(const GrainCloud&) = delete;
+
+    // Allocates room for maxGrains, stopping any playing grains. Not realtime safe.
+    void prepareToPlay(double sampleRate, int maxBlockSize, int maxGrains, int numOutputChannels = 2);
+
+    // Share rendering with a pool's workers (nullptr to render on the audio thread only). Not
+    // realtime safe.
+    void setRenderPool(GrainRenderPool* pool);
+
+    // Resident float buffers only (not compact or streamed), stored either way round. Stops every
+    // grain, so call it from the audio thread or while nothing is rendering.
+    void setBuffer(const std::shared_ptr<imagiro::InfoBuffer>& buf);
+
+    // Start a grain delay samples into the next block. position, duration, gain, pitch, pan, spread,
+    // shape, skew and reverse are used from the settings. Safe from any thread; returns false if
+    // every slot is in use.
+    bool spawn(const GrainSettings& settings, int delay = 0);
+
+    // Add the active grains to out. Audio thread only.
+    void processBlock(juce::AudioSampleBuffer& out, int startSample, int numSamples);
+
+    // Stop every grain at once. Audio thread only.
+    void stopAll();
+
+    int getNumActiveGrains() const { return static_cast<int>(active.size()); }
+    int getMaxGrains() const { return static_cast<int>(capacity); }
+
+    // Grains that have finished or been stopped since prepareToPlay(). Audio thread only.
+    uint64_t getNumFinishedGrains() const { return numFinished; }
+
+private:
+    double sampleRate {0};
+    int maxBlockSize {0};
+    uint32_t capacity {0};
+
+    std::shared_ptr<imagiro::InfoBuffer> buffer;
+    double sampleRateRatio {1};
+
+    juce::SharedResourcePointer<GrainWindowBank> windowBank;
+
+    // Grain state, indexed by slot
+    std::vector<double> position;       // in samples, read at position + increment for the first sample
+    std::vector<double> increment;      // per output sample, negative for reverse
+    std::vector<float> phase;           // 0-1 through the window
+    std::vector<float> phasePerSample;
+    std::vector<float> gain;
+    std::vector<std::array<float, 2>> panGains;
+    std::vector<int> delay;
+    std::vector<GrainWindowBank::Window> windows;
+
+    // Written by spawn() and read when the grain starts, as the buffer isn't known until then
+    std::vector<GrainSettings> spawnSettings;
+
+    // Slots being rendered, in the order they started
+    std::vector<uint32_t> active;
+    uint64_t numFinished {0};
+
+    // Free and pending slots are linked through next, each slot being in at most one list. The free
+    // list head carries a tag in the top half that changes on every push, so a pop can't succeed
+    // with a stale next (ABA). Pending slots are only ever taken all at once, so need no tag.
+    static constexpr uint32_t endOfList = std::numeric_limits<uint32_t>::max();
+    std::vector<std::atomic<uint32_t>> next;
+    std::atomic<uint64_t> freeHead {endOfList};
+    std::atomic<uint32_t> pendingHead {endOfList};
+
+    uint32_t popFree();
+    void pushFree(uint32_t slot);
+    void startPending();
+    void startGrain(uint32_t slot);
+
+    imagiro::FastRandom random;
+
+    // Per chunk scratch, as in Grain::processBlock(), and the accumulator for one part of a split cloud
+    struct RenderScratch {
+        std::vector<double> readIndices;
+        std::vector<float> rendered;
+        std::vector<float> renderGains;
+        juce::AudioSampleBuffer accumulator;
+    };
+    std::vector<RenderScratch> parts; // the first is also used when rendering in one pass
+    void allocateParts();
+
+    GrainRenderPool* renderPool {nullptr};
+    int numOutputChannels {2};
+
+    // Fixed rather than taken from the pool, so the split doesn't depend on the machine. Fewer grains
+    // than minGrainsPerPart in a part aren't worth handing to another thread.
+    static constexpr size_t maxParts = 8;
+    static constexpr size_t minGrainsPerPart = 32;
+
+    // Whether each active grain finished during the block, by its index in active
+    std::vector<uint8_t> finished;
+
+    void renderBlock(juce::AudioSampleBuffer& out, int startSample, int numSamples);
+
+    // Renders up to numSamples of one grain, returning false once it has finished
+    bool renderGrain(uint32_t slot, juce::AudioSampleBuffer& out, int startSample, int numSamples,
+                     RenderScratch& scratch);
+};
@@ -0,0 +1,64 @@
+//
+// Worker threads that help the audio thread render grains.
+//
+#include "GrainRenderPool.h"
+
+GrainRenderPool::GrainRenderPool(int numWorkers) {
+    for (int i = 0; i < numWorkers; i++) {
+        workers.push_back(std::make_unique<Worker>(*this));
+        if (!workers.back()->startRealtimeThread(juce::Thread::RealtimeOptions{}.withPriority(8))) {
+            workers.back()->startThread(juce::Thread::Priority::highest);
+        }
+    }
+}
+
+GrainRenderPool::~GrainRenderPool() {
+    for (auto& worker : workers) worker->signalThreadShouldExit();
+    wakeWorkers.release(static_cast<std::ptrdiff_t>(workers.size()));
+    for (auto& worker : workers) worker->stopThread(1000);
+}
+
+void GrainRenderPool::runTasks(int numTasks, TaskFunction function, void* context) {
+    if (numTasks <= 0) return;
+
+    // Busy, or nothing to share - run the batch here
+    if (numTasks == 1 || workers.empty() || inUse.exchange(true, std::memory_order_acquire)) {
+        for (int i = 0; i < numTasks; i++) function(context, i);
+        return;
+    }
+
+    // Nothing else is in a task, so the batch can be set up before publishing it in claims
+    batchFunction = function;
+    batchContext = context;
+    tasksDone.store(0, std::memory_order_relaxed);
+    claims.store(static_cast<uint64_t>(numTasks) << 32, std::memory_order_release);
+
+    wakeWorkers.release(std::min(static_cast<std::ptrdiff_t>(workers.size()), static_cast<std::ptrdiff_t>(numTasks - 1)));
+
+    while (runNextTask()) {}
+
+    // Only tasks a worker has already started can be left, so wait for those
+    while (tasksDone.load(std::memory_order_acquire) < numTasks) std::this_thread::yield();
+
+    // Close the batch, so workers that wake late find nothing to do
+    claims.store(0, std::memory_order_relaxed);
+    inUse.store(false, std::memory_order_release);
+}
+
+bool GrainRenderPool::runNextTask() {
+    const auto claim = claims.fetch_add(1, std::memory_order_acq_rel);
+    const auto task = static_cast<uint32_t>(claim);
+    const auto numTasks = static_cast<uint32_t>(claim >> 32);
+    if (task >= numTasks) return false;
+
+    batchFunction(batchContext, static_cast<int>(task));
+    tasksDone.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+void GrainRenderPool::Worker::run() {
+    while (!threadShouldExit()) {
+        pool.wakeWorkers.acquire();
+        while (!threadShouldExit() && pool.runNextTask()) {}
+    }
+}
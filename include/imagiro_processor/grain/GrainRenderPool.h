@@ -0,0 +1,60 @@
+//
+// Worker threads that help the audio thread render grains.
+//
+
+#pragma once
+#include <juce_core/juce_core.h>
+
+#include <atomic>
+#include <semaphore>
+
+// Runs a batch of tasks on a few realtime worker threads and the calling thread together, returning
+// once every task has finished. Used by GrainCloud to split its grains between cores.
+//
+// run() doesn't lock or allocate: workers are woken with a semaphore and take tasks from an atomic
+// counter, and the calling thread takes tasks too rather than waiting, so a batch finishes even if
+// no worker wakes up in time. If another run() is already using the pool (another voice, say), the
+// batch just runs on the calling thread. Tasks are the same however they end up being run, so the
+// callers' output doesn't depend on how busy the pool was.
+//
+// Shared process-wide, get it with juce::SharedResourcePointer<GrainRenderPool>.
+class GrainRenderPool {
+public:
+    GrainRenderPool() : GrainRenderPool(std::max(0, juce::SystemStats::getNumCpus() / 2 - 1)) {}
+    explicit GrainRenderPool(int numWorkers);
+    ~GrainRenderPool();
+
+    int getNumWorkers() const { return static_cast<int>(workers.size()); }
+
+    // Calls task(i) for every i in [0, numTasks), in any order and from any of the threads
+    template <typename Task>
+    void run(int numTasks, Task& task) {
+        runTasks(numTasks, [](void* context, int i) { (*static_cast<Task*>(context))(i); }, &task);
+    }
+
+private:
+    using TaskFunction = void (*)(void* context, int task);
+
+    class Worker : public juce::Thread {
+    public:
+        explicit Worker(GrainRenderPool& p) : juce::Thread("GrainRenderPool"), pool(p) {}
+        void run() override;
+
+    private:
+        GrainRenderPool& pool;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    void runTasks(int numTasks, TaskFunction function, void* context);
+    bool runNextTask();
+
+    std::atomic<bool> inUse {false};
+    std::counting_semaphore<> wakeWorkers {0};
+
+    // The batch being run. claims holds the number of tasks in its top half and the next task to
+    // take in the bottom, so a worker can't take a task from one batch and run it with the next.
+    TaskFunction batchFunction {nullptr};
+    void* batchContext {nullptr};
+    std::atomic<uint64_t> claims {0};
+    std::atomic<int> tasksDone {0};
+};
@@ -0,0 +1,175 @@
+//
+// Plans the read positions of a grain for one chunk of a block.
+//
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "GrainSampleData.h"
+
+// Positions move along a pitch ramp, and only a few things change how they're worked out: wrapping
+// at the loop end, the loop crossfade starting, and entering or leaving the crossfade region. The
+// planner works out from the ramp how many samples are certain to pass before the next of these,
+// fills that stretch as a straight segment with no loop logic in it, and only runs the full checks
+// (step()) for the samples around each event. The result is identical to checking every sample.
+class GrainSegmentPlanner {
+public:
+    struct LoopBounds {
+        int loopStartSample = 0;
+        int loopEndSample = 0;
+        int loopCrossfadeSamples = 0;
+        int loopFadeStart = 0;
+        int loopFadeStartReverse = 0;
+        int loopLengthSamples = 0;
+    };
+
+    struct Ramp {
+        double startPitchRatio = 1;
+        double pitchRatioPerSample = 0;
+        int numSamples = 0;
+
+        double getPitchRatio(int s) const { return startPitchRatio + static_cast<float>(s) * pitchRatioPerSample; }
+
+        // Largest distance any one sample moves, the ramp being linear
+        double getMaxStep() const {
+            return std::max(std::abs(startPitchRatio), std::abs(getPitchRatio(numSamples - 1)));
+        }
+    };
+
+    GrainSegmentPlanner(const LoopBounds& bounds, bool loopActive, bool reverse)
+        : bounds(bounds), loopActive(loopActive), reverse(reverse) {
+    }
+
+    // Fill data[0, ramp.numSamples), starting from pos and looping (which are updated)
+    void plan(GrainSampleData* data, const Ramp& ramp, double& pos, bool& looping) const {
+        const auto maxStep = ramp.getMaxStep();
+
+        for (int s = 0; s < ramp.numSamples;) {
+            const auto end = s + std::min(ramp.numSamples - s, getSamplesBeforeEvent(pos, looping, maxStep));
+            if (end == s) {
+                step(data[s], ramp.getPitchRatio(s), pos, looping);
+                s++;
+                continue;
+            }
+
+            switch (getFadeRegion(pos, looping)) {
+                case FadeRegion::Forward: fill<FadeRegion::Forward>(data, s, end, ramp, pos, looping); break;
+                case FadeRegion::Reverse: fill<FadeRegion::Reverse>(data, s, end, ramp, pos, looping); break;
+                case FadeRegion::None: fill<FadeRegion::None>(data, s, end, ramp, pos, looping); break;
+            }
+            s = end;
+        }
+    }
+
+    // Reference version, checking every sample
+    void planPerSample(GrainSampleData* data, const Ramp& ramp, double& pos, bool& looping) const {
+        for (int s = 0; s < ramp.numSamples; s++) step(data[s], ramp.getPitchRatio(s), pos, looping);
+    }
+
+    // Advance one sample with all the loop checks
+    void step(GrainSampleData& sample, double pitchRatio, double& pos, bool& looping) const {
+        pos += pitchRatio;
+
+        // Handle loop wrapping
+        if (loopActive) {
+            if (!reverse && pos >= bounds.loopEndSample) {
+                pos -= bounds.loopLengthSamples;
+                pos += bounds.loopCrossfadeSamples;
+                looping = false;
+            } else if (reverse && pos <= bounds.loopStartSample) {
+                pos += bounds.loopLengthSamples;
+                pos -= bounds.loopCrossfadeSamples;
+                looping = false;
+            }
+
+            // Check for loop fade start
+            if (!reverse && pos - pitchRatio < bounds.loopFadeStart && pos >= bounds.loopFadeStart) {
+                looping = true;
+            } else if (reverse && pos - pitchRatio > bounds.loopFadeStartReverse && pos <= bounds.loopFadeStartReverse) {
+                looping = true;
+            }
+        }
+
+        sample.position = pos;
+        sample.looping = looping;
+        setFade(sample, pos, looping ? regionAt(pos) : FadeRegion::None);
+    }
+
+private:
+    const LoopBounds& bounds;
+    const bool loopActive;
+    const bool reverse;
+
+    enum class FadeRegion {
+        None,
+        Forward,
+        Reverse
+    };
+
+    FadeRegion regionAt(double pos) const {
+        if (bounds.loopCrossfadeSamples <= 0) return FadeRegion::None;
+        if (!reverse && pos >= bounds.loopFadeStart && pos <= bounds.loopEndSample + 1) return FadeRegion::Forward;
+        if (reverse && pos >= bounds.loopStartSample - 1 && pos <= bounds.loopFadeStartReverse) return FadeRegion::Reverse;
+        return FadeRegion::None;
+    }
+
+    FadeRegion getFadeRegion(double pos, bool looping) const {
+        return looping ? regionAt(pos) : FadeRegion::None;
+    }
+
+    void setFade(GrainSampleData& sample, double pos, FadeRegion region) const {
+        if (region == FadeRegion::Forward) {
+            const auto distanceIntoFade = pos - bounds.loopFadeStart;
+            sample.loopFadePointer = bounds.loopStartSample + distanceIntoFade;
+            sample.loopFadeProgress = distanceIntoFade / bounds.loopCrossfadeSamples;
+        } else if (region == FadeRegion::Reverse) {
+            const auto distanceIntoFade = bounds.loopFadeStartReverse - pos;
+            sample.loopFadePointer = bounds.loopEndSample - distanceIntoFade;
+            sample.loopFadeProgress = distanceIntoFade / bounds.loopCrossfadeSamples;
+        } else {
+            sample.loopFadePointer = -1;
+            sample.loopFadeProgress = 0;
+        }
+    }
+
+    // Samples from pos that can't reach any position where step() would decide differently.
+    // Each sample moves at most maxStep, and a sample's margin keeps the previous position (which the
+    // crossfade start check compares) on the same side too.
+    int getSamplesBeforeEvent(double pos, bool looping, double maxStep) const {
+        constexpr auto margin = 1.0;
+        auto distance = std::numeric_limits<double>::max();
+        const auto consider = [&](double threshold) { distance = std::min(distance, std::abs(pos - threshold)); };
+
+        if (loopActive) {
+            // Already past the wrap (e.g. started outside the loop), step() wraps on the next sample
+            if (!reverse ? pos >= bounds.loopEndSample : pos <= bounds.loopStartSample) return 0;
+
+            consider(reverse ? bounds.loopStartSample : bounds.loopEndSample);
+            consider(reverse ? bounds.loopFadeStartReverse : bounds.loopFadeStart);
+        }
+        if (looping && bounds.loopCrossfadeSamples > 0) {
+            consider(bounds.loopFadeStart);
+            consider(bounds.loopEndSample + 1);
+            consider(bounds.loopStartSample - 1);
+            consider(bounds.loopFadeStartReverse);
+        }
+
+        if (distance == std::numeric_limits<double>::max() || maxStep <= 0) return std::numeric_limits<int>::max();
+        if (distance <= margin) return 0;
+        return static_cast<int>(std::min((distance - margin) / maxStep, static_cast<double>(std::numeric_limits<int>::max())));
+    }
+
+    // A straight segment: no wraps, and the crossfade region (if any) stays the same throughout
+    template <FadeRegion region>
+    void fill(GrainSampleData* data, int start, int end, const Ramp& ramp, double& pos, bool looping) const {
+        for (int s = start; s < end; s++) {
+            pos += ramp.getPitchRatio(s);
+            auto& sample = data[s];
+            sample.position = pos;
+            sample.looping = looping;
+            setFade(sample, pos, region);
+        }
+    }
+};
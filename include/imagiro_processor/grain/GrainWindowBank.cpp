@@ -0,0 +1,71 @@
+//
+// Window tables shared by every grain.
+//
+#include "GrainWindowBank.h"
+#include "imagiro_util/util.h"
+
+using namespace imagiro;
+
+GrainWindowBank::GrainWindowBank() {
+    flat.fill(1.f);
+    build(33, 33);
+}
+
+GrainWindowBank::Window GrainWindowBank::getWindow(float shape, float skew) const {
+    const auto* tables = current.load(std::memory_order_acquire);
+
+    const auto x = std::clamp(shape, 0.f, 1.f) * static_cast<float>(tables->numShapes - 1);
+    const auto shapeIndex = std::min(static_cast<int>(x), tables->numShapes - 2);
+    const auto normalizedSkew = (std::clamp(skew, -maxSkew, maxSkew) + maxSkew) / (2 * maxSkew);
+    const auto skewIndex = static_cast<int>(std::lround(normalizedSkew * static_cast<float>(tables->numSkews - 1)));
+
+    const auto table = static_cast<size_t>(skewIndex * tables->numShapes + shapeIndex);
+    return {tables->data.data() + table * tableStride, x - static_cast<float>(shapeIndex)};
+}
+
+void GrainWindowBank::build(int numShapes, int numSkews) {
+    auto tables = std::make_unique<Tables>();
+    tables->numShapes = std::max(2, numShapes);
+    tables->numSkews = std::max(1, numSkews);
+    tables->data.resize(static_cast<size_t>(tables->numShapes * tables->numSkews * tableStride));
+
+    auto* point = tables->data.data();
+    for (int k = 0; k < tables->numSkews; k++) {
+        const auto skew = tables->numSkews > 1
+            ? -maxSkew + 2 * maxSkew * static_cast<float>(k) / static_cast<float>(tables->numSkews - 1)
+            : 0.f;
+        for (int s = 0; s < tables->numShapes; s++) {
+            const auto shape = static_cast<float>(s) / static_cast<float>(tables->numShapes - 1);
+            for (int i = 0; i < tableStride; i++) {
+                *point++ = getGrainShapeGain(static_cast<float>(i) / tableSize, shape, skew);
+            }
+        }
+    }
+
+    std::lock_guard lock(buildMutex);
+    current.store(tables.get(), std::memory_order_release);
+    allTables.push_back(std::move(tables));
+}
+
+float GrainWindowBank::getGrainShapeGain(float p, float sym, float skew) {
+    if (skew < 0)
+        p = pow(p, fastexp(skew));
+    else if (skew > 0) {
+        p = pow(1 - p, fastexp(-skew));
+    }
+
+    auto alphaStart = std::max(1 - sym, 0.001f);
+    auto alphaEnd = alphaStart;
+    auto pInv = 1 - p;
+
+    float v;
+    if (2 * pInv <= alphaEnd) {
+        v = 0.5f * (1 - fastcos((juce::MathConstants<float>::twoPi * pInv) / alphaEnd));
+    } else if (2 * p <= alphaStart) {
+        v = 0.5f * (1 - fastcos((juce::MathConstants<float>::twoPi * p) / alphaStart));
+    } else v = 1.f;
+
+    jassert(!std::isnan(v));
+
+    return v;
+}
@@ -0,0 +1,70 @@
+//
+// Window tables shared by every grain.
+//
+
+#pragma once
+#include <juce_core/juce_core.h>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+
+// Grain windows for a grid of shapes and skews, worked out once rather than every time a grain
+// starts. A grain looks up its window with getWindow(), which is realtime safe, and then only holds
+// a pointer into the bank and a weight between two neighbouring shapes.
+//
+// The tables are immutable. build() makes a new set and swaps it in atomically; the old sets are
+// kept until the bank goes, so grains that are playing can keep reading theirs.
+//
+// Shared process-wide, get it with juce::SharedResourcePointer<GrainWindowBank>.
+class GrainWindowBank {
+public:
+    static constexpr int tableSize = 128; // segments per window, with a point at each end
+    static constexpr int tableStride = tableSize + 1;
+    static constexpr float maxSkew = 1.f; // skews are clamped to [-maxSkew, maxSkew]
+
+    struct Window {
+        const float* table {nullptr}; // the next shape's table follows, tableStride later
+        float weight {0};             // towards the next shape
+
+        // Gain at p (0-1) through the grain
+        float getGain(float p) const {
+            const auto x = std::clamp(p, 0.f, 1.f) * tableSize;
+            const auto i = std::min(static_cast<int>(x), tableSize - 1);
+            const auto f = x - static_cast<float>(i);
+            const auto* a = table + i;
+            const auto* b = a + tableStride;
+            const auto ga = a[0] + f * (a[1] - a[0]);
+            const auto gb = b[0] + f * (b[1] - b[0]);
+            return ga + weight * (gb - ga);
+        }
+    };
+
+    GrainWindowBank();
+
+    // Realtime safe
+    Window getWindow(float shape, float skew) const;
+
+    // Full volume throughout, for grains with no duration
+    Window getFlatWindow() const { return {flat.data(), 0}; }
+
+    // Swap in tables for a finer or coarser grid (shapes are interpolated between, skews rounded to
+    // the nearest). Not realtime safe.
+    void build(int numShapes, int numSkews);
+
+    // Window gain at p (0-1) through a grain with the given shape and skew
+    static float getGrainShapeGain(float p, float sym, float skew);
+
+private:
+    struct Tables {
+        int numShapes;
+        int numSkews;
+        std::vector<float> data; // by skew, then shape
+    };
+
+    std::atomic<const Tables*> current {nullptr};
+    std::mutex buildMutex;
+    std::vector<std::unique_ptr<const Tables>> allTables;
+
+    std::array<float, 2 * tableStride> flat;
+};
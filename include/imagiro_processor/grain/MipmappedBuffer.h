@@ -4,13 +4,21 @@
 
 #pragma once
 #include <array>
+#include <functional>
+#include <vector>
 
-#include "imagiro_processor/src/dsp/filter/CascadedBiquadFilter.h"
 #include "juce_audio_basics/juce_audio_basics.h"
+#include "juce_dsp/juce_dsp.h"
 
+// Pyramid of progressively band-limited and decimated copies of a buffer. Level i holds the audio at
+// 1/2^i of the original rate, so all the levels together take under twice the original's memory.
+// Reading level i with the increment divided by 2^i plays back at high pitches without aliasing.
 template <int Resolution = 1>
 class MipmappedBuffer {
 public:
+    // Runs fn(c) for every channel, in parallel if it likes, returning once all are done
+    using ForEachChannel = std::function<void(int numChannels, const std::function<void(int)>& fn)>;
+
     MipmappedBuffer() {
         for (auto& b : mipmapBuffers) {
             b = std::make_shared<juce::AudioSampleBuffer>(0, 0);
@@ -24,43 +32,132 @@ public:
         setBuffer(buffer, sampleRate);
     }
 
-    void setBuffer(std::shared_ptr<juce::AudioSampleBuffer> buffer, const float sampleRate) {
+    // Build the levels below source without keeping it as level 0, for owners that hold it anyway
+    // (see imagiro::MipmapTransform). getBuffer(0) is then empty.
+    MipmappedBuffer(const juce::AudioSampleBuffer& source, const double sampleRate,
+                    const ForEachChannel& forEachChannel = sequential) {
+        mipmapBuffers[0] = std::make_shared<juce::AudioSampleBuffer>(0, 0);
+        originalSampleRate = sampleRate;
+        generateMipMaps(source, forEachChannel);
+    }
+
+    void setBuffer(std::shared_ptr<juce::AudioSampleBuffer> buffer, const float sampleRate,
+                   const ForEachChannel& forEachChannel = sequential) {
         mipmapBuffers[0] = buffer;
         originalSampleRate = sampleRate;
-        generateMipMaps();
+        generateMipMaps(*buffer, forEachChannel);
+    }
+
+    std::shared_ptr<juce::AudioSampleBuffer> getBuffer(size_t level) const {
+        return mipmapBuffers[std::min(level, static_cast<size_t>(Resolution - 1))];
+    }
+
+    // Same as getBuffer(level)->getReadPointer(channel), without touching the reference count
+    const float* getReadPointer(size_t level, int channel) const {
+        return mipmapBuffers[std::min(level, static_cast<size_t>(Resolution - 1))]->getReadPointer(channel);
+    }
+
+    // Level i sample n lines up with sample n * getDecimation(i) of the original
+    static int getDecimation(size_t level) {
+        return 1 << std::min(level, static_cast<size_t>(Resolution - 1));
     }
 
-    std::shared_ptr<juce::AudioSampleBuffer> getBuffer(size_t factor) {
-        return mipmapBuffers[std::min(factor, static_cast<size_t>(Resolution - 1))];
+    // Coarsest level that still has at least one sample per read increment (in original samples)
+    static size_t getLevelForIncrement(double increment) {
+        size_t level = 0;
+        while (level + 1 < static_cast<size_t>(Resolution) && std::abs(increment) >= 2 << level) level++;
+        return level;
     }
 
     static int getResolution() { return Resolution; }
     double getSampleRate() const { return originalSampleRate; }
 
+    // Memory taken by the levels this holds
+    size_t getSizeInBytes() const {
+        size_t size = 0;
+        for (const auto& b : mipmapBuffers) {
+            size += static_cast<size_t>(b->getNumChannels()) * static_cast<size_t>(b->getNumSamples()) * sizeof(float);
+        }
+        return size;
+    }
+
+    static void sequential(int numChannels, const std::function<void(int)>& fn) {
+        for (auto c = 0; c < numChannels; c++) fn(c);
+    }
+
 private:
+    // Non-zero taps of the half-band filter, at odd offsets 1, 3, 5... from the centre (which is 0.5).
+    // Every even offset is zero, so each output only needs halfbandTaps multiplies per side.
+    static constexpr int halfbandTaps = 12;
 
-    void generateMipMaps() {
-        const auto originalBuffer = mipmapBuffers[0];
+    static std::array<float, halfbandTaps> createHalfbandCoefficients() {
+        constexpr auto windowSize = 4 * halfbandTaps - 1;
+        constexpr auto centre = 2 * halfbandTaps - 1;
+        std::array<float, windowSize> window {};
+        juce::dsp::WindowingFunction<float>::fillWindowingTables(window.data(), windowSize,
+            juce::dsp::WindowingFunction<float>::kaiser, false, 8.f);
 
-        for (auto i=1; i<Resolution; i++) {
-            mipmapBuffers[i]->setSize(originalBuffer->getNumChannels(), originalBuffer->getNumSamples());
+        std::array<float, halfbandTaps> coefficients {};
+        auto sum = 0.f;
+        for (auto k = 0; k < halfbandTaps; k++) {
+            const auto offset = 2 * k + 1;
+            const auto sinc = std::sin(juce::MathConstants<float>::halfPi * offset)
+                              / (juce::MathConstants<float>::pi * offset);
+            coefficients[k] = sinc * window[centre + offset];
+            sum += coefficients[k];
+        }
 
-            CascadedBiquadFilter<8> filter;
-            filter.setChannels(originalBuffer->getNumChannels());
-            filter.setSampleRate(originalSampleRate);
-            const auto factor = 1.f / (i + 1.f);
-            filter.setCutoff(originalSampleRate * 0.5 * factor);
+        // Unity gain at DC: 0.5 + 2 * sum = 1
+        for (auto& c : coefficients) c *= 0.25f / sum;
+        return coefficients;
+    }
 
-            for (auto c=0; c<originalBuffer->getNumChannels(); c++) {
-                for (auto s=0; s<mipmapBuffers[i]->getNumSamples(); s++) {
-                    const auto input = originalBuffer->getSample(c, s);
-                    const auto filtered = filter.process(input, c);
-                    mipmapBuffers[i]->setSample(c, s, filtered);
-                }
-            }
+    // Filter and decimate one channel by 2. Works on the polyphase split, so every step is a
+    // vectorised multiply-add over the whole output.
+    static void decimateChannel(const float* input, int numInput, float* output, int numOutput,
+                                const std::array<float, halfbandTaps>& coefficients,
+                                std::vector<float>& odd) {
+        // Odd input samples with halfbandTaps zeros either side, so shifted reads stay in range
+        odd.assign(static_cast<size_t>(numOutput + 2 * halfbandTaps), 0.f);
+        for (auto n = 0; 2 * n + 1 < numInput; n++) odd[halfbandTaps + n] = input[2 * n + 1];
+
+        // Centre tap, from the even samples
+        for (auto n = 0; n < numOutput; n++) output[n] = 2 * n < numInput ? 0.5f * input[2 * n] : 0.f;
+
+        // x[2n - (2k+1)] is odd[n - k - 1], x[2n + (2k+1)] is odd[n + k]
+        const auto* oddStart = odd.data() + halfbandTaps;
+        for (auto k = 0; k < halfbandTaps; k++) {
+            juce::FloatVectorOperations::addWithMultiply(output, oddStart - k - 1, coefficients[k], numOutput);
+            juce::FloatVectorOperations::addWithMultiply(output, oddStart + k, coefficients[k], numOutput);
         }
     }
 
+    void generateMipMaps(const juce::AudioSampleBuffer& original, const ForEachChannel& forEachChannel) {
+        const auto numChannels = original.getNumChannels();
+
+        // Each level keeps a couple of samples of the filter's tail past the end, so an interpolator
+        // reading up to the last original sample never runs off the end of a level
+        auto previousLength = original.getNumSamples();
+        for (auto i = 1; i < Resolution; i++) {
+            previousLength = (previousLength + 1) / 2 + 2;
+            mipmapBuffers[i] = std::make_shared<juce::AudioSampleBuffer>(numChannels, previousLength);
+        }
+
+        static const auto coefficients = createHalfbandCoefficients();
+
+        // Channels are independent, each builds its whole pyramid in one go
+        forEachChannel(numChannels, [&](int c) {
+            std::vector<float> scratch;
+            for (auto i = 1; i < Resolution; i++) {
+                const auto& source = i == 1 ? original : *mipmapBuffers[i - 1];
+                auto& destination = *mipmapBuffers[i];
+                decimateChannel(source.getReadPointer(c), source.getNumSamples(),
+                                destination.getWritePointer(c), destination.getNumSamples(),
+                                coefficients, scratch);
+            }
+        });
+    }
+
     std::array<std::shared_ptr<juce::AudioSampleBuffer>, Resolution> mipmapBuffers;
     double originalSampleRate {0};
 };
@@ -6,7 +6,7 @@
 #include "../../processor/Processor.h"
 #include "Parameters.h"
 #include "../../grain/Grain.h"
-#include "imagiro_processor/src/bufferpool/FileBufferCache.h"
+#include "../../bufferpool/SharedFileBufferCache.h"
 #include "imagiro_processor/src/dsp/XORRandom.h"
 #include "imagiro_processor/src/dsp/filter/CascadedOnePoleFilter.h"
 #include "imagiro_processor/src/valuedata/Serialize.h"
@@ -183,7 +183,7 @@ private:
     juce::AudioSampleBuffer noiseBuffer;
     std::vector<GrainSampleData> sampleDataBuffer;
 
-    FileBufferCache fbc;
+    SharedFileBufferCache fbc;
     SerializableValue<std::string> filePath {valueData, "filePath", "", true};
     std::shared_ptr<InfoBuffer> loadedBuffer;
 
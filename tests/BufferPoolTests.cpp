@@ -0,0 +1,376 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <imagiro_processor/bufferpool/FileBufferCache.h>
+#include <imagiro_processor/bufferpool/AnalysisTransforms.h>
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <thread>
+
+using namespace imagiro;
+using Catch::Matchers::WithinAbs;
+
+namespace {
+    // Sines written to a temporary WAV file, deleted again when it goes out of scope
+    struct TempWav {
+        juce::File file;
+
+        explicit TempWav(int numSamples, int bitsPerSample = 24, double sampleRate = 48000, int numChannels = 1) {
+            file = juce::File::getSpecialLocation(juce::File::tempDirectory)
+                       .getNonexistentChildFile("imagiro_bufferpool_test", ".wav");
+
+            juce::AudioSampleBuffer samples(numChannels, numSamples);
+            for (int c = 0; c < numChannels; c++) {
+                for (int s = 0; s < numSamples; s++) {
+                    samples.setSample(c, s, 0.5f * std::sin(0.01f * static_cast<float>((c + 1) * s)));
+                }
+            }
+
+            auto stream = std::make_unique<juce::FileOutputStream>(file);
+            juce::WavAudioFormat wav;
+            std::unique_ptr<juce::AudioFormatWriter> writer(
+                wav.createWriterFor(stream.get(), sampleRate, static_cast<unsigned int>(numChannels), bitsPerSample, {}, 0));
+            REQUIRE(writer != nullptr);
+            stream.release(); // owned by the writer now
+            REQUIRE(writer->writeFromAudioSampleBuffer(samples, 0, numSamples));
+        }
+
+        ~TempWav() { file.deleteFile(); }
+
+        std::string getPath() const { return file.getFullPathName().toStdString(); }
+    };
+}
+
+TEST_CASE("Compact requests only cache the compact result", "[bufferpool][compact]") {
+    TempWav wav(48000);
+    FileBufferCache pool;
+
+    SECTION("straight from the source") {
+        auto result = pool.request(wav.getPath()).compact().executeBlocking();
+        REQUIRE(result.has_value());
+        REQUIRE(result.value()->isCompact());
+        REQUIRE(pool.getCurrentCacheSize() == result.value()->getSizeInBytes());
+    }
+
+    SECTION("after another transform") {
+        auto result = pool.request(wav.getPath())
+                          .transform(std::make_unique<GainTransform>(-6.f))
+                          .compact()
+                          .executeBlocking();
+        REQUIRE(result.has_value());
+
+        // The source is still cached, but not the float samples the gain made
+        auto source = pool.request(wav.getPath()).executeBlocking();
+        REQUIRE(source.has_value());
+        REQUIRE(pool.getCurrentCacheSize() == source.value()->getSizeInBytes() + result.value()->getSizeInBytes());
+    }
+}
+
+TEST_CASE("Reversing a stereo buffer swaps its padding", "[bufferpool][reverse]") {
+    TempWav wav(4800, 24, 48000, 2);
+    FileBufferCache pool;
+
+    auto source = pool.request(wav.getPath()).executeBlocking();
+    auto result = pool.request(wav.getPath())
+                      .transform(std::make_unique<PadTransform>(3, 7))
+                      .transform(std::make_unique<ReverseTransform>())
+                      .executeBlocking();
+    REQUIRE(source.has_value());
+    REQUIRE(result.has_value());
+
+    const auto& reversed = *result.value();
+    REQUIRE(reversed.reversed);
+    REQUIRE(reversed.padStart == 7);
+    REQUIRE(reversed.padEnd == 3);
+    REQUIRE(reversed.buffer.getNumChannels() == 2);
+
+    const auto length = source.value()->buffer.getNumSamples();
+    REQUIRE(reversed.getLengthInSamples() == length);
+    for (int c = 0; c < 2; c++) {
+        for (int s = 0; s < length; s++) {
+            REQUIRE(reversed.buffer.getSample(c, reversed.padStart + s) ==
+                    source.value()->buffer.getSample(c, length - 1 - s));
+        }
+    }
+}
+
+TEST_CASE("Consecutive gains are applied in one pass", "[bufferpool][gain]") {
+    TempWav wav(48000);
+    FileBufferCache pool;
+
+    SECTION("fused by default") {
+        auto result = pool.request(wav.getPath())
+                          .transform(std::make_unique<GainTransform>(-6.f))
+                          .transform(std::make_unique<NormalizeTransform>())
+                          .executeBlocking();
+        REQUIRE(result.has_value());
+
+        // The peak is carried through the fused gains rather than measured again
+        const auto& buffer = result.value()->buffer;
+        REQUIRE_THAT(buffer.getMagnitude(0, 0, buffer.getNumSamples()), WithinAbs(1.0, 1e-4));
+        REQUIRE_THAT(result.value()->maxMagnitude, WithinAbs(1.0, 1e-4));
+
+        // Only the source and the result are cached, the stage after the first gain was never made
+        auto source = pool.request(wav.getPath()).executeBlocking();
+        REQUIRE(source.has_value());
+        REQUIRE(pool.getCurrentCacheSize() == source.value()->getSizeInBytes() + result.value()->getSizeInBytes());
+    }
+
+    SECTION("split where caching stops") {
+        auto result = pool.request(wav.getPath())
+                          .transform(std::make_unique<GainTransform>(-6.f))
+                          .transform(std::make_unique<NormalizeTransform>())
+                          .nocache(2)
+                          .executeBlocking();
+        REQUIRE(result.has_value());
+
+        auto gained = pool.request(wav.getPath())
+                          .transform(std::make_unique<GainTransform>(-6.f))
+                          .executeBlocking();
+        auto source = pool.request(wav.getPath()).executeBlocking();
+        REQUIRE(gained.has_value());
+        REQUIRE(source.has_value());
+        REQUIRE(pool.getCurrentCacheSize() == source.value()->getSizeInBytes() +
+                                                  gained.value()->getSizeInBytes() +
+                                                  result.value()->getSizeInBytes());
+    }
+}
+
+TEST_CASE("Analysis survives a reload from the disk cache", "[bufferpool][analysis]") {
+    TempWav wav(48000);
+    const auto directory = juce::File::getSpecialLocation(juce::File::tempDirectory)
+                               .getNonexistentChildFile("imagiro_bufferpool_disk", "");
+
+    const auto request = [&](FileBufferCache& pool) {
+        return pool.request(wav.getPath())
+            .transform(std::make_unique<PitchAnalysisTransform>())
+            .transform(std::make_unique<NormalizeTransform>())
+            .executeBlocking();
+    };
+
+    std::optional<float> pitchHz;
+    {
+        FileBufferCache pool;
+        pool.enablePersistentCache(directory);
+        auto result = request(pool);
+        REQUIRE(result.has_value());
+        REQUIRE(result.value()->analysis != nullptr);
+        pitchHz = result.value()->analysis->pitchHz;
+        // Queued writes are finished when the pool goes
+    }
+
+    {
+        FileBufferCache pool;
+        pool.enablePersistentCache(directory);
+        auto result = request(pool);
+        REQUIRE(result.has_value());
+        REQUIRE(pool.getLoaderMetrics().diskPrefixHits.load() == 1);
+        REQUIRE(result.value()->analysis != nullptr);
+        REQUIRE(result.value()->analysis->pitchHz == pitchHz);
+    }
+
+    directory.deleteRecursively();
+}
+
+namespace {
+    // A file source that cuts its file in half once the first chunk has been read, as if the file
+    // were truncated while it's loading
+    class TruncatingLoadTransform : public LoadTransform {
+    public:
+        using LoadTransform::LoadTransform;
+
+        std::unique_ptr<ChunkedSource> createChunkedSource() const override {
+            struct Truncating : ChunkedSource {
+                std::unique_ptr<ChunkedSource> source;
+                std::string path;
+                bool truncated {false};
+
+                bool prepare(InfoBuffer& info) override { return source->prepare(info); }
+
+                bool read(InfoBuffer& info, int startSample, int numSamples) override {
+                    if (startSample > 0 && !truncated) {
+                        std::filesystem::resize_file(path, std::filesystem::file_size(path) / 2);
+                        truncated = true;
+                    }
+                    return source->read(info, startSample, numSamples);
+                }
+
+                std::string getLastError() const override { return source->getLastError(); }
+            };
+
+            auto truncating = std::make_unique<Truncating>();
+            truncating->source = LoadTransform::createChunkedSource();
+            truncating->path = getFilePath();
+            return truncating;
+        }
+
+        std::unique_ptr<Transform> clone() const override {
+            return std::make_unique<TruncatingLoadTransform>(getFilePath(), getFormatManager());
+        }
+    };
+}
+
+TEST_CASE("Progressive loads that fail part way are reported through the buffer", "[bufferpool][progressive]") {
+    // Several progressive chunks long
+    TempWav wav(4 * 65536);
+    juce::AudioFormatManager afm;
+    afm.registerBasicFormats();
+
+    BufferCache cache;
+    BufferLoader loader(cache);
+
+    CacheKey key;
+    key.transforms.push_back(std::make_unique<TruncatingLoadTransform>(wav.getPath(), afm));
+    key.progressive = true;
+
+    // Handed out after the first chunk, before the file is cut short
+    auto result = loader.requestBuffer(key);
+    REQUIRE(result.has_value());
+    const auto buffer = result.value();
+    REQUIRE(buffer->progress != nullptr);
+
+    // The entry is marked as an error once the load has given up
+    const auto isError = [&] {
+        const auto entry = cache.get(key.getId());
+        return entry.has_value() && entry->state == CacheEntryState::Error;
+    };
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!isError() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    REQUIRE(isError());
+    REQUIRE(buffer->hasFailed());
+    REQUIRE_FALSE(buffer->isFullyLoaded());
+    REQUIRE(buffer->getReadySamples() < buffer->getNumStoredSamples());
+    REQUIRE(buffer->getLoadError().value().find("truncated") != std::string::npos);
+}
+
+namespace {
+    // A mono buffer at the given bit depth, as a file reader would decode it
+    std::shared_ptr<InfoBuffer> makeQuantised(const std::vector<int32_t>& values, int bits) {
+        auto info = std::make_shared<InfoBuffer>();
+        info->sampleRate = 48000;
+        info->maxMagnitude = 0;
+        info->buffer.setSize(1, static_cast<int>(values.size()));
+        const auto scale = static_cast<float>(1 << (bits - 1));
+        for (size_t i = 0; i < values.size(); i++) {
+            info->buffer.setSample(0, static_cast<int>(i), static_cast<float>(values[i]) / scale);
+        }
+        return info;
+    }
+
+    void requireRoundTrip(const InfoBuffer& original, float minRatio = 0.8f) {
+        const auto compressed = CompressedBuffer::compress(original, minRatio);
+        REQUIRE(compressed != nullptr);
+
+        const auto restored = compressed->decompress();
+        REQUIRE(restored->buffer.getNumChannels() == original.buffer.getNumChannels());
+        REQUIRE(restored->buffer.getNumSamples() == original.buffer.getNumSamples());
+        for (int c = 0; c < original.buffer.getNumChannels(); c++) {
+            for (int s = 0; s < original.buffer.getNumSamples(); s++) {
+                REQUIRE(restored->buffer.getSample(c, s) == original.buffer.getSample(c, s));
+            }
+        }
+    }
+}
+
+TEST_CASE("Compressed buffers decode to exactly what was stored", "[bufferpool][compression]") {
+    // Not a multiple of the block size, so the last block is a short one
+    constexpr auto numSamples = 3 * 4096 + 123;
+    std::mt19937 rng(3);
+
+    SECTION("silence") {
+        requireRoundTrip(*makeQuantised(std::vector<int32_t>(numSamples, 0), 16));
+    }
+
+    SECTION("full scale noise") {
+        for (const auto bits : {16, 24}) {
+            const auto limit = (1 << (bits - 1));
+            std::uniform_int_distribution<int32_t> dist(-limit, limit - 1);
+            std::vector<int32_t> values(numSamples);
+            for (auto& v : values) v = dist(rng);
+            values[0] = -limit;
+            values[1] = limit - 1;
+
+            // Noise doesn't shrink much, it only has to come back intact
+            requireRoundTrip(*makeQuantised(values, bits), 1.f);
+        }
+    }
+
+    SECTION("spikes in silence, which need the escape code") {
+        // The Rice parameter follows the quiet samples, so the spikes' residuals are far too long
+        // for it and have to be stored raw
+        std::vector<int32_t> values(numSamples, 0);
+        for (size_t i = 100; i < values.size(); i += 997) {
+            values[i] = (i / 997) % 2 == 0 ? (1 << 23) - 1 : -(1 << 23);
+        }
+        requireRoundTrip(*makeQuantised(values, 24));
+    }
+
+    SECTION("stereo") {
+        auto info = makeQuantised(std::vector<int32_t>(numSamples, 0), 16);
+        info->buffer.setSize(2, numSamples, true, true);
+        std::uniform_int_distribution<int32_t> dist(-1000, 1000);
+        for (int s = 0; s < numSamples; s++) {
+            info->buffer.setSample(1, s, static_cast<float>(dist(rng)) / 32768.f);
+        }
+        requireRoundTrip(*info);
+    }
+}
+
+TEST_CASE("Mipmaps are built from the content and counted in the cache", "[bufferpool][mipmap]") {
+    TempWav wav(48000, 24, 48000, 2);
+    FileBufferCache pool;
+
+    auto result = pool.request(wav.getPath())
+                      .transform(std::make_unique<PadTransform>(3, 3))
+                      .mipmaps()
+                      .executeBlocking();
+    REQUIRE(result.has_value());
+
+    const auto& info = *result.value();
+    REQUIRE(info.mipmaps != nullptr);
+
+    // Level 0 is the buffer itself, so it isn't stored twice
+    REQUIRE(info.mipmaps->getBuffer(0)->getNumSamples() == 0);
+
+    auto previousLength = info.getLengthInSamples();
+    for (size_t level = 1; level < InfoBuffer::mipmapLevels; level++) {
+        const auto& decimated = *info.mipmaps->getBuffer(level);
+        REQUIRE(decimated.getNumChannels() == 2);
+        REQUIRE(decimated.getNumSamples() >= previousLength / 2);
+        REQUIRE(decimated.getNumSamples() <= previousLength / 2 + 3);
+        previousLength = decimated.getNumSamples();
+
+        // The test sines are far below every level's cutoff, so they come through the filter intact.
+        // Padding isn't part of the content, so sample n lines up with content sample n * decimation.
+        const auto decimation = InfoBuffer::Mipmaps::getDecimation(level);
+        for (int c = 0; c < 2; c++) {
+            for (int s = 100; s < 1000; s += 97) {
+                REQUIRE_THAT(decimated.getSample(c, s),
+                             WithinAbs(info.buffer.getSample(c, info.padStart + s * decimation), 1e-3));
+            }
+        }
+    }
+
+    // The mipmapped result is charged for its levels as well as the samples it shares
+    auto source = pool.request(wav.getPath()).executeBlocking();
+    auto padded = pool.request(wav.getPath()).transform(std::make_unique<PadTransform>(3, 3)).executeBlocking();
+    REQUIRE(source.has_value());
+    REQUIRE(padded.has_value());
+    REQUIRE(info.getSizeInBytes() == padded.value()->getSizeInBytes() + info.mipmaps->getSizeInBytes());
+    REQUIRE(pool.getCurrentCacheSize() == source.value()->getSizeInBytes() +
+                                              padded.value()->getSizeInBytes() +
+                                              info.getSizeInBytes());
+
+    // Mipmaps end the chain
+    auto followed = pool.request(wav.getPath())
+                        .mipmaps()
+                        .transform(std::make_unique<GainTransform>(-6.f))
+                        .executeBlocking();
+    REQUIRE_FALSE(followed.has_value());
+}
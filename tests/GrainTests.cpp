@@ -0,0 +1,365 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <imagiro_processor/grain/GrainSettings.h>
+#include <imagiro_processor/grain/GrainSegmentPlanner.h>
+#include <imagiro_processor/grain/GrainCloud.h>
+#include <imagiro_processor/grain/GrainWindowBank.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace imagiro;
+using Catch::Matchers::WithinAbs;
+
+namespace {
+
+GrainSegmentPlanner::LoopBounds getBounds(const LoopSettings& loop, int bufferLength) {
+    return {
+        loop.getLoopStartSample(bufferLength),
+        loop.getLoopEndSample(bufferLength),
+        loop.getCrossfadeSamples(bufferLength),
+        loop.getCrossfadeStartSample(bufferLength),
+        loop.getReverseCrossfadeStartSample(bufferLength),
+        loop.getLoopLengthSamples(bufferLength)
+    };
+}
+
+// Plans consecutive blocks both ways, from the same start, and requires identical results
+void requireSamePlan(const LoopSettings& loop, bool reverse, double startPos, double pitchRatio,
+                     double pitchRatioEnd, int numBlocks, int blockSize) {
+    constexpr auto bufferLength = 48000;
+    const auto bounds = getBounds(loop, bufferLength);
+    const GrainSegmentPlanner planner(bounds, loop.loopActive, reverse);
+
+    std::vector<GrainSampleData> segmented(static_cast<size_t>(blockSize));
+    std::vector<GrainSampleData> perSample(static_cast<size_t>(blockSize));
+    auto segmentedPos = startPos, perSamplePos = startPos;
+    auto segmentedLooping = false, perSampleLooping = false;
+
+    for (int block = 0; block < numBlocks; block++) {
+        const auto t0 = static_cast<double>(block) / numBlocks;
+        const auto t1 = static_cast<double>(block + 1) / numBlocks;
+        const auto start = pitchRatio + (pitchRatioEnd - pitchRatio) * t0;
+        const auto end = pitchRatio + (pitchRatioEnd - pitchRatio) * t1;
+        const GrainSegmentPlanner::Ramp ramp {start, (end - start) / static_cast<float>(blockSize), blockSize};
+
+        planner.plan(segmented.data(), ramp, segmentedPos, segmentedLooping);
+        planner.planPerSample(perSample.data(), ramp, perSamplePos, perSampleLooping);
+
+        for (size_t s = 0; s < segmented.size(); s++) {
+            REQUIRE(segmented[s].position == perSample[s].position);
+            REQUIRE(segmented[s].looping == perSample[s].looping);
+            REQUIRE(segmented[s].loopFadePointer == perSample[s].loopFadePointer);
+            REQUIRE(segmented[s].loopFadeProgress == perSample[s].loopFadeProgress);
+        }
+        REQUIRE(segmentedPos == perSamplePos);
+        REQUIRE(segmentedLooping == perSampleLooping);
+    }
+}
+
+} // namespace
+
+TEST_CASE("Segment planner matches per-sample loop checks", "[grain][loop]") {
+    LoopSettings loop;
+    loop.loopStart = 0.2f;
+    loop.loopLength = 0.3f;
+    loop.loopCrossfade = 0.5f;
+    loop.loopActive = true;
+
+    // Long enough to wrap several times at every pitch
+    constexpr auto numBlocks = 400;
+    constexpr auto blockSize = 512;
+    const auto bounds = getBounds(loop, 48000);
+
+    SECTION("forward loop with crossfade") {
+        for (const auto pitch : {0.5, 1.0, 1.7, 3.3, 7.9}) {
+            requireSamePlan(loop, false, bounds.loopStartSample + 10.25, pitch, pitch, numBlocks, blockSize);
+        }
+    }
+
+    SECTION("reverse loop with crossfade") {
+        for (const auto pitch : {0.5, 1.0, 1.7, 3.3, 7.9}) {
+            requireSamePlan(loop, true, bounds.loopEndSample - 10.25, -pitch, -pitch, numBlocks, blockSize);
+        }
+    }
+
+    SECTION("pitch ramps") {
+        requireSamePlan(loop, false, bounds.loopStartSample + 3.5, 0.25, 6.0, numBlocks, blockSize);
+        requireSamePlan(loop, true, bounds.loopEndSample - 3.5, -6.0, -0.25, numBlocks, blockSize);
+    }
+
+    SECTION("starting outside the loop") {
+        // Past the wrap point, so the very first sample wraps back in
+        for (const auto crossfade : {0.5f, 0.f}) {
+            loop.loopCrossfade = crossfade;
+            for (const auto pitch : {1.0, 3.3}) {
+                requireSamePlan(loop, false, bounds.loopEndSample + 2000.5, pitch, pitch, 20, blockSize);
+                requireSamePlan(loop, true, bounds.loopStartSample - 2000.5, -pitch, -pitch, 20, blockSize);
+            }
+        }
+
+        // Before the loop, playing towards it
+        requireSamePlan(loop, false, bounds.loopStartSample - 2000.5, 1.3, 1.3, numBlocks, blockSize);
+        requireSamePlan(loop, true, bounds.loopEndSample + 2000.5, -1.3, -1.3, numBlocks, blockSize);
+    }
+
+    SECTION("no crossfade, and loop off") {
+        loop.loopCrossfade = 0.f;
+        requireSamePlan(loop, false, bounds.loopStartSample + 0.5, 1.3, 1.3, numBlocks, blockSize);
+        requireSamePlan(loop, true, bounds.loopEndSample - 0.5, -1.3, -1.3, numBlocks, blockSize);
+
+        loop.loopActive = false;
+        requireSamePlan(loop, false, 100.0, 1.1, 1.1, 20, blockSize);
+    }
+}
+
+TEST_CASE("Grain cloud recycles slots", "[grain][cloud]") {
+    constexpr auto sampleRate = 48000.0;
+    constexpr auto blockSize = 256;
+
+    auto info = std::make_shared<imagiro::InfoBuffer>();
+    info->sampleRate = sampleRate;
+    info->buffer.setSize(1, 48000);
+    juce::FloatVectorOperations::fill(info->buffer.getWritePointer(0), 1.f, info->buffer.getNumSamples());
+
+    GrainCloud cloud;
+    cloud.prepareToPlay(sampleRate, blockSize, 4);
+    cloud.setBuffer(info);
+
+    juce::AudioSampleBuffer out(2, blockSize);
+
+    SECTION("spawns fail once every slot is in use") {
+        GrainSettings settings;
+        settings.duration = 0.01f;
+        for (int i = 0; i < 4; i++) REQUIRE(cloud.spawn(settings));
+        REQUIRE_FALSE(cloud.spawn(settings));
+
+        // 480 samples each, so all finish within a few blocks and their slots can be used again
+        for (int block = 0; block < 4; block++) {
+            out.clear();
+            cloud.processBlock(out, 0, blockSize);
+        }
+        REQUIRE(cloud.getNumActiveGrains() == 0);
+        for (int i = 0; i < 4; i++) REQUIRE(cloud.spawn(settings));
+    }
+
+    SECTION("grains with no duration play at their gain") {
+        GrainSettings settings;
+        settings.duration = -1;
+        settings.position = 0.25f;
+        settings.gain = 0.25f;
+        REQUIRE(cloud.spawn(settings));
+        REQUIRE(cloud.spawn(settings, 100));
+
+        out.clear();
+        cloud.processBlock(out, 0, blockSize);
+        REQUIRE(cloud.getNumActiveGrains() == 2);
+        for (int c = 0; c < out.getNumChannels(); c++) {
+            REQUIRE_THAT(out.getSample(c, 99), WithinAbs(0.25, 1e-4));
+            REQUIRE_THAT(out.getSample(c, 100), WithinAbs(0.5, 1e-4));
+        }
+    }
+}
+
+TEST_CASE("Grain cloud reads reversed buffers in playback order", "[grain][cloud]") {
+    constexpr auto sampleRate = 48000.0;
+    constexpr auto blockSize = 256;
+    constexpr auto length = 4800;
+
+    // A ramp, and the same ramp stored back to front as ReverseTransform leaves it
+    auto forwards = std::make_shared<imagiro::InfoBuffer>();
+    auto backwards = std::make_shared<imagiro::InfoBuffer>();
+    for (auto& info : {forwards, backwards}) {
+        info->sampleRate = sampleRate;
+        info->buffer.setSize(1, length);
+    }
+    backwards->reversed = true;
+    for (int s = 0; s < length; s++) {
+        const auto value = static_cast<float>(s) / length;
+        forwards->buffer.setSample(0, s, value);
+        backwards->buffer.setSample(0, length - 1 - s, value);
+    }
+
+    const auto render = [&](const std::shared_ptr<imagiro::InfoBuffer>& info, bool reverse) {
+        GrainCloud cloud;
+        cloud.prepareToPlay(sampleRate, blockSize, 1);
+        cloud.setBuffer(info);
+
+        GrainSettings settings;
+        settings.duration = -1;
+        settings.position = 0.5f;
+        settings.reverse = reverse;
+        cloud.spawn(settings);
+
+        juce::AudioSampleBuffer out(1, blockSize);
+        out.clear();
+        cloud.processBlock(out, 0, blockSize);
+        return out;
+    };
+
+    for (const auto reverse : {false, true}) {
+        const auto expected = render(forwards, reverse);
+        const auto actual = render(backwards, reverse);
+
+        // Playing forwards through a rising ramp rises, playing in reverse falls
+        const auto rising = expected.getSample(0, blockSize - 1) > expected.getSample(0, 0);
+        REQUIRE(rising == !reverse);
+        for (int s = 0; s < blockSize; s++) {
+            REQUIRE_THAT(actual.getSample(0, s), WithinAbs(expected.getSample(0, s), 1e-4));
+        }
+    }
+}
+
+TEST_CASE("Grain cloud slots survive concurrent spawning", "[grain][cloud]") {
+    constexpr auto sampleRate = 48000.0;
+    constexpr auto blockSize = 64;
+    constexpr auto maxGrains = 64;
+    constexpr auto numSpawners = 4;
+
+    auto info = std::make_shared<imagiro::InfoBuffer>();
+    info->sampleRate = sampleRate;
+    info->buffer.setSize(1, 48000);
+    info->buffer.clear();
+
+    GrainCloud cloud;
+    cloud.prepareToPlay(sampleRate, blockSize, maxGrains);
+    cloud.setBuffer(info);
+
+    // Short grains, so slots go round the free list, the pending list and back many times
+    std::atomic<bool> stop {false};
+    std::atomic<uint64_t> numSpawned {0};
+    std::vector<std::thread> spawners;
+    for (int t = 0; t < numSpawners; t++) {
+        spawners.emplace_back([&, t] {
+            GrainSettings settings;
+            settings.duration = 0.002f;
+            settings.position = 0.1f * static_cast<float>(t + 1);
+            while (!stop.load()) {
+                if (cloud.spawn(settings, t)) numSpawned++;
+                else std::this_thread::yield();
+            }
+        });
+    }
+
+    juce::AudioSampleBuffer out(1, blockSize);
+    std::thread renderer([&] {
+        const auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (numSpawned.load() < 50 * maxGrains && std::chrono::steady_clock::now() < giveUp) {
+            out.clear();
+            cloud.processBlock(out, 0, blockSize);
+            if (cloud.getNumActiveGrains() > maxGrains) break;
+            std::this_thread::yield();
+        }
+        stop = true;
+    });
+
+    renderer.join();
+    for (auto& spawner : spawners) spawner.join();
+    REQUIRE(numSpawned.load() >= 50 * maxGrains);
+    REQUIRE(cloud.getNumActiveGrains() <= maxGrains);
+
+    // Start whatever is still pending, then no grain can be unaccounted for
+    out.clear();
+    cloud.processBlock(out, 0, blockSize);
+    REQUIRE(numSpawned.load() - cloud.getNumFinishedGrains() == static_cast<uint64_t>(cloud.getNumActiveGrains()));
+
+    // Once they've all finished every slot is free exactly once
+    for (int block = 0; block < 10; block++) {
+        out.clear();
+        cloud.processBlock(out, 0, blockSize);
+    }
+    REQUIRE(cloud.getNumActiveGrains() == 0);
+    REQUIRE(numSpawned.load() == cloud.getNumFinishedGrains());
+
+    GrainSettings settings;
+    for (int i = 0; i < maxGrains; i++) REQUIRE(cloud.spawn(settings));
+    REQUIRE_FALSE(cloud.spawn(settings));
+}
+
+TEST_CASE("Grain cloud output doesn't depend on the render pool", "[grain][cloud]") {
+    constexpr auto sampleRate = 48000.0;
+    constexpr auto blockSize = 256;
+    constexpr auto numBlocks = 100;
+
+    auto info = std::make_shared<imagiro::InfoBuffer>();
+    info->sampleRate = sampleRate;
+    info->buffer.setSize(2, 48000);
+    for (int c = 0; c < 2; c++) {
+        for (int s = 0; s < info->buffer.getNumSamples(); s++) {
+            info->buffer.setSample(c, s, std::sin(static_cast<float>(s) * 0.01f * static_cast<float>(c + 1)));
+        }
+    }
+
+    // Enough grains that the cloud is split into every part
+    const auto render = [&](GrainRenderPool& pool) {
+        GrainCloud cloud;
+        cloud.prepareToPlay(sampleRate, blockSize, 1024);
+        cloud.setRenderPool(&pool);
+        cloud.setBuffer(info);
+
+        FastRandom random(7);
+        juce::AudioSampleBuffer out(2, blockSize);
+        std::vector<float> rendered;
+        for (int block = 0; block < numBlocks; block++) {
+            for (int i = 0; i < 40; i++) {
+                GrainSettings settings;
+                settings.duration = 0.02f + 0.05f * random.nextFloat01();
+                settings.position = random.nextFloat01();
+                settings.pitch = random.nextFloat() * 12;
+                settings.spread = 0.5f;
+                settings.reverse = i % 3 == 0;
+                cloud.spawn(settings, i * 5);
+            }
+
+            out.clear();
+            cloud.processBlock(out, 0, blockSize);
+            for (int c = 0; c < out.getNumChannels(); c++) {
+                rendered.insert(rendered.end(), out.getReadPointer(c), out.getReadPointer(c) + blockSize);
+            }
+        }
+        REQUIRE(cloud.getNumActiveGrains() > 256);
+        return rendered;
+    };
+
+    GrainRenderPool callingThreadOnly(0), withWorkers(3);
+    const auto expected = render(callingThreadOnly);
+    const auto actual = render(withWorkers);
+
+    REQUIRE(actual.size() == expected.size());
+    for (size_t i = 0; i < actual.size(); i++) REQUIRE(actual[i] == expected[i]);
+}
+
+TEST_CASE("Window bank tables match the window function", "[grain][window]") {
+    GrainWindowBank bank;
+
+    SECTION("at grid points") {
+        for (const auto shape : {0.f, 0.25f, 0.5f, 1.f}) {
+            for (const auto skew : {-1.f, -0.5f, 0.f, 0.5f, 1.f}) {
+                const auto window = bank.getWindow(shape, skew);
+                for (int i = 0; i <= GrainWindowBank::tableSize; i++) {
+                    const auto p = static_cast<float>(i) / GrainWindowBank::tableSize;
+                    REQUIRE_THAT(window.getGain(p), WithinAbs(GrainWindowBank::getGrainShapeGain(p, shape, skew), 1e-6));
+                }
+            }
+        }
+    }
+
+    SECTION("between shapes") {
+        const auto window = bank.getWindow(0.4f, 0.5f);
+        for (int i = 0; i <= 64; i++) {
+            const auto p = static_cast<float>(i) / 64;
+            REQUIRE_THAT(window.getGain(p), WithinAbs(GrainWindowBank::getGrainShapeGain(p, 0.4f, 0.5f), 0.02));
+        }
+    }
+
+    SECTION("windows stay valid after a rebuild") {
+        const auto window = bank.getWindow(0.5f, 0.5f);
+        const auto before = window.getGain(0.1f);
+        bank.build(65, 65);
+        REQUIRE(window.getGain(0.1f) == before);
+        REQUIRE(bank.getFlatWindow().getGain(0.3f) == 1.f);
+    }
+}
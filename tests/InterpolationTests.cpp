@@ -0,0 +1,41 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <imagiro_processor/dsp/interpolation.h>
+
+#include <random>
+#include <vector>
+
+using namespace imagiro;
+using Catch::Matchers::WithinAbs;
+
+// Built with AVX2 where the compiler supports it (see CMakeLists.txt), so this covers the vector
+// path as well as the scalar one
+TEST_CASE("Block interpolation matches the scalar interpolator", "[grain][interpolation]") {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> sampleDist(-1.f, 1.f);
+    std::vector<float> samples(4096);
+    for (auto& s : samples) s = sampleDist(rng);
+
+    // An odd count, so the scalar tail after the vector lanes is covered too
+    std::uniform_real_distribution<double> indexDist(1.0, 4090.0);
+    std::vector<double> indices(1027);
+    for (auto& i : indices) i = indexDist(rng);
+    std::vector<float> block(indices.size());
+
+    SECTION("guarded") {
+        interp4p3o_2x_block<true>(samples.data(), indices.data(), block.data(), static_cast<int>(indices.size()));
+        for (size_t i = 0; i < indices.size(); i++) {
+            REQUIRE_THAT(block[i], WithinAbs(interp4p3o_2x_guarded(samples.data(), indices[i]), 1e-6));
+        }
+    }
+
+    SECTION("unguarded, including the first samples") {
+        indices[0] = 0.0;
+        indices[1] = 0.25;
+        indices[2] = 0.999;
+        interp4p3o_2x_block<false>(samples.data(), indices.data(), block.data(), static_cast<int>(indices.size()));
+        for (size_t i = 0; i < indices.size(); i++) {
+            REQUIRE_THAT(block[i], WithinAbs(interp4p3o_2x(samples.data(), indices[i]), 1e-6));
+        }
+    }
+}
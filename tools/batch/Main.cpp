@@ -0,0 +1,104 @@
+// imagiro-batch: runs a transform chain over a whole sample library, see BatchProcessor
+//
+//     imagiro-batch <input dir> <output dir> --chain "bandpass:30:18000,normalize,resample:48000"
+//                   [--jobs N] [--bits 16|24|32] [--max-resident-mb N] [--no-recursive] [--no-analysis]
+//                   [--json]
+
+#include <imagiro_processor/bufferpool/BatchProcessor.h>
+#include <iostream>
+#include <mutex>
+
+namespace {
+
+void printUsage() {
+    std::cerr << "Usage: imagiro-batch <input dir> <output dir> --chain <spec> [options]\n"
+                 "\n"
+                 "  --chain <spec>          comma separated transforms, e.g. \"bandpass:30:18000,normalize\"\n"
+                 "                          normalize, gain:<db>, bandpass:<low>:<high>, resample:<rate>,\n"
+                 "                          reverse, pitch[:<block size>], transients:<sensitivity>\n"
+                 "  --jobs <n>              files processed at once (default: number of cores)\n"
+                 "  --bits <16|24|32>       output bit depth (default 24)\n"
+                 "  --max-resident-mb <n>   cache quota for the batch (default 512)\n"
+                 "  --no-recursive          only the top level of the input directory\n"
+                 "  --no-analysis           don't write analysis results as .json next to the audio\n"
+                 "  --json                  print the final stats as JSON\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::StringArray args;
+    for (int i = 1; i < argc; i++) args.add(juce::CharPointer_UTF8(argv[i]));
+
+    imagiro::BatchProcessor::Options options;
+    juce::String chainSpec;
+    bool printJson = false;
+    juce::StringArray positional;
+
+    for (int i = 0; i < args.size(); i++) {
+        const auto& arg = args[i];
+        const auto hasValue = i + 1 < args.size();
+
+        if (arg == "--chain" && hasValue) chainSpec = args[++i];
+        else if (arg == "--jobs" && hasValue) options.numWorkers = std::max(1, args[++i].getIntValue());
+        else if (arg == "--bits" && hasValue) options.bitsPerSample = args[++i].getIntValue();
+        else if (arg == "--max-resident-mb" && hasValue) options.maxResidentBytes = static_cast<uint64_t>(args[++i].getLargeIntValue()) * 1024 * 1024;
+        else if (arg == "--no-recursive") options.recursive = false;
+        else if (arg == "--no-analysis") options.writeAnalysis = false;
+        else if (arg == "--json") printJson = true;
+        else if (arg == "--help" || arg == "-h") {
+            printUsage();
+            return 0;
+        } else if (arg.startsWith("--")) {
+            std::cerr << "Unknown option " << arg << "\n\n";
+            printUsage();
+            return 1;
+        } else positional.add(arg);
+    }
+
+    if (positional.size() != 2 || chainSpec.isEmpty()) {
+        printUsage();
+        return 1;
+    }
+
+    const auto cwd = juce::File::getCurrentWorkingDirectory();
+    options.inputDirectory = cwd.getChildFile(positional[0]);
+    options.outputDirectory = cwd.getChildFile(positional[1]);
+    if (!options.inputDirectory.isDirectory()) {
+        std::cerr << options.inputDirectory.getFullPathName() << " is not a directory\n";
+        return 1;
+    }
+
+    auto chain = imagiro::BatchProcessor::parseChain(chainSpec.toStdString());
+    if (!chain.has_value()) {
+        std::cerr << chain.error() << "\n";
+        return 1;
+    }
+
+    imagiro::FileBufferCache cache;
+    imagiro::BatchProcessor processor(cache, options);
+    processor.setChain(std::move(chain.value()));
+
+    std::mutex outputMutex;
+    const auto stats = processor.run([&](const juce::File& file, const std::string& error, size_t numDone, size_t numTotal) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        const auto name = file.getRelativePathFrom(options.inputDirectory);
+        if (error.empty()) std::cout << "[" << numDone << "/" << numTotal << "] " << name << "\n";
+        else std::cerr << "[" << numDone << "/" << numTotal << "] " << name << ": " << error << "\n";
+    });
+
+    if (printJson) {
+        std::cout << stats.toJson().dump(2) << "\n";
+    } else {
+        std::cout << "\n"
+                  << stats.filesProcessed << " files processed, " << stats.filesFailed << " failed in "
+                  << juce::String(stats.elapsedSeconds, 2) << "s\n"
+                  << juce::String(stats.getFilesPerSecond(), 1) << " files/s, "
+                  << juce::String(stats.getMegabytesPerSecond(), 1) << " MB/s read, "
+                  << juce::String(stats.getRealtimeFactor(), 1) << "x realtime\n";
+    }
+
+    return stats.filesFailed == 0 ? 0 : 2;
+}